@@ -1,475 +1,2128 @@
 #include "sham.h"
 
-// client state
-static connection_state_t state = CLOSED;
-static uint32_t client_seq = 0;
-static uint32_t server_seq = 0;
+// client state. per-connection state is thread-local: with --streams
+// every connection runs on a thread of its own
+static __thread connection_state_t state = CLOSED;
+static __thread uint32_t client_seq = 0;
+static __thread uint32_t server_seq = 0;
 static int sockfd = -1;
 static struct sockaddr_in server_addr;
+static cc_algo_t cc_algo = CC_NEWRENO;
+static digest_algo_t digest_algo = DIGEST_MD5; // end-to-end digest sent in the FIN
+static int sack_enabled = 1; // offer sack in the SYN
+static __thread int sack_ok = 0; // negotiated with the server
+static int use_mmap = 0;     // serve payloads from a file mapping
+static int batch_size = SEND_BATCH; // datagrams per sendmmsg
+static int use_gso = 1;      // coalesce batches with UDP_SEGMENT when available
+static int use_uring = 0;    // submit batches through io_uring when the kernel allows
+static int use_zerocopy = 0; // send large batches with MSG_ZEROCOPY
+static int zerocopy_min = ZEROCOPY_MIN_BYTES; // smallest sendmsg worth pinning pages for
+static __thread struct sham_syn_options syn_opts; // negotiated handshake options
+static int ack_freq_wanted = ACK_FREQ;   // delayed-ack frequency to request
+static __thread uint32_t peer_rwnd = BUFFER_SIZE; // receive window the server last advertised
+static int use_pmtud = 1;    // start at BASE_MSS and probe the path for larger segments
+static int mss_wanted = 0;   // largest payload to offer, 0 for the default
+static off_t input_size = 0; // announced in the SYN so the server can preallocate
+static int crc_enabled = 1;  // offer per-packet crc32c in the SYN
+static int crc_reported = 0; // the crc32c in use was logged (atomic: streams share it)
+static __thread uint16_t crc_flag = 0; // CRC_FLAG once the server accepted it, stamped on every packet
+static fec_mode_t fec_mode = FEC_NONE; // repair segments to offer
+static int fec_k = FEC_K;             // data segments per fec block
+static int fec_parity_max = FEC_PARITY; // most repairs per block (rs)
+static int use_pipeline = 0; // read, build and send on three threads
+static int stream_count = 1; // connections the file is striped over
+static int use_resume = 0;   // let the server keep a checkpoint, and pick up from it
+static uint32_t resume_id = 0;      // names the transfer for the server's checkpoint
+static uint64_t resume_limit = 0;   // most of the file to skip: all of it, or none after a mismatch
+static const char *resume_input = NULL;
+static off_t resume_from = 0;       // bytes the server holds that our input agrees with
+static struct sham_digest resume_digest; // over those bytes, for the FIN
+
+// --streams: the input is cut into STRIPE_UNIT-aligned ranges that the
+// connections, one thread each, claim as they go: a fresh STRIPE_CHUNK
+// while any is left, then the back half of what the stream with the most
+// left has not sent yet. a stream's bytes run through its ranges back to
+// back, and each data segment's ack_num says how far its file offset is
+// from its offset in the stream (STRIPE_SHIFT)
+struct stripe_flow
+{
+    off_t pos; // current range: first byte not yet cut into a segment
+    off_t end;
+};
+
+struct stripe
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t id;
+    int flows;
+    const char *filename;
+    off_t size;
+    off_t next; // first byte no range has covered yet
+    struct stripe_flow *flow;
+    unsigned long steals;
+    int ready;  // streams through the handshake
+    int failed; // and those among them that did not make it
+    // digest of the whole file, taken by a thread of its own while the
+    // streams send; every stream's FIN carries it
+    unsigned char digest[DIGEST_MAX];
+    int digest_len; // 0 until it is done, -1 if it failed
+    int verified;   // the receiver's digest came back in a FIN and matched
+};
+
+static __thread struct stripe *my_stripe = NULL; // this thread's transfer, if striped
+static __thread int my_flow = 0;                  // and its index in it
+
+// three way handshake for client: the SYN-ACK is awaited on a reactor
+struct handshake
+{
+    struct reactor reactor;
+    struct io_watch watch;
+    struct sham_timer timeout;
+    int sockfd;
+    struct sockaddr_in *addr;
+    int result; // 1 while waiting, then 0, -1 or HANDSHAKE_RETRY
+};
+
+#define HANDSHAKE_RETRY 2 // declined the server's resume offer: handshake again without one
+
+static void handshake_timeout(void *arg)
+{
+    struct handshake *hs = arg;
+    fprintf(stderr, "connection timeout: server not responding\n");
+    hs->result = -1;
+    reactor_stop(&hs->reactor);
+}
+
+// --resume: the server holds the first resume_from bytes of the file from
+// an earlier attempt. they are skipped only if our input hashes to the same
+// chain of chunk crcs, and go into the digest on the way; 0 if it does not
+static int resume_accept(void)
+{
+    uint64_t from = syn_opts.resume_from;
+    resume_from = 0;
+    if (syn_opts.resume != resume_id || from == 0)
+        return 1;
+
+    uint32_t chain = 0;
+    uint64_t hashed = 0;
+    int fd = open(resume_input, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && from <= (uint64_t)input_size &&
+        digest_init(&resume_digest, (digest_algo_t)syn_opts.digest) == 0)
+        hashed = ckpt_scan(fd, from, NULL, &chain, &resume_digest);
+    if (fd >= 0)
+        close(fd);
+    if (hashed == from && chain == syn_opts.resume_crc)
+    {
+        resume_from = (off_t)from;
+        log_event("RESUME FROM=%llu", (unsigned long long)from);
+        printf("resuming: the server already has %llu bytes\n", (unsigned long long)from);
+        return 1;
+    }
+
+    digest_free(&resume_digest);
+    log_event("RESUME MISMATCH FROM=%llu", (unsigned long long)from);
+    fprintf(stderr, "the server's partial copy does not match the input: starting over\n");
+    resume_limit = 0;
+    return 0;
+}
+
+// SYN-ACK in hand: record what the server agreed to and send the final ACK
+static int handshake_complete(struct handshake *hs, struct sham_packet *packet, int bytes_recv)
+{
+    if (!(packet->header.flags & (SYN_FLAG | ACK_FLAG)))
+    {
+        fprintf(stderr, "expected SYN-ACK packet\n");
+        return -1;
+    }
+
+    server_seq = packet->header.seq_num;
+    sack_ok = sack_enabled && (packet->header.flags & SACK_FLAG);
+    crc_flag = crc_enabled ? packet->header.flags & CRC_FLAG : 0;
+    syn_options_parse(packet, bytes_recv, &syn_opts);
+    peer_rwnd = (uint32_t)packet->header.window_size << syn_opts.wscale;
+    if (my_stripe && syn_opts.stripe != my_stripe->id)
+    {
+        fprintf(stderr, "server did not accept a striped transfer\n");
+        return -1;
+    }
+    log_event("RCV SYN-ACK SEQ=%u ACK=%u SACK=%d ACKFREQ=%u RWND=%u MSS=%u CRC=%d FEC=%s/%u/%u", server_seq,
+              packet->header.ack_num, sack_ok, syn_opts.ack_freq, peer_rwnd, syn_opts.mss,
+              crc_flag != 0, fec_name((fec_mode_t)syn_opts.fec), syn_opts.fec_k, syn_opts.fec_parity);
+    if (crc_flag && !__atomic_exchange_n(&crc_reported, 1, __ATOMIC_RELAXED))
+        log_event("CRC32C %s", crc32c_impl());
+
+    if (packet->header.ack_num != client_seq + 1)
+    {
+        fprintf(stderr, "invalid ACK number in SYN-ACK\n");
+        return -1;
+    }
+    if (resume_id && !my_stripe && !resume_accept())
+        return HANDSHAKE_RETRY;
+
+    // step 3: send ACK
+    packet->header.seq_num = client_seq;
+    packet->header.ack_num = server_seq + 1;
+    packet->header.flags = ACK_FLAG | crc_flag;
+    packet->header.window_size = BUFFER_SIZE;
+
+    if (send_packet(hs->sockfd, hs->addr, packet, 0) < 0)
+    {
+        return -1;
+    }
+
+    log_event("SND ACK FOR SYN");
+    return 0;
+}
+
+static void handshake_readable(void *arg, uint32_t events)
+{
+    struct handshake *hs = arg;
+    struct sham_packet packet;
+    (void)events;
+
+    socklen_t addr_len = sizeof(*hs->addr);
+    int bytes_recv = recvfrom(hs->sockfd, &packet, sizeof(packet), MSG_DONTWAIT,
+                              (struct sockaddr *)hs->addr, &addr_len);
+    if (bytes_recv < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return;
+        perror("recvfrom failed in handshake");
+        hs->result = -1;
+    }
+    else if (!packet_intact(&packet, &bytes_recv, 0))
+    {
+        log_event("DROP CORRUPT SYN-ACK");
+        return; // as if lost: keep waiting
+    }
+    else
+    {
+        hs->result = handshake_complete(hs, &packet, bytes_recv);
+    }
+    reactor_stop(&hs->reactor);
+}
 
-// three way handshake for client
 int three_way_handshake_client(int sockfd, struct sockaddr_in *server_addr, uint32_t *initial_seq)
 {
-    struct sham_packet packet;
+    struct sham_packet packet;
+
+    // step 1: send SYN
+    client_seq = generate_initial_seq();
+    packet.header.seq_num = client_seq;
+    packet.header.ack_num = 0;
+    packet.header.flags = SYN_FLAG | (sack_enabled ? SACK_FLAG : 0) | (crc_enabled ? CRC_FLAG : 0);
+    packet.header.window_size = BUFFER_SIZE;
+
+    struct sham_syn_options offer;
+    syn_options_default(&offer);
+    offer.ack_freq = ack_freq_wanted;
+    offer.ack_delay_ms = ack_freq_wanted > 1 ? ACK_DELAY_MS : 0;
+    offer.wscale = window_scale_for(BUFFER_SIZE);
+    // without path mtu discovery nothing confirms a larger size is safe
+    offer.mss = mss_wanted ? mss_wanted : use_pmtud ? MAX_DATA_SIZE : BASE_MSS;
+    offer.file_size = (uint64_t)input_size;
+    offer.digest = digest_algo;
+    offer.fec = fec_mode;
+    offer.fec_k = fec_k;
+    offer.fec_parity = fec_mode == FEC_XOR ? 1 : fec_parity_max;
+    if (my_stripe)
+    {
+        offer.stripe = my_stripe->id;
+        offer.stripe_flows = my_stripe->flows;
+        offer.fec = FEC_NONE;
+    }
+    else if (resume_id)
+    {
+        offer.resume = resume_id;
+        offer.resume_from = resume_limit;
+    }
+    memcpy(packet.data, &offer, sizeof(offer));
+
+    if (send_packet(sockfd, server_addr, &packet, sizeof(offer)) < 0)
+    {
+        return -1;
+    }
+
+    log_event("SND SYN SEQ=%u ACKFREQ=%u MSS=%u", client_seq, offer.ack_freq, offer.mss);
+    state = SYN_SENT;
+
+    // step 2: receive SYN-ACK with timeout
+    struct handshake hs;
+    hs.sockfd = sockfd;
+    hs.addr = server_addr;
+    hs.result = 1;
+    if (reactor_init(&hs.reactor) < 0)
+        return -1;
+    if (reactor_add(&hs.reactor, &hs.watch, sockfd, EPOLLIN | EPOLLET, handshake_readable, &hs) < 0)
+    {
+        reactor_free(&hs.reactor);
+        return -1;
+    }
+    timer_init(&hs.timeout, handshake_timeout, &hs);
+    // a server resuming reads its partial copy back before it answers
+    long wait_ms = offer.resume && offer.resume_from ? RESUME_TIMEOUT_MS : CONNECT_TIMEOUT_MS;
+    timer_arm(&hs.reactor.timers, &hs.timeout, monotonic_us() + wait_ms * 1000L);
+
+    if (reactor_run(&hs.reactor) < 0)
+        hs.result = -1;
+    reactor_free(&hs.reactor);
+    if (hs.result == HANDSHAKE_RETRY)
+        return three_way_handshake_client(sockfd, server_addr, initial_seq);
+    if (hs.result != 0)
+        return -1;
+
+    state = ESTABLISHED;
+    client_seq++; // increment for data packets
+    *initial_seq = client_seq;
+    return 0;
+}
+
+// where send_file reads segment payloads from
+struct segment_source
+{
+    int fd;              // read path: each segment is read once into its pool buffer
+    struct packet_pool pool;
+    struct file_map map; // mmap path: datagrams built straight from the mapping
+    int mapped;
+    off_t size;
+    struct read_ahead *ahead; // pipelined: new segments come from the reader thread
+};
+
+static int source_open(struct segment_source *src, const char *filename, int use_mmap)
+{
+    memset(src, 0, sizeof(*src));
+    src->mapped = use_mmap;
+    if (use_mmap)
+    {
+        if (file_map_open(&src->map, filename) < 0)
+            return -1;
+        src->size = src->map.size;
+        return 0;
+    }
+
+    src->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (src->fd < 0) {
+        fprintf(stderr, "failed to open input file '%s': %s\n", 
+                filename, strerror(errno));
+        return -1;
+    }
+
+    // Verify file is readable
+    struct stat st;
+    src->size = fstat(src->fd, &st) == 0 ? st.st_size : 0;
+
+    if (src->size <= 0) {
+        fprintf(stderr, "input file '%s' is empty or unreadable\n", filename);
+        close(src->fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void source_close(struct segment_source *src)
+{
+    if (src->mapped)
+    {
+        file_map_close(&src->map);
+        return;
+    }
+    packet_pool_free(&src->pool);
+    close(src->fd);
+}
+
+// len bytes at offset, however many reads that takes
+static int source_read(struct segment_source *src, char *dst, int len, off_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pread(src->fd, dst, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        dst += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+struct fec_encoder;
+static void fec_encode(struct fec_encoder *f, const void *data, int len);
+
+// queue a tracked segment (window slot index) for the next batch flush;
+// the digest (unless the reader thread keeps it) takes in whatever part of
+// it extends the prefix hashed so far, and the open fec block a segment
+// sent for the first time
+static int queue_segment(struct send_batch *batch, struct segment_source *src, int index,
+                         struct packet_info *p, struct sham_digest *digest,
+                         struct fec_encoder *fec)
+{
+    struct sham_header header;
+    header.seq_num = p->seq_num;
+    header.ack_num = p->shift;
+    header.flags = crc_flag;
+    header.window_size = BUFFER_SIZE;
+
+    if (src->mapped)
+    {
+        // queued iovecs point into the mapping, and zerocopy sends keep
+        // referencing it after the flush: release everything before it slides
+        if (!file_map_covers(&src->map, p->file_offset, p->data_len) && batch_release(batch) < 0)
+            return -1;
+
+        // no file i/o and no copy: the kernel gathers header + mapped slice
+        const char *data = file_map_slice(&src->map, p->file_offset, p->data_len);
+        if (!data)
+            return -1;
+        if (digest)
+            digest_extend(digest, p->file_offset, data, p->data_len);
+        if (fec && p->fec_block)
+            fec_encode(fec, data, p->data_len);
+        return batch_add(batch, &header, data, p->data_len);
+    }
+
+    // read path: the payload goes into the segment's pool buffer once, and
+    // every send writes the header in front of it and queues the buffer
+    struct sham_packet *packet = packet_pool_get(&src->pool, index);
+    if (p->buffered)
+    {
+        src->pool.resends++;
+    }
+    else
+    {
+        int taken = src->ahead ? read_ahead_take(src->ahead, p->file_offset, packet->data, p->data_len) : 0;
+        if (taken < 0)
+            return -1;
+        if (taken)
+            src->pool.copied += p->data_len;
+        else if (source_read(src, packet->data, p->data_len, p->file_offset) < 0)
+            return -1;
+        src->pool.fills++;
+        p->buffered = 1;
+        if (digest)
+            digest_extend(digest, p->file_offset, packet->data, p->data_len);
+        if (fec && p->fec_block)
+            fec_encode(fec, packet->data, p->data_len);
+    }
+    packet->header = header;
+    return batch_add_packet(batch, packet, p->data_len);
+}
+
+// first window index in [start, end) whose seq_num is >= seq
+static int window_find(const struct packet_info *window, int start, int end, uint32_t seq)
+{
+    while (start < end)
+    {
+        int mid = start + (end - start) / 2;
+        if ((int32_t)(window[mid % MAX_WINDOW].seq_num - seq) < 0)
+            start = mid + 1;
+        else
+            end = mid;
+    }
+    return start;
+}
+
+static void mark_lost(struct packet_info *p, uint32_t *lost_bytes)
+{
+    if (p->lost || p->sacked)
+        return;
+    p->lost = 1;
+    *lost_bytes += p->data_len;
+}
+
+// forward error correction: new segments of one size are grouped into
+// blocks of k, and when a block closes its repairs go out right behind it.
+// how many depends on the loss rate over the last few windows, counting
+// retransmissions and the segments the receiver reports it rebuilt
+struct fec_sent
+{
+    uint32_t serial;
+    int parity;
+    uint64_t repair_us; // when its repairs were queued
+};
+
+struct fec_encoder
+{
+    fec_mode_t mode;
+    int k;
+    int parity_max;
+    // the open block
+    uint32_t serial; // packet_info.fec_block of its segments
+    uint32_t start;  // first byte
+    int len;         // bytes per segment
+    int count;       // segments so far, 0 when none is open
+    int parity;      // repairs it will get
+    uint8_t *repair; // parity_max rows of MAX_DATA_SIZE
+    struct fec_sent *sent; // closed blocks by serial % MAX_WINDOW
+    // loss estimate
+    double loss;
+    uint32_t sample_sent;
+    uint32_t sample_lost;
+    struct sham_fec_report seen; // receiver's last report
+    unsigned long blocks;
+    unsigned long repairs;
+};
+
+// fold one segment into every repair row of the open block
+static void fec_encode(struct fec_encoder *f, const void *data, int len)
+{
+    for (int j = 0; j < f->parity; j++)
+        fec_mul_add(f->repair + (size_t)j * MAX_DATA_SIZE, data, fec_coef(j, f->count), len);
+    f->count++;
+}
+
+// part of the file a striped stream claimed, and where it sits in the stream
+struct stripe_range
+{
+    off_t stream_start;
+    off_t file_start;
+    off_t len;
+};
+
+// everything a file transfer tracks, shared by the reactor callbacks
+struct sender
+{
+    struct reactor reactor;
+    struct io_watch watch;
+    int sockfd;
+    struct sockaddr_in *addr;
+    struct segment_source src;
+    struct packet_info *window;
+    struct send_batch *batch;      // being filled
+    struct send_batch batch_store; // the only batch without the pipeline
+
+    // --pipeline: a reader thread fills src.ahead and a transmitter thread
+    // flushes the batches this loop fills
+    struct read_ahead ahead;
+    struct tx_stage tx;
+    int window_start, window_end;
+    // sequence numbers are 32-bit and wrap every 4 GB; only serial
+    // arithmetic is used on them, and file positions are kept 64-bit here
+    off_t file_pos; // track absolute file offset
+    off_t file_size;
+
+    // scoreboard totals over the outstanding segments
+    uint32_t sacked_bytes; // held by the receiver out of order
+    uint32_t lost_bytes;   // marked for retransmission
+    uint32_t high_sacked;  // end of the highest sacked range
+    int dupacks;
+
+    struct cc_state cc;
+    struct rtt_state rtt;
+    struct sham_timer rto_timer; // restarted whenever snd_una moves
+
+    // flow control: new data never goes past snd_una + rwnd. when the
+    // receiver closes the window with nothing in flight, the persist timer
+    // sends header-only probes until an ack reopens it
+    uint32_t rwnd;
+    long persist_us;
+    struct sham_timer persist_timer;
+
+    // path mtu discovery (RFC 8899): new segments carry mss bytes, the
+    // largest size confirmed so far. padding-only probes binary search
+    // (mss, probe_hi) up to the negotiated mss_max; a size is too big after
+    // PMTU_MAX_PROBES unanswered probes or an EMSGSIZE from the local stack
+    int mss;
+    int mss_max;
+    int probe_hi;      // smallest size known not to fit, mss_max + 1 if none
+    int probe_len;     // size of the probe in flight, 0 when idle
+    int probe_tries;
+    uint32_t probe_id;    // id of the last probe sent
+    uint32_t probe_first; // id of the first probe at probe_len
+    struct sham_timer probe_timer;
+
+    // close: FIN retransmitted on rto until the peer acknowledges it
+    uint32_t fin_seq;
+    int fin_tries;
+    struct sham_timer fin_timer;
+    struct sham_timer time_wait_timer;
+
+    // digest of the file in order, taken as segments are first queued; the
+    // FIN carries it and the receiver's FIN answers with its own
+    struct sham_digest digest;
+    unsigned char final_digest[DIGEST_MAX];
+    int final_len;
+    int digest_checked;
+
+    struct fec_encoder fec;
+    struct sham_timer fec_timer; // a loss held back for a block's repairs
+
+    // --streams: file_pos counts the stream's own bytes, and file_size is
+    // not known until the stripe has nothing left for it
+    struct stripe *stripe;
+    int flow;
+    struct stripe_range *ranges; // claimed so far, in stream order
+    int nranges;
+    int range; // the one file_pos is in
+
+    int result;
+};
+
+static void sender_start_close(struct sender *s);
+
+static uint32_t sender_snd_una(const struct sender *s)
+{
+    return s->window_start < s->window_end ?
+           s->window[s->window_start % MAX_WINDOW].seq_num : client_seq;
+}
+
+static void sender_fail(struct sender *s)
+{
+    s->result = -1;
+    reactor_stop(&s->reactor);
+}
+
+// the batch to queue into; with the pipeline a full one goes to the
+// transmitter instead of being flushed here. NULL after a failed send
+static struct send_batch *sender_batch(struct sender *s)
+{
+    if (s->tx.batches && s->batch->count == s->batch->max)
+        s->batch = tx_stage_swap(&s->tx, s->batch);
+    return s->batch;
+}
+
+static int sender_flush(struct sender *s)
+{
+    if (!s->tx.batches)
+        return batch_flush(s->batch);
+    s->batch = tx_stage_swap(&s->tx, s->batch);
+    return s->batch ? 0 : -1;
+}
+
+// the digest queue_segment extends: none while the reader thread keeps it,
+// or for a striped stream, whose bytes are not the file in order
+static struct sham_digest *sender_digest(struct sender *s)
+{
+    return s->src.ahead || s->stripe ? NULL : &s->digest;
+}
+
+// ---- striped streams ----
+
+// the whole file's digest for a stream's FIN, once its thread is done
+static int stripe_digest_wait(struct stripe *sp, unsigned char *out)
+{
+    pthread_mutex_lock(&sp->lock);
+    while (sp->digest_len == 0)
+        pthread_cond_wait(&sp->cond, &sp->lock);
+    int len = sp->digest_len;
+    if (len > 0)
+        memcpy(out, sp->digest, len);
+    pthread_mutex_unlock(&sp->lock);
+    return len;
+}
+
+// a new range for flow f, with the stripe locked: the next fresh chunk, or
+// the unsent back half of the range with the most left, cut at a unit
+static int stripe_claim(struct stripe *sp, int f)
+{
+    struct stripe_flow *me = &sp->flow[f];
+    if (sp->next < sp->size)
+    {
+        me->pos = sp->next;
+        me->end = sp->size - sp->next < STRIPE_CHUNK ? sp->size : sp->next + STRIPE_CHUNK;
+        sp->next = me->end;
+        return 0;
+    }
+
+    struct stripe_flow *victim = NULL;
+    for (int i = 0; i < sp->flows; i++)
+        if (i != f && (!victim || sp->flow[i].end - sp->flow[i].pos > victim->end - victim->pos))
+            victim = &sp->flow[i];
+    if (!victim || victim->end - victim->pos < STRIPE_STEAL_MIN)
+        return -1;
+    off_t mid = (victim->pos + (victim->end - victim->pos) / 2 + STRIPE_UNIT - 1) / STRIPE_UNIT * STRIPE_UNIT;
+    if (mid >= victim->end)
+        return -1;
+    me->pos = mid;
+    me->end = victim->end;
+    victim->end = mid;
+    sp->steals++;
+    log_event("STRIPE STEAL FLOW=%d FROM=%d OFFSET=%lld LEN=%lld", f, (int)(victim - sp->flow),
+              (long long)me->pos, (long long)(me->end - me->pos));
+    return 0;
+}
+
+// length and file offset of the next new segment, 0 once the stream has
+// nothing left to send. a striped stream's segments never cross a range,
+// and a range that ends the file is its last: every other range is whole
+// units long, so each one starts at a unit boundary in the stream as well
+static int sender_next_segment(struct sender *s, off_t *offset)
+{
+    if (!s->stripe)
+    {
+        *offset = s->file_pos;
+        return s->file_size - s->file_pos < s->mss ? (int)(s->file_size - s->file_pos) : s->mss;
+    }
+
+    // after a black hole file_pos may be back in an earlier range
+    while (s->range > 0 && s->file_pos < s->ranges[s->range].stream_start)
+        s->range--;
+
+    struct stripe *sp = s->stripe;
+    struct stripe_flow *me = &sp->flow[s->flow];
+    pthread_mutex_lock(&sp->lock);
+    while (1)
+    {
+        struct stripe_range *r = s->nranges > 0 ? &s->ranges[s->range] : NULL;
+        int current = r && s->range == s->nranges - 1;
+        if (current)
+            r->len = me->end - r->file_start; // another stream may have taken its tail
+        if (r && s->file_pos < r->stream_start + r->len)
+            break;
+        if (r && !current)
+        {
+            s->range++;
+            continue;
+        }
+        if ((r && r->file_start + r->len == sp->size) || stripe_claim(sp, s->flow) < 0)
+        {
+            pthread_mutex_unlock(&sp->lock);
+            return 0;
+        }
+
+        struct stripe_range *grown = realloc(s->ranges, (s->nranges + 1) * sizeof(*s->ranges));
+        if (!grown)
+        {
+            pthread_mutex_unlock(&sp->lock);
+            perror("failed to record stripe range");
+            return -1;
+        }
+        s->ranges = grown;
+        s->range = s->nranges++;
+        s->ranges[s->range].stream_start = s->file_pos;
+        s->ranges[s->range].file_start = me->pos;
+        s->ranges[s->range].len = me->end - me->pos;
+    }
+
+    struct stripe_range *r = &s->ranges[s->range];
+    off_t into = s->file_pos - r->stream_start;
+    int len = r->len - into < s->mss ? (int)(r->len - into) : s->mss;
+    *offset = r->file_start + into;
+    if (s->range == s->nranges - 1 && *offset + len > me->pos)
+        me->pos = *offset + len;
+    pthread_mutex_unlock(&sp->lock);
+    return len;
+}
+
+// ---- forward error correction ----
+
+// queue the open block's repairs behind its data
+static int fec_close(struct sender *s)
+{
+    struct fec_encoder *f = &s->fec;
+    if (f->count == 0)
+        return 0;
+
+    struct sham_header header;
+    header.seq_num = f->start;
+    header.flags = FEC_FLAG | crc_flag;
+    header.window_size = BUFFER_SIZE;
+    for (int j = 0; j < f->parity; j++)
+    {
+        struct send_batch *batch = sender_batch(s);
+        char *slot = batch ? batch_slot(batch) : NULL;
+        if (!slot)
+            return -1;
+        memcpy(slot, f->repair + (size_t)j * MAX_DATA_SIZE, f->len);
+        s->src.pool.copied += f->len;
+        header.ack_num = FEC_INFO(f->count, f->parity, j);
+        if (batch_add(batch, &header, slot, f->len) < 0)
+            return -1;
+    }
+
+    struct fec_sent *b = &f->sent[f->serial % MAX_WINDOW];
+    b->serial = f->serial;
+    b->parity = f->parity;
+    b->repair_us = monotonic_us();
+    f->blocks++;
+    f->repairs += f->parity;
+    f->count = 0;
+    return 0;
+}
+
+// a new segment is about to go out: put it in the open block, or open one
+// sized for the current loss estimate
+static int fec_next(struct sender *s, struct packet_info *p)
+{
+    struct fec_encoder *f = &s->fec;
+    if (f->count > 0 && p->data_len != f->len && fec_close(s) < 0)
+        return -1;
+
+    if (f->count == 0)
+    {
+        f->parity = fec_parity_for(f->loss, f->k, f->parity_max);
+        if (f->parity == 0)
+            return 0;
+        f->serial++;
+        if (f->serial == 0)
+            f->serial = 1;
+        f->start = p->seq_num;
+        f->len = p->data_len;
+        for (int j = 0; j < f->parity; j++)
+            memset(f->repair + (size_t)j * MAX_DATA_SIZE, 0, f->len);
+    }
+    p->fec_block = f->serial;
+    return 0;
+}
+
+// take a loss-rate sample every few windows' worth of segments
+static void fec_sample(struct sender *s)
+{
+    struct fec_encoder *f = &s->fec;
+    uint32_t need = s->cc.cwnd / (uint32_t)s->mss;
+    if (need < FEC_SAMPLE_SEGMENTS)
+        need = FEC_SAMPLE_SEGMENTS;
+    if (f->sample_sent < need)
+        return;
+
+    double rate = (double)f->sample_lost / f->sample_sent;
+    f->loss = f->loss * 3 / 4 + (rate > 1 ? 1 : rate) / 4;
+    f->sample_sent = 0;
+    f->sample_lost = 0;
+}
+
+// the receiver's running totals: rebuilt segments were lost too
+static void fec_on_report(struct sender *s, const struct sham_fec_report *report)
+{
+    struct fec_encoder *f = &s->fec;
+    if ((int32_t)(report->repaired - f->seen.repaired) > 0)
+        f->sample_lost += report->repaired - f->seen.repaired;
+    if ((int32_t)(report->failed - f->seen.failed) > 0)
+        log_event("FEC FAILED BLOCKS=%u", report->failed);
+    if ((int32_t)(report->repaired - f->seen.repaired) >= 0)
+        f->seen = *report;
+}
+
+// a missing segment whose block went out with repairs is not declared lost
+// until those repairs have had a round trip (and a delayed ack) to rebuild
+// it. a block still being filled is closed now to send them
+static int fec_may_repair(struct sender *s, const struct packet_info *p, uint64_t now)
+{
+    struct fec_encoder *f = &s->fec;
+    if (!p->fec_block || p->retransmitted)
+        return 0;
+    if (p->fec_block == f->serial && f->count > 0 && fec_close(s) < 0)
+    {
+        sender_fail(s);
+        return 0;
+    }
+
+    struct fec_sent *b = &f->sent[p->fec_block % MAX_WINDOW];
+    if (b->serial != p->fec_block || b->parity == 0)
+        return 0;
+    uint64_t deadline = b->repair_us + s->rtt.srtt_us * 5 / 4 + ACK_DELAY_MS * 1000L;
+    if (now >= deadline)
+        return 0;
+    if (!timer_armed(&s->fec_timer) || deadline < s->fec_timer.deadline_us)
+        timer_arm(&s->reactor.timers, &s->fec_timer, deadline);
+    return 1;
+}
+
+// send what cwnd and rwnd allow: lost segments first, then new data, all in
+// one batch flush. once everything is acked the close begins
+static void sender_pump(struct sender *s)
+{
+    struct packet_info *window = s->window;
+    uint32_t snd_una = sender_snd_una(s);
+
+    // retransmit segments marked lost, oldest first
+    for (int i = s->window_start; i < s->window_end && s->lost_bytes > 0; i++)
+    {
+        struct packet_info *p = &window[i % MAX_WINDOW];
+        if (!p->lost)
+            continue;
+
+        // the first retransmission of a recovery goes out regardless of cwnd
+        uint32_t pipe = client_seq - snd_una - s->sacked_bytes - s->lost_bytes;
+        if (pipe > 0 && pipe + p->data_len > s->cc.cwnd)
+            break;
+
+        struct send_batch *batch = sender_batch(s);
+        if (!batch || queue_segment(batch, &s->src, i, p, sender_digest(s), NULL) < 0)
+        {
+            sender_fail(s);
+            return;
+        }
+        log_packet(LOG_RETX_DATA, p->seq_num, 0, p->data_len, 0);
+        if (!p->retransmitted)
+            s->fec.sample_lost++;
+
+        p->lost = 0;
+        p->retransmitted = 1;
+        s->lost_bytes -= p->data_len;
+        p->sent_us = monotonic_us();
+        if (i == s->window_start)
+            timer_arm(&s->reactor.timers, &s->rto_timer, p->sent_us + s->rtt.rto_us);
+    }
+
+    // fill window with new data up to min(cwnd, rwnd)
+    int rwnd_limited = 0;
+    while (s->window_end - s->window_start < MAX_WINDOW && s->file_pos < s->file_size &&
+           s->lost_bytes == 0)
+    {
+        uint32_t pipe = client_seq - snd_una - s->sacked_bytes;
+        if (pipe + s->mss > s->cc.cwnd)
+            break;
+        off_t offset;
+        int len = sender_next_segment(s, &offset);
+        if (len < 0)
+        {
+            sender_fail(s);
+            return;
+        }
+        if (len == 0)
+        {
+            s->file_size = s->file_pos; // striped: the stream ends here
+            break;
+        }
+        if (client_seq + len - snd_una > s->rwnd)
+        {
+            rwnd_limited = 1;
+            break;
+        }
+
+        // track packet
+        struct packet_info *p = &window[s->window_end % MAX_WINDOW];
+        memset(p, 0, sizeof(*p));
+        p->seq_num = client_seq; // use current seq
+        p->file_offset = offset; // save offset
+        p->data_len = len;
+        p->shift = s->stripe ? STRIPE_SHIFT(offset, s->file_pos) : 0;
+
+        if (s->fec.mode != FEC_NONE && fec_next(s, p) < 0)
+        {
+            sender_fail(s);
+            return;
+        }
+        struct send_batch *batch = sender_batch(s);
+        if (!batch || queue_segment(batch, &s->src, s->window_end, p, sender_digest(s), &s->fec) < 0)
+        {
+            sender_fail(s);
+            return;
+        }
+        log_packet(LOG_SND_DATA, p->seq_num, 0, p->data_len, 0);
+
+        p->sent_us = monotonic_us();
+        if (s->window_start == s->window_end)
+            timer_arm(&s->reactor.timers, &s->rto_timer, p->sent_us + s->rtt.rto_us);
+
+        client_seq += p->data_len; // advance once per packet
+        s->file_pos += p->data_len;
+        s->window_end++;
+
+        // a full block, or the end of the file, sends the repairs
+        if (s->fec.mode != FEC_NONE)
+        {
+            s->fec.sample_sent++;
+            fec_sample(s);
+            if (s->fec.count > 0 && (s->fec.count == s->fec.k || s->file_pos >= s->file_size) &&
+                fec_close(s) < 0)
+            {
+                sender_fail(s);
+                return;
+            }
+        }
+    }
+
+    // one sendmmsg for everything the two loops above queued, here or on
+    // the transmitter thread
+    if (sender_flush(s) < 0)
+    {
+        sender_fail(s);
+        return;
+    }
+
+    // window closed and nothing left to be acked: only a probe can reopen it
+    if (rwnd_limited && s->window_start == s->window_end)
+    {
+        if (!timer_armed(&s->persist_timer))
+        {
+            if (s->persist_us == 0)
+                s->persist_us = s->rtt.rto_us;
+            timer_arm(&s->reactor.timers, &s->persist_timer, monotonic_us() + s->persist_us);
+        }
+    }
+    else if (timer_armed(&s->persist_timer))
+    {
+        timer_cancel(&s->reactor.timers, &s->persist_timer);
+        s->persist_us = 0;
+    }
+
+    if (s->window_start == s->window_end && s->file_pos >= s->file_size)
+        sender_start_close(s);
+}
+
+static void sender_detect_loss(struct sender *s, uint32_t old_high_sacked, uint64_t now);
+
+// one ACK: advance snd_una, update the scoreboard, rtt, cwnd and recovery
+static void sender_on_ack(struct sender *s, const struct sham_packet *packet, int rcv)
+{
+    struct packet_info *window = s->window;
+    uint32_t snd_una = sender_snd_una(s);
+    uint32_t ack_num = packet->header.ack_num;
+    const char *payload = packet->data;
+    int payload_len = rcv - (int)sizeof(struct sham_header);
+    if ((packet->header.flags & FEC_FLAG) && payload_len >= (int)sizeof(struct sham_fec_report))
+    {
+        struct sham_fec_report report;
+        memcpy(&report, payload, sizeof(report));
+        fec_on_report(s, &report);
+        payload += sizeof(report);
+        payload_len -= sizeof(report);
+    }
+
+    int nblocks = 0;
+    struct sham_sack_block blocks[MAX_SACK_BLOCKS];
+    if (sack_ok && (packet->header.flags & SACK_FLAG))
+    {
+        nblocks = payload_len / (int)sizeof(blocks[0]);
+        if (nblocks > MAX_SACK_BLOCKS)
+            nblocks = MAX_SACK_BLOCKS;
+        if (nblocks < 0)
+            nblocks = 0;
+        memcpy(blocks, payload, nblocks * sizeof(blocks[0]));
+    }
+
+    // window updates from reordered, older acks are ignored
+    uint32_t old_rwnd = s->rwnd;
+    if ((int32_t)(ack_num - snd_una) >= 0)
+        s->rwnd = (uint32_t)packet->header.window_size << syn_opts.wscale;
+    log_packet(LOG_RCV_ACK, 0, ack_num, nblocks, s->rwnd);
+
+    uint32_t acked = 0;
+    int ambiguous = 0; // ack may have been triggered by a retransmission
+    struct packet_info *newest = NULL;
+
+    while (s->window_start < s->window_end)
+    {
+        struct packet_info *p = &window[s->window_start % MAX_WINDOW];
+        if ((int32_t)(p->seq_num + p->data_len - ack_num) > 0)
+            break;
+        acked += p->data_len;
+        ambiguous |= p->retransmitted;
+        if (p->sacked)
+            s->sacked_bytes -= p->data_len;
+        if (p->lost)
+            s->lost_bytes -= p->data_len;
+        newest = p;
+        s->window_start++;
+    }
+
+    // mark sacked segments; they will not be retransmitted
+    uint32_t old_high_sacked = s->high_sacked;
+    uint32_t old_sacked_bytes = s->sacked_bytes;
+    struct packet_info *newest_sacked = NULL;
+    for (int b = 0; b < nblocks; b++)
+    {
+        int i = window_find(window, s->window_start, s->window_end, blocks[b].start);
+        for (; i < s->window_end; i++)
+        {
+            struct packet_info *p = &window[i % MAX_WINDOW];
+            if ((int32_t)(p->seq_num + p->data_len - blocks[b].end) > 0)
+                break;
+            if (p->sacked)
+                continue;
+            p->sacked = 1;
+            s->sacked_bytes += p->data_len;
+            if (!p->retransmitted)
+                newest_sacked = p;
+            if (p->lost)
+            {
+                p->lost = 0;
+                s->lost_bytes -= p->data_len;
+            }
+        }
+        if ((int32_t)(blocks[b].end - s->high_sacked) > 0)
+            s->high_sacked = blocks[b].end;
+    }
+
+    uint64_t now = monotonic_us();
+
+    // karn: only time segments that were sent exactly once, and
+    // only on their first acknowledgement (cumulative or sack)
+    if (acked > 0 && !ambiguous && !newest->sacked)
+        newest_sacked = newest;
+    if (newest_sacked)
+    {
+        rtt_sample(&s->rtt, (long)(now - newest_sacked->sent_us));
+    }
+
+    if (acked > 0)
+    {
+        cc_on_ack(&s->cc, acked, ack_num);
+        s->dupacks = 0;
+        if (s->window_start < s->window_end)
+            timer_arm(&s->reactor.timers, &s->rto_timer, now + s->rtt.rto_us);
+        else
+            timer_cancel(&s->reactor.timers, &s->rto_timer);
+
+        // newreno partial ack without sack: the next hole is lost too
+        if (s->cc.in_recovery && !sack_ok && s->window_start < s->window_end)
+            mark_lost(&window[s->window_start % MAX_WINDOW], &s->lost_bytes);
+    }
+    else if (ack_num == snd_una && s->window_start < s->window_end && s->rwnd == old_rwnd &&
+             (!sack_ok || s->sacked_bytes != old_sacked_bytes))
+    {
+        // a duplicate only if it is not a window update and, with sack,
+        // reports something new (RFC 5681 2, RFC 6675 2): a window reopened
+        // by the disk writer or a delayed-ack timer ack says nothing about loss
+        s->dupacks++;
+    }
+
+    sender_detect_loss(s, old_high_sacked, now);
+}
+
+// fast retransmit once DUPACK_THRESHOLD duplicate acks, or as many segments
+// sacked, are in; during recovery also every hole below newly sacked data.
+// holes that a fec block's repairs may still fill are left alone for now
+static void sender_detect_loss(struct sender *s, uint32_t old_high_sacked, uint64_t now)
+{
+    struct packet_info *window = s->window;
+    uint32_t outstanding = client_seq - sender_snd_una(s);
+
+    if (!s->cc.in_recovery && s->window_start < s->window_end &&
+        (s->dupacks >= DUPACK_THRESHOLD || s->sacked_bytes >= DUPACK_THRESHOLD * (uint32_t)s->mss))
+    {
+        if (fec_may_repair(s, &window[s->window_start % MAX_WINDOW], now))
+            return;
+
+        // fast retransmit: the head of the window and, with sack,
+        // every hole below the highest sacked byte
+        log_event("FAST RETX SEQ=%u DUPACKS=%d", window[s->window_start % MAX_WINDOW].seq_num, s->dupacks);
+        cc_on_loss(&s->cc, outstanding - s->sacked_bytes, client_seq);
+        mark_lost(&window[s->window_start % MAX_WINDOW], &s->lost_bytes);
+        old_high_sacked = window[s->window_start % MAX_WINDOW].seq_num;
+    }
+
+    // holes revealed by newly sacked data during recovery
+    if (s->cc.in_recovery && sack_ok && (int32_t)(s->high_sacked - old_high_sacked) > 0)
+    {
+        for (int i = s->window_start; i < s->window_end; i++)
+        {
+            struct packet_info *p = &window[i % MAX_WINDOW];
+            if ((int32_t)(p->seq_num + p->data_len - s->high_sacked) > 0)
+                break;
+            if (!p->sacked && !p->retransmitted && !fec_may_repair(s, p, now))
+                mark_lost(p, &s->lost_bytes);
+        }
+    }
+}
+
+// the repairs of a held-back hole had their chance
+static void sender_fec_expired(void *arg)
+{
+    struct sender *s = arg;
+    sender_detect_loss(s, sender_snd_una(s), monotonic_us());
+    sender_pump(s);
+}
+
+// ---- path mtu discovery (RFC 8899 DPLPMTUD) ----
+
+static void sender_probe_next(struct sender *s);
+
+// the search settled: look again after PMTU_RAISE_MS in case the path grew
+static void sender_probe_done(struct sender *s)
+{
+    log_event("PMTU SEARCH DONE MSS=%d", s->mss);
+    s->probe_len = 0;
+    timer_arm(&s->reactor.timers, &s->probe_timer, monotonic_us() + PMTU_RAISE_MS * 1000L);
+}
+
+// probe_len did not make it: it becomes the upper bound
+static void sender_probe_failed(struct sender *s)
+{
+    log_event("PMTU PROBE FAILED LEN=%d", s->probe_len);
+    s->probe_hi = s->probe_len;
+    s->probe_len = 0;
+    sender_probe_next(s);
+}
+
+static void sender_probe_send(struct sender *s)
+{
+    static const char padding[MAX_DATA_SIZE];
+    struct sham_header header;
+    header.seq_num = ++s->probe_id;
+    header.ack_num = 0;
+    header.flags = MTU_PROBE_FLAG | crc_flag;
+    header.window_size = BUFFER_SIZE;
+    uint32_t crc;
+    int trailer = packet_seal(&header, padding, s->probe_len, &crc);
+
+    struct iovec iov[3] = {{&header, sizeof(header)}, {(void *)padding, s->probe_len}, {&crc, trailer}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = s->addr;
+    msg.msg_namelen = sizeof(*s->addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+    if (sendmsg(s->sockfd, &msg, 0) < 0)
+    {
+        // larger than the local interface: no need to wait for a timeout
+        if (errno == EMSGSIZE)
+        {
+            sender_probe_failed(s);
+            return;
+        }
+        log_event("PMTU PROBE SEND FAILED errno=%d", errno);
+    }
+    log_event("PMTU PROBE ID=%u LEN=%d", s->probe_id, s->probe_len);
+    timer_arm(&s->reactor.timers, &s->probe_timer, monotonic_us() + s->rtt.rto_us);
+}
+
+// next candidate: the negotiated maximum first (it usually fits), then
+// the midpoint of what is confirmed and what has failed
+static void sender_probe_next(struct sender *s)
+{
+    if (s->probe_hi - s->mss <= PMTU_SEARCH_STEP)
+    {
+        sender_probe_done(s);
+        return;
+    }
+    s->probe_len = s->probe_hi > s->mss_max ? s->mss_max : s->mss + (s->probe_hi - s->mss) / 2;
+    s->probe_tries = 1;
+    s->probe_first = s->probe_id + 1;
+    sender_probe_send(s);
+}
+
+static void sender_probe_timeout(void *arg)
+{
+    struct sender *s = arg;
+    if (s->probe_len == 0)
+    {
+        // raise timer: search the whole range above the current mss again
+        s->probe_hi = s->mss_max + 1;
+        sender_probe_next(s);
+        return;
+    }
+    if (s->probe_tries++ < PMTU_MAX_PROBES)
+        sender_probe_send(s);
+    else
+        sender_probe_failed(s);
+}
+
+// the receiver echoed a probe: its size fits the path
+static void sender_on_probe_ack(struct sender *s, const struct sham_packet *packet)
+{
+    // any copy at the current size will do; older sizes are stale
+    if (s->probe_len == 0 || packet->header.ack_num - s->probe_first > s->probe_id - s->probe_first)
+        return;
+    timer_cancel(&s->reactor.timers, &s->probe_timer);
+    s->mss = s->probe_len;
+    s->cc.mss = s->mss;
+    s->probe_len = 0;
+    log_event("PMTU MSS=%d", s->mss);
+    sender_probe_next(s);
+}
+
+// repeated timeouts at a probed size look like a black hole (the path mtu
+// shrank, or icmp is filtered): fall back to BASE_MSS, resend everything
+// unacknowledged at that size, and search again from there
+static void sender_blackhole(struct sender *s)
+{
+    int base = s->mss_max < BASE_MSS ? s->mss_max : BASE_MSS;
+    if (!use_pmtud || s->mss <= base)
+        return;
+    log_event("PMTU BLACK HOLE MSS=%d -> %d", s->mss, base);
+    s->probe_hi = s->mss;
+    s->mss = base;
+    s->cc.mss = base;
+
+    // forget how the outstanding bytes were cut into segments
+    if (s->window_start < s->window_end)
+    {
+        struct packet_info *head = &s->window[s->window_start % MAX_WINDOW];
+        s->file_pos -= client_seq - head->seq_num;
+        client_seq = head->seq_num;
+        s->window_end = s->window_start;
+        s->sacked_bytes = 0;
+        s->lost_bytes = 0;
+        s->high_sacked = client_seq;
+        s->dupacks = 0;
+        s->fec.count = 0; // its segments are cut again; the repairs would not match
+    }
+
+    timer_cancel(&s->reactor.timers, &s->probe_timer);
+    s->probe_len = 0;
+    sender_probe_next(s);
+}
+
+// a corrupted packet is dropped as if the network had lost it; an intact
+// one loses its crc trailer from *rcv
+static int packet_usable(const struct sham_packet *packet, int *rcv)
+{
+    if (packet_intact(packet, rcv, crc_flag != 0))
+        return 1;
+    log_event("DROP CORRUPT SEQ=%u ACK=%u LEN=%d", packet->header.seq_num, packet->header.ack_num, *rcv);
+    return 0;
+}
+
+// edge-triggered: drain every queued ACK, then send once for all of them
+static void sender_readable(void *arg, uint32_t events)
+{
+    struct sender *s = arg;
+    struct sham_packet packet;
+
+    // zerocopy completions are queued on the error queue and raise EPOLLERR
+    if ((events & EPOLLERR) && !s->tx.batches)
+        batch_reap(s->batch);
+
+    while (1)
+    {
+        socklen_t addr_len = sizeof(*s->addr);
+        int rcv = recvfrom(s->sockfd, &packet, sizeof(packet), MSG_DONTWAIT,
+                           (struct sockaddr *)s->addr, &addr_len);
+        if (rcv < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (!packet_usable(&packet, &rcv))
+            continue;
+        if (packet.header.flags & ACK_FLAG)
+            sender_on_ack(s, &packet, rcv);
+        else if (packet.header.flags & MTU_PROBE_FLAG)
+            sender_on_probe_ack(s, &packet);
+    }
+    sender_pump(s);
+}
+
+// retransmission timeout: everything not sacked is presumed lost
+static void sender_rto(void *arg)
+{
+    struct sender *s = arg;
+    if (s->window_start < s->window_end)
+    {
+        struct packet_info *head = &s->window[s->window_start % MAX_WINDOW];
+        log_event("TIMEOUT SEQ=%u RTO=%ldms", head->seq_num, s->rtt.rto_us / 1000);
+        cc_on_timeout(&s->cc, client_seq - head->seq_num - s->sacked_bytes);
+        rtt_backoff(&s->rtt);
+        if (s->rtt.backoff >= PMTU_BLACKHOLE_RTOS)
+            sender_blackhole(s);
+
+        for (int i = s->window_start; i < s->window_end; i++)
+        {
+            struct packet_info *p = &s->window[i % MAX_WINDOW];
+            if (!p->sacked)
+                mark_lost(p, &s->lost_bytes);
+        }
+        s->dupacks = 0;
+        timer_arm(&s->reactor.timers, &s->rto_timer, monotonic_us() + s->rtt.rto_us);
+    }
+    sender_pump(s);
+}
+
+static void sender_persist(void *arg)
+{
+    struct sender *s = arg;
+    struct sham_header probe;
+    probe.seq_num = client_seq;
+    probe.ack_num = 0;
+    probe.flags = crc_flag;
+    probe.window_size = BUFFER_SIZE;
+    send_packet_iov(s->sockfd, s->addr, &probe, NULL, 0);
+    log_event("PROBE SEQ=%u RWND=%u", client_seq, s->rwnd);
+
+    s->persist_us *= 2;
+    if (s->persist_us > RTO_MAX_MS * 1000L)
+        s->persist_us = RTO_MAX_MS * 1000L;
+    timer_arm(&s->reactor.timers, &s->persist_timer, monotonic_us() + s->persist_us);
+}
+
+static void sender_send_fin(struct sender *s)
+{
+    struct sham_packet packet;
+    int len = s->final_len > 0 ? s->final_len : 0;
+    packet.header.seq_num = s->fin_seq;
+    packet.header.ack_num = 0;
+    packet.header.flags = FIN_FLAG | crc_flag;
+    packet.header.window_size = BUFFER_SIZE;
+    memcpy(packet.data, s->final_digest, len);
+    send_packet(s->sockfd, s->addr, &packet, len);
+}
+
+// the receiver's FIN carries the digest of what it wrote: a different one
+// fails the transfer
+static void sender_check_digest(struct sender *s, const struct sham_packet *packet, int len)
+{
+    if (s->digest_checked || len <= 0 || s->final_len <= 0)
+        return;
+    s->digest_checked = 1;
+    if (len == s->final_len && memcmp(packet->data, s->final_digest, len) == 0)
+    {
+        log_event("DIGEST %s MATCH", digest_name(s->digest.algo));
+        digest_print(s->digest.algo, s->final_digest, s->final_len);
+        if (s->stripe)
+        {
+            pthread_mutex_lock(&s->stripe->lock);
+            s->stripe->verified = 1;
+            pthread_mutex_unlock(&s->stripe->lock);
+        }
+        return;
+    }
+    log_event("DIGEST %s MISMATCH", digest_name(s->digest.algo));
+    fprintf(stderr, "digest mismatch: the receiver's copy differs from the input\n");
+    s->result = -1;
+}
+
+// stale data ACKs may still be queued; only the FIN exchange counts
+static void sender_fin_readable(void *arg, uint32_t events)
+{
+    struct sender *s = arg;
+    struct sham_packet packet;
+    (void)events;
+
+    while (1)
+    {
+        socklen_t addr_len = sizeof(*s->addr);
+        int rcv = recvfrom(s->sockfd, &packet, sizeof(packet), MSG_DONTWAIT,
+                           (struct sockaddr *)s->addr, &addr_len);
+        if (rcv < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (!packet_usable(&packet, &rcv))
+            continue;
+
+        if (state == FIN_WAIT_1 && (packet.header.flags & ACK_FLAG) &&
+            packet.header.ack_num == s->fin_seq + 1)
+        {
+            log_event("RCV ACK FOR FIN");
+            state = FIN_WAIT_2;
+            // our FIN is in; the receiver's may wait on a digest of the whole
+            // file, so give it as long as the receiver gives a silent peer
+            timer_arm(&s->reactor.timers, &s->fin_timer, monotonic_us() + IDLE_TIMEOUT_MS * 1000L);
+        }
+
+        if (packet.header.flags & FIN_FLAG)
+        {
+            uint32_t peer_fin_seq = packet.header.seq_num;
+            log_event("RCV FIN SEQ=%u", peer_fin_seq);
+            sender_check_digest(s, &packet, rcv - (int)sizeof(struct sham_header));
+
+            // ACK every copy of the peer's FIN until TIME_WAIT expires
+            packet.header.seq_num = s->fin_seq + 1;
+            packet.header.ack_num = peer_fin_seq + 1;
+            packet.header.flags = ACK_FLAG | crc_flag;
+            packet.header.window_size = BUFFER_SIZE;
+            send_packet(s->sockfd, s->addr, &packet, 0);
+            log_event("SND ACK=%u", packet.header.ack_num);
+
+            if (state != TIME_WAIT)
+            {
+                state = TIME_WAIT;
+                timer_cancel(&s->reactor.timers, &s->fin_timer);
+                timer_arm(&s->reactor.timers, &s->time_wait_timer, monotonic_us() + TIME_WAIT_MS * 1000L);
+            }
+        }
+    }
+}
+
+static void sender_fin_rto(void *arg)
+{
+    struct sender *s = arg;
+    if (state == FIN_WAIT_2 || ++s->fin_tries > FIN_RETRIES)
+    {
+        // without the receiver's FIN there is no digest to check against
+        log_event("FIN GIVE UP");
+        fprintf(stderr, "no FIN from the receiver: its copy could not be verified\n");
+        s->result = -1;
+        reactor_stop(&s->reactor);
+        return;
+    }
+    sender_send_fin(s);
+    log_event("RETX FIN SEQ=%u", s->fin_seq);
+    rtt_backoff(&s->rtt);
+    timer_arm(&s->reactor.timers, &s->fin_timer, monotonic_us() + s->rtt.rto_us);
+}
+
+static void sender_time_wait(void *arg)
+{
+    struct sender *s = arg;
+    reactor_stop(&s->reactor);
+}
+
+// all data acked: send FIN and hand the socket to the close callbacks
+static void sender_start_close(struct sender *s)
+{
+    timer_cancel(&s->reactor.timers, &s->rto_timer);
+    timer_cancel(&s->reactor.timers, &s->persist_timer);
+    timer_cancel(&s->reactor.timers, &s->probe_timer);
+    timer_cancel(&s->reactor.timers, &s->fec_timer);
+    if (s->fec.mode != FEC_NONE)
+        log_event("FEC %s BLOCKS=%lu REPAIRS=%lu REBUILT=%u FAILED=%u LOSS=%.4f", fec_name(s->fec.mode),
+                  s->fec.blocks, s->fec.repairs, s->fec.seen.repaired, s->fec.seen.failed, s->fec.loss);
+    if (!s->src.mapped)
+        log_event("POOL FILLS=%lu RESENDS=%lu COPIED=%lu", s->src.pool.fills, s->src.pool.resends,
+                  s->src.pool.copied);
+    if (!s->tx.batches)
+        log_event("BATCH DATAGRAMS=%lu SYSCALLS=%lu GSO=%d WAKEUPS=%lu ZC=%lu COPIED=%lu", s->batch->datagrams,
+                  s->batch->syscalls, s->batch->gso, s->reactor.wakeups, s->batch->zc_sends,
+                  s->batch->zc_copied);
+
+    // every byte has been queued at least once, so the digest is complete;
+    // the reader thread has read the whole file and can go
+    read_ahead_stop(&s->ahead);
+    s->src.ahead = NULL;
+    if (s->stripe)
+    {
+        log_event("STRIPE FLOW=%d RANGES=%d BYTES=%lld", s->flow, s->nranges, (long long)s->file_pos);
+        s->final_len = stripe_digest_wait(s->stripe, s->final_digest);
+    }
+    else
+    {
+        s->final_len = digest_final(&s->digest, s->final_digest);
+    }
+
+    s->fin_seq = client_seq; // next unsent seq
+    s->fin_tries = 0;
+    sender_send_fin(s);
+    log_event("SND FIN SEQ=%u", s->fin_seq);
+    state = FIN_WAIT_1;
+    timer_arm(&s->reactor.timers, &s->fin_timer, monotonic_us() + s->rtt.rto_us);
+    s->watch.cb = sender_fin_readable;
+}
+
+// send file with sliding window and retransmission, driven by the reactor
+int send_file(int sockfd, struct sockaddr_in *addr, const char *filename, float loss_rate)
+{
+    (void)loss_rate;
+
+    struct sender *s = calloc(1, sizeof(*s));
+    if (!s)
+    {
+        perror("failed to allocate sender");
+        return -1;
+    }
+    s->sockfd = sockfd;
+    s->addr = addr;
+    s->stripe = my_stripe;
+    s->flow = my_flow;
+
+    if (source_open(&s->src, filename, use_mmap) < 0)
+    {
+        free(s);
+        return -1;
+    }
+    s->file_size = s->stripe ? (off_t)INT64_MAX : s->src.size;
+
+    // a buffer per window slot, plus the sends a batch, the transmitter or
+    // the kernel (zerocopy) may still be reading when a slot comes round again
+    int in_flight = batch_size * (use_pipeline ? PIPE_BATCHES : use_zerocopy ? ZEROCOPY_SLABS : 1);
+    if (!s->src.mapped && packet_pool_init(&s->src.pool, MAX_WINDOW + in_flight, syn_opts.mss) < 0)
+    {
+        source_close(&s->src);
+        free(s);
+        return -1;
+    }
+
+    s->window = calloc(MAX_WINDOW, sizeof(*s->window));
+    if (!s->window)
+    {
+        perror("failed to allocate send window");
+        source_close(&s->src);
+        free(s);
+        return -1;
+    }
+
+    if (use_pipeline ? tx_stage_start(&s->tx, sockfd, addr, batch_size, syn_opts.mss, use_gso, use_uring)
+                     : batch_init(&s->batch_store, sockfd, addr, batch_size, syn_opts.mss, use_gso, use_uring))
+    {
+        free(s->window);
+        source_close(&s->src);
+        free(s);
+        return -1;
+    }
+    s->batch = use_pipeline ? tx_stage_swap(&s->tx, NULL) : &s->batch_store;
+    // without SO_ZEROCOPY the batch keeps copying; that is logged, not fatal
+    if (use_zerocopy)
+        batch_zerocopy(s->batch, zerocopy_min);
+
+    if (reactor_init(&s->reactor) < 0 ||
+        reactor_add(&s->reactor, &s->watch, sockfd, EPOLLIN | EPOLLET, sender_readable, s) < 0)
+    {
+        reactor_free(&s->reactor);
+        if (use_pipeline)
+            tx_stage_stop(&s->tx, NULL);
+        else
+            batch_free(&s->batch_store);
+        free(s->window);
+        source_close(&s->src);
+        free(s);
+        return -1;
+    }
+
+    // with discovery, data starts at a size every path carries and grows
+    // as probes confirm larger ones; without, the negotiated mss is trusted
+    s->mss_max = syn_opts.mss;
+    s->mss = use_pmtud && s->mss_max > BASE_MSS ? BASE_MSS : s->mss_max;
+    s->probe_hi = s->mss_max + 1;
+
+    s->digest.algo = (digest_algo_t)syn_opts.digest;
+    if (!s->stripe && resume_from > 0)
+    {
+        // the server has the prefix; it was hashed when it was checked
+        s->digest = resume_digest;
+        resume_digest.ctx = NULL;
+        s->file_pos = resume_from;
+    }
+    else if (!s->stripe && digest_init(&s->digest, (digest_algo_t)syn_opts.digest) < 0)
+        s->result = -1;
+    if (s->result == 0 && use_pipeline &&
+        read_ahead_start(&s->ahead, filename, s->file_pos, s->file_size, &s->digest) == 0)
+        s->src.ahead = &s->ahead;
+    else if (use_pipeline)
+        s->result = -1;
+
+    // the server may have turned fec down, or capped it
+    s->fec.mode = (fec_mode_t)syn_opts.fec;
+    if (s->fec.mode != FEC_NONE)
+    {
+        s->fec.k = syn_opts.fec_k;
+        s->fec.parity_max = syn_opts.fec_parity;
+        s->fec.repair = malloc((size_t)s->fec.parity_max * MAX_DATA_SIZE);
+        s->fec.sent = calloc(MAX_WINDOW, sizeof(*s->fec.sent));
+        if (!s->fec.repair || !s->fec.sent)
+        {
+            perror("failed to allocate fec buffers");
+            s->result = -1;
+        }
+    }
+
+    s->high_sacked = client_seq;
+    cc_init(&s->cc, cc_algo, s->mss);
+    log_event("CC %s CWND=%u SACK=%d MSS=%d", cc_name(&s->cc), s->cc.cwnd, sack_ok, s->mss);
+    rtt_init(&s->rtt);
+    s->rwnd = peer_rwnd;
+    timer_init(&s->rto_timer, sender_rto, s);
+    timer_init(&s->persist_timer, sender_persist, s);
+    timer_init(&s->fin_timer, sender_fin_rto, s);
+    timer_init(&s->time_wait_timer, sender_time_wait, s);
+    timer_init(&s->probe_timer, sender_probe_timeout, s);
+    timer_init(&s->fec_timer, sender_fec_expired, s);
+
+    if (!use_pmtud)
+        set_path_mtu_mode(sockfd, 0);
+    else if (s->mss < s->mss_max && set_path_mtu_mode(sockfd, 1) == 0)
+        sender_probe_next(s);
+    sender_pump(s);
+    if (s->result == 0 && reactor_run(&s->reactor) < 0)
+        s->result = -1;
+    // a receiver that predates the digest answers with a bare FIN
+    if (s->result == 0 && !s->stripe && !s->digest_checked)
+        fprintf(stderr, "warning: the receiver sent no digest, the transfer is unverified\n");
+
+    read_ahead_stop(&s->ahead);
+    if (s->tx.batches && tx_stage_stop(&s->tx, s->batch) < 0)
+        s->result = -1;
+    else if (!s->tx.batches)
+        batch_free(&s->batch_store);
+
+    int result = s->result;
+    digest_free(&s->digest);
+    free(s->fec.repair);
+    free(s->fec.sent);
+    free(s->ranges);
+    reactor_free(&s->reactor);
+    free(s->window);
+    source_close(&s->src);
+    free(s);
+    state = CLOSED;
+    return result;
+}
+
+// ---- striped transfer ----
+
+static void *stripe_digest_main(void *arg)
+{
+    struct stripe *sp = arg;
+    unsigned char digest[DIGEST_MAX];
+    int len = -1;
+    int fd = open(sp->filename, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        len = digest_file(fd, (uint64_t)sp->size, digest_algo, digest);
+        close(fd);
+    }
+
+    pthread_mutex_lock(&sp->lock);
+    memcpy(sp->digest, digest, len > 0 ? len : 0);
+    sp->digest_len = len;
+    pthread_cond_broadcast(&sp->cond);
+    pthread_mutex_unlock(&sp->lock);
+    return NULL;
+}
+
+// no stream sends until every one has its connection: the server then
+// knows the whole group before any of it finishes
+static int stripe_ready(struct stripe *sp, int ok)
+{
+    pthread_mutex_lock(&sp->lock);
+    sp->ready++;
+    if (!ok)
+        sp->failed++;
+    pthread_cond_broadcast(&sp->cond);
+    while (sp->ready < sp->flows)
+        pthread_cond_wait(&sp->cond, &sp->lock);
+    int failed = sp->failed;
+    pthread_mutex_unlock(&sp->lock);
+    return failed ? -1 : 0;
+}
+
+// one connection of a striped transfer, on a socket and thread of its own
+struct stream
+{
+    struct stripe *stripe;
+    int index;
+    struct sockaddr_in addr;
+    const char *filename;
+    pthread_t thread;
+    int result;
+};
+
+static void *stream_main(void *arg)
+{
+    struct stream *st = arg;
+    my_stripe = st->stripe;
+    my_flow = st->index;
 
-    // step 1: send SYN
-    client_seq = generate_initial_seq();
-    packet.header.seq_num = client_seq;
-    packet.header.ack_num = 0;
-    packet.header.flags = SYN_FLAG;
-    packet.header.window_size = BUFFER_SIZE;
+    int fd = create_socket(0);
+    uint32_t initial_seq;
+    int ok = three_way_handshake_client(fd, &st->addr, &initial_seq) == 0;
+    if (!ok)
+        fprintf(stderr, "stream %d: handshake failed\n", st->index);
+    st->result = stripe_ready(st->stripe, ok) == 0 ? send_file(fd, &st->addr, st->filename, 0) : -1;
+    close(fd);
+    return NULL;
+}
 
-    if (send_packet(sockfd, server_addr, &packet, 0) < 0)
+// --streams: send one file over nstreams connections at once; the server
+// puts every range at its offset in one output file and checks the digest
+// of the whole of it
+static int send_file_striped(struct sockaddr_in *addr, const char *filename, int nstreams)
+{
+    struct stripe sp;
+    memset(&sp, 0, sizeof(sp));
+    pthread_mutex_init(&sp.lock, NULL);
+    pthread_cond_init(&sp.cond, NULL);
+    sp.id = (uint32_t)(monotonic_us() * 2654435761u) ^ (uint32_t)getpid();
+    if (sp.id == 0)
+        sp.id = 1;
+    sp.flows = nstreams;
+    sp.filename = filename;
+    sp.size = input_size;
+    sp.flow = calloc(nstreams, sizeof(*sp.flow));
+    struct stream *streams = calloc(nstreams, sizeof(*streams));
+    pthread_t digest_thread;
+    int result = 0;
+    if (!sp.flow || !streams || pthread_create(&digest_thread, NULL, stripe_digest_main, &sp) != 0)
     {
+        fprintf(stderr, "failed to set up striped transfer\n");
+        free(sp.flow);
+        free(streams);
         return -1;
     }
+    log_event("STRIPE %u STREAMS=%d SIZE=%lld", sp.id, nstreams, (long long)sp.size);
 
-    log_event("SND SYN SEQ=%u", client_seq);
-    state = SYN_SENT;
-
-    // step 2: receive SYN-ACK with timeout
-    socklen_t addr_len = sizeof(*server_addr);
-    fd_set readfds;
-    struct timeval tv;
-    FD_ZERO(&readfds);
-    FD_SET(sockfd, &readfds);
-    tv.tv_sec = 10;  // 10 second timeout
-    tv.tv_usec = 0;
-
-    int sel = select(sockfd + 1, &readfds, NULL, NULL, &tv);
-    if (sel <= 0) {
-        if (sel == 0) {
-            fprintf(stderr, "connection timeout: server not responding\n");
-        } else {
-            perror("select failed during handshake");
+    int started = 0;
+    for (; started < nstreams; started++)
+    {
+        struct stream *st = &streams[started];
+        st->stripe = &sp;
+        st->index = started;
+        st->addr = *addr;
+        st->filename = filename;
+        if (pthread_create(&st->thread, NULL, stream_main, st) != 0)
+        {
+            fprintf(stderr, "failed to start stream %d\n", started);
+            break;
         }
-        return -1;
     }
+    if (started < nstreams)
+    {
+        // the streams already started wait for the rest: count these as failed
+        pthread_mutex_lock(&sp.lock);
+        sp.ready += nstreams - started;
+        sp.failed += nstreams - started;
+        pthread_cond_broadcast(&sp.cond);
+        pthread_mutex_unlock(&sp.lock);
+        result = -1;
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(streams[i].thread, NULL);
+        if (streams[i].result < 0)
+            result = -1;
+    }
+    pthread_join(digest_thread, NULL);
+    log_event("STRIPE %u DONE STEALS=%lu RESULT=%d", sp.id, sp.steals, result);
+    if (result == 0 && !sp.verified)
+        fprintf(stderr, "warning: the receiver sent no digest, the transfer is unverified\n");
+
+    free(streams);
+    free(sp.flow);
+    pthread_mutex_destroy(&sp.lock);
+    pthread_cond_destroy(&sp.cond);
+    return result;
+}
 
-    int bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                             (struct sockaddr *)server_addr, &addr_len);
-    if (bytes_recv < 0)
+// acknowledge chat messages up to ack_num
+static void send_chat_ack(int sockfd, struct sockaddr_in *addr, uint32_t seq_num, uint32_t ack_num)
+{
+    struct sham_packet ack_packet;
+    ack_packet.header.seq_num = seq_num;
+    ack_packet.header.ack_num = ack_num;
+    ack_packet.header.flags = ACK_FLAG;
+    ack_packet.header.window_size = BUFFER_SIZE;
+    send_packet(sockfd, addr, &ack_packet, 0);
+    log_event("SND ACK=%u", ack_num);
+}
+
+// chat session: stdin is watched level-triggered because fgets buffers it,
+// the socket edge-triggered and drained on every wakeup
+enum chat_end
+{
+    CHAT_RUNNING,
+    CHAT_QUIT,      // local /quit: we send the first FIN
+    CHAT_PEER_FIN,  // peer sent FIN: answer it
+    CHAT_PEER_QUIT, // peer sent /quit as a message
+};
+
+struct chat
+{
+    struct reactor reactor;
+    struct io_watch input_watch;
+    struct io_watch sock_watch;
+    int sockfd;
+    struct sockaddr_in *addr;
+
+    // delayed ack: one ACK per ack_freq messages or ack_delay_ms, whichever first
+    struct sham_timer delack_timer;
+    int unacked;
+    uint32_t pending_ack;
+
+    enum chat_end end;
+};
+
+// the FIN that ended chat mode, so the passive close can answer it at once
+static int chat_fin_pending = 0;
+static uint32_t chat_fin_seq = 0;
+
+static void chat_delack(void *arg)
+{
+    struct chat *c = arg;
+    if (c->unacked > 0)
     {
-        perror("recvfrom failed in handshake");
-        return -1;
+        send_chat_ack(c->sockfd, c->addr, client_seq, c->pending_ack);
+        c->unacked = 0;
     }
+}
+
+static void chat_input(void *arg, uint32_t events)
+{
+    struct chat *c = arg;
+    char input_buffer[1024];
+    struct sham_packet packet;
+    (void)events;
 
-    if (!(packet.header.flags & (SYN_FLAG | ACK_FLAG)))
+    // end of input closes the session like /quit
+    if (!fgets(input_buffer, sizeof(input_buffer), stdin))
     {
-        fprintf(stderr, "expected SYN-ACK packet\n");
-        return -1;
+        c->end = CHAT_QUIT;
+        reactor_stop(&c->reactor);
+        return;
     }
 
-    server_seq = packet.header.seq_num;
-    log_event("RCV SYN-ACK SEQ=%u ACK=%u", server_seq, packet.header.ack_num);
+    // strip newline
+    int msg_len = strlen(input_buffer);
+    if (msg_len > 0 && input_buffer[msg_len - 1] == '\n')
+    {
+        input_buffer[msg_len - 1] = '\0';
+        msg_len--;
+    }
 
-    if (packet.header.ack_num != client_seq + 1)
+    if (strcmp(input_buffer, "/quit") == 0)
     {
-        fprintf(stderr, "invalid ACK number in SYN-ACK\n");
-        return -1;
+        // initiate 4-way handshake close
+        c->end = CHAT_QUIT;
+        reactor_stop(&c->reactor);
+        return;
     }
 
-    // step 3: send ACK
+    // send message
     packet.header.seq_num = client_seq;
-    packet.header.ack_num = server_seq + 1;
-    packet.header.flags = ACK_FLAG;
+    packet.header.ack_num = 0;
+    packet.header.flags = 0;
     packet.header.window_size = BUFFER_SIZE;
 
-    if (send_packet(sockfd, server_addr, &packet, 0) < 0)
+    if (msg_len > 0 && msg_len < MAX_DATA_SIZE)
     {
-        return -1;
+        memcpy(packet.data, input_buffer, msg_len);
+        packet.data[msg_len] = '\0';
     }
 
-    log_event("SND ACK FOR SYN");
-    state = ESTABLISHED;
-    client_seq++; // increment for data packets
-    *initial_seq = client_seq;
-    return 0;
+    send_packet(c->sockfd, c->addr, &packet, msg_len);
+    log_event("SND DATA SEQ=%u LEN=%d", client_seq, msg_len);
+    client_seq += msg_len;
 }
 
-// send file with sliding window and retransmission
-int send_file(int sockfd, struct sockaddr_in *addr, const char *filename, float loss_rate)
+static void chat_readable(void *arg, uint32_t events)
 {
-    (void)loss_rate;
-    
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        fprintf(stderr, "failed to open input file '%s': %s\n", 
-                filename, strerror(errno));
-        return -1;
-    }
-
-    // Verify file is readable
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    if (file_size <= 0) {
-        fprintf(stderr, "input file '%s' is empty or unreadable\n", filename);
-        fclose(file);
-        return -1;
-    }
-
+    struct chat *c = arg;
     struct sham_packet packet;
-    struct packet_info window[WINDOW_SIZE];
-    int window_start = 0, window_end = 0;
-    long file_pos = 0; // track absolute file offset
-    int bytes_read = 0;
-    char buffer[MAX_DATA_SIZE];
+    (void)events;
 
-    packet.header.flags = 0;
-    packet.header.window_size = BUFFER_SIZE;
-
-    while (1)
+    while (c->end == CHAT_RUNNING)
     {
-        // fill window
-        while (window_end - window_start < WINDOW_SIZE)
+        socklen_t addr_len = sizeof(*c->addr);
+        int bytes_recv = recvfrom(c->sockfd, &packet, sizeof(packet), MSG_DONTWAIT,
+                                  (struct sockaddr *)c->addr, &addr_len);
+        if (bytes_recv < 0)
         {
-            if (fseek(file, file_pos, SEEK_SET) != 0)
-                break;
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (bytes_recv == 0)
+            continue;
 
-            bytes_read = fread(buffer, 1, MAX_DATA_SIZE, file);
-            if (bytes_read <= 0)
-                break;
+        if (packet.header.flags & FIN_FLAG)
+        {
+            // handle connection close
+            chat_fin_pending = 1;
+            chat_fin_seq = packet.header.seq_num;
+            c->end = CHAT_PEER_FIN;
+            reactor_stop(&c->reactor);
+            return;
+        }
 
-            // setup packet
-            packet.header.seq_num = client_seq; // use current seq
-            packet.header.ack_num = 0;
-            memcpy(packet.data, buffer, bytes_read);
+        int data_len = bytes_recv - sizeof(struct sham_header);
+        if (data_len > 0)
+        {
+            if (data_len >= MAX_DATA_SIZE)
+                data_len = MAX_DATA_SIZE - 1;
+            packet.data[data_len] = '\0';
 
-            if (send_packet(sockfd, addr, &packet, bytes_read) < 0)
+            // check if peer sent /quit
+            if (strcmp(packet.data, "/quit") == 0)
             {
-                fclose(file);
-                return -1;
+                printf("peer disconnected\n");
+                c->end = CHAT_PEER_QUIT;
+                reactor_stop(&c->reactor);
+                return;
             }
 
-            log_event("SND DATA SEQ=%u LEN=%d", packet.header.seq_num, bytes_read);
-
-            // track packet
-            int idx = window_end % WINDOW_SIZE;
-            window[idx].seq_num = packet.header.seq_num;
-            window[idx].data_len = bytes_read;
-            window[idx].file_offset = file_pos; // save offset
-            gettimeofday(&window[idx].sent_time, NULL);
-            window[idx].retransmitted = 0;
-
-            client_seq += bytes_read; // advance once per packet
-            file_pos += bytes_read;
-            window_end++;
+            printf("received: %s\n", packet.data);
         }
 
-        // check ACKs or timeout
-        fd_set readfds;
-        struct timeval timeout;
-        FD_ZERO(&readfds);
-        FD_SET(sockfd, &readfds);
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 100000;
-
-        int sel = select(sockfd + 1, &readfds, NULL, NULL, &timeout);
-        if (sel > 0 && FD_ISSET(sockfd, &readfds))
+        // ACK messages only, never pure ACKs; a gap in the
+        // sequence is acked at once, in-order data may wait
+        if (data_len > 0)
         {
-            socklen_t addr_len = sizeof(*addr);
-            int rcv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                              (struct sockaddr *)addr, &addr_len);
-
-            if (rcv > 0 && (packet.header.flags & ACK_FLAG))
+            int in_order = c->unacked == 0 || packet.header.seq_num == c->pending_ack;
+            c->pending_ack = packet.header.seq_num + data_len;
+            c->unacked++;
+            if (!in_order || c->unacked >= syn_opts.ack_freq)
             {
-                log_event("RCV ACK=%u", packet.header.ack_num);
-                uint32_t ack_num = packet.header.ack_num;
-
-                while (window_start < window_end)
-                {
-                    int idx = window_start % WINDOW_SIZE;
-                    if (window[idx].seq_num + window[idx].data_len <= ack_num)
-                    {
-                        window_start++;
-                    }
-                    else
-                        break;
-                }
+                send_chat_ack(c->sockfd, c->addr, client_seq, c->pending_ack);
+                c->unacked = 0;
+                timer_cancel(&c->reactor.timers, &c->delack_timer);
             }
-        }
-        else if (sel == 0)
-        {
-            // timeout - retransmit
-            struct timeval now;
-            gettimeofday(&now, NULL);
-
-            for (int i = window_start; i < window_end; i++)
+            else if (!timer_armed(&c->delack_timer))
             {
-                int idx = i % WINDOW_SIZE;
-                long elapsed_ms = (now.tv_sec - window[idx].sent_time.tv_sec) * 1000 +
-                                 (now.tv_usec - window[idx].sent_time.tv_usec) / 1000;
-
-                if (elapsed_ms > RTO_MS)
-                {
-                    log_event("TIMEOUT SEQ=%u", window[idx].seq_num);
-                    packet.header.seq_num = window[idx].seq_num;
-                    packet.header.ack_num = 0;
-
-                    // reread original data
-                    fseek(file, window[idx].file_offset, SEEK_SET);
-                    int retx_bytes = fread(buffer, 1, window[idx].data_len, file);
-                    memcpy(packet.data, buffer, retx_bytes);
-
-                    send_packet(sockfd, addr, &packet, retx_bytes);
-                    log_event("RETX DATA SEQ=%u LEN=%d", window[idx].seq_num, retx_bytes);
-
-                    gettimeofday(&window[idx].sent_time, NULL);
-                    window[idx].retransmitted = 1;
-                }
+                timer_arm(&c->reactor.timers, &c->delack_timer,
+                          monotonic_us() + syn_opts.ack_delay_ms * 1000L);
             }
         }
-
-        if (window_start == window_end && bytes_read <= 0)
-            break;
     }
+}
 
-    fclose(file);
-
-    // send FIN
-    packet.header.seq_num = client_seq; // next unsent seq
-    packet.header.ack_num = 0;
-    packet.header.flags = FIN_FLAG;
-    packet.header.window_size = BUFFER_SIZE;
-    send_packet(sockfd, addr, &packet, 0);
-    log_event("SND FIN SEQ=%u", packet.header.seq_num);
+// chat mode for client
+int chat_mode(int sockfd, struct sockaddr_in *addr, int is_server)
+{
+    (void)is_server; // suppress unused parameter warning
 
-    // normal FIN/ACK handshake unchanged
-    socklen_t addr_len = sizeof(*addr);
-    int rcv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                      (struct sockaddr *)addr, &addr_len);
+    struct chat c;
+    memset(&c, 0, sizeof(c));
+    c.sockfd = sockfd;
+    c.addr = addr;
+    c.end = CHAT_RUNNING;
+    timer_init(&c.delack_timer, chat_delack, &c);
 
-    if (rcv > 0 && (packet.header.flags & ACK_FLAG))
+    if (reactor_init(&c.reactor) < 0 ||
+        reactor_add(&c.reactor, &c.input_watch, 0, EPOLLIN, chat_input, &c) < 0 ||
+        reactor_add(&c.reactor, &c.sock_watch, sockfd, EPOLLIN | EPOLLET, chat_readable, &c) < 0)
     {
-        log_event("RCV ACK FOR FIN");
+        reactor_free(&c.reactor);
+        return -1;
     }
 
-    rcv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                  (struct sockaddr *)addr, &addr_len);
+    printf("chat mode started. type /quit to exit\n");
+    fflush(stdout);
+
+    int result = reactor_run(&c.reactor);
+    reactor_free(&c.reactor);
+
+    if (c.end == CHAT_QUIT)
+        four_way_handshake_close(sockfd, addr, 1);
+    else if (c.end == CHAT_PEER_FIN)
+        four_way_handshake_close(sockfd, addr, 0);
+    return result;
+}
+
+// 4-way close: each step waits at most CLOSE_STEP_MS for its packet so a
+// lost FIN or ACK never hangs the session
+struct closer
+{
+    struct reactor reactor;
+    struct io_watch watch;
+    struct sham_timer step_timer;
+    int sockfd;
+    struct sockaddr_in *addr;
+    int passive;    // answering the peer's FIN rather than sending the first
+    int steps_left;
+};
+
+static void closer_send(struct closer *cl, uint8_t flags, uint32_t ack_num)
+{
+    struct sham_packet packet;
+    packet.header.seq_num = server_seq;
+    packet.header.ack_num = ack_num;
+    packet.header.flags = flags;
+    packet.header.window_size = BUFFER_SIZE;
+    send_packet(cl->sockfd, cl->addr, &packet, 0);
+}
 
-    if (rcv > 0 && (packet.header.flags & FIN_FLAG))
+// one step done or timed out: wait for the next one, or finish
+static void closer_next_step(struct closer *cl)
+{
+    if (--cl->steps_left <= 0)
     {
-        log_event("RCV FIN SEQ=%u", packet.header.seq_num);
-        packet.header.seq_num = client_seq;
-        packet.header.ack_num = packet.header.seq_num + 1;
-        packet.header.flags = ACK_FLAG;
-        packet.header.window_size = BUFFER_SIZE;
-        send_packet(sockfd, addr, &packet, 0);
-        log_event("SND ACK=%u", packet.header.ack_num);
+        reactor_stop(&cl->reactor);
+        return;
     }
+    timer_arm(&cl->reactor.timers, &cl->step_timer, monotonic_us() + CLOSE_STEP_MS * 1000L);
+}
 
-    return 0;
+static void closer_step_timeout(void *arg)
+{
+    closer_next_step(arg);
 }
 
-// chat mode for client
-int chat_mode(int sockfd, struct sockaddr_in *addr, int is_server)
+// passive side, FIN in hand: ACK it and send our own
+static void closer_answer_fin(struct closer *cl, uint32_t fin_seq)
 {
-    (void)is_server; // suppress unused parameter warning
-    fd_set readfds;
-    char input_buffer[1024];
-    struct sham_packet packet;
+    log_event("RCV FIN SEQ=%u", fin_seq);
 
-    printf("chat mode started. type /quit to exit\n");
+    // send ACK
+    closer_send(cl, ACK_FLAG, fin_seq + 1);
+    log_event("SND ACK FOR FIN");
+    state = CLOSE_WAIT;
 
-    while (1)
-    {
-        FD_ZERO(&readfds);
-        FD_SET(0, &readfds); // stdin
-        FD_SET(sockfd, &readfds);
-        int max_fd = (sockfd > 0) ? sockfd : 0;
+    // send our own FIN
+    closer_send(cl, FIN_FLAG, 0);
+    log_event("SND FIN SEQ=%u", server_seq);
+    state = LAST_ACK;
+}
+
+static void closer_on_packet(void *arg, uint32_t events)
+{
+    struct closer *cl = arg;
+    struct sham_packet packet;
+    (void)events;
 
-        if (select(max_fd + 1, &readfds, NULL, NULL, NULL) < 0)
+    while (cl->steps_left > 0)
+    {
+        socklen_t addr_len = sizeof(*cl->addr);
+        int bytes_recv = recvfrom(cl->sockfd, &packet, sizeof(packet), MSG_DONTWAIT,
+                                  (struct sockaddr *)cl->addr, &addr_len);
+        if (bytes_recv < 0)
         {
-            perror("select failed");
-            break;
+            if (errno == EINTR)
+                continue;
+            return;
         }
 
-        // check for input from stdin
-        if (FD_ISSET(0, &readfds))
+        if (state == FIN_WAIT_1 && (packet.header.flags & ACK_FLAG))
         {
-            if (fgets(input_buffer, sizeof(input_buffer), stdin))
-            {
-                // strip newline
-                int msg_len = strlen(input_buffer);
-                if (msg_len > 0 && input_buffer[msg_len - 1] == '\n')
-                {
-                    input_buffer[msg_len - 1] = '\0';
-                    msg_len--;
-                }
-
-                if (strcmp(input_buffer, "/quit") == 0)
-                {
-                    // initiate 4-way handshake close
-                    four_way_handshake_close(sockfd, addr, 1);
-                    break;
-                }
-
-                // send message
-                packet.header.seq_num = client_seq;
-                packet.header.ack_num = 0;
-                packet.header.flags = 0;
-                packet.header.window_size = BUFFER_SIZE;
-
-                if (msg_len > 0 && msg_len < MAX_DATA_SIZE)
-                {
-                    memcpy(packet.data, input_buffer, msg_len);
-                    packet.data[msg_len] = '\0';
-                }
-
-                send_packet(sockfd, addr, &packet, msg_len);
-                log_event("SND DATA SEQ=%u LEN=%d", client_seq, msg_len);
-                client_seq += msg_len;
-            }
+            log_event("RCV ACK FOR FIN");
+            state = FIN_WAIT_2;
+            closer_next_step(cl);
         }
-
-        // check for data from network
-        if (FD_ISSET(sockfd, &readfds))
+        else if ((state == FIN_WAIT_1 || state == FIN_WAIT_2) && (packet.header.flags & FIN_FLAG))
         {
-            socklen_t addr_len = sizeof(*addr);
-            int bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                                    (struct sockaddr *)addr, &addr_len);
+            uint32_t fin_seq = packet.header.seq_num;
+            log_event("RCV FIN SEQ=%u", fin_seq);
 
-            if (bytes_recv > 0)
-            {
-                if (packet.header.flags & FIN_FLAG)
-                {
-                    // handle connection close
-                    four_way_handshake_close(sockfd, addr, 0);
-                    break;
-                }
-                else
-                {
-                    int data_len = bytes_recv - sizeof(struct sham_header);
-                    if (data_len > 0)
-                    {
-                        if (data_len >= MAX_DATA_SIZE)
-                            data_len = MAX_DATA_SIZE - 1;
-                        packet.data[data_len] = '\0';
-
-                        // check if peer sent /quit
-                        if (strcmp(packet.data, "/quit") == 0)
-                        {
-                            printf("peer disconnected\n");
-                            break;
-                        }
-
-                        printf("received: %s\n", packet.data);
-                    }
-
-                    // send ACK
-                    struct sham_packet ack_packet;
-                    ack_packet.header.seq_num = client_seq;
-                    ack_packet.header.ack_num = packet.header.seq_num + data_len;
-                    ack_packet.header.flags = ACK_FLAG;
-                    ack_packet.header.window_size = BUFFER_SIZE;
-                    send_packet(sockfd, addr, &ack_packet, 0);
-                    log_event("SND ACK=%u", ack_packet.header.ack_num);
-                }
-            }
+            // step 4: send final ACK
+            closer_send(cl, ACK_FLAG, fin_seq + 1);
+            log_event("SND ACK=%u", fin_seq + 1);
+            state = TIME_WAIT;
+            cl->steps_left = 0;
+            reactor_stop(&cl->reactor);
+        }
+        else if (cl->passive && state != LAST_ACK && (packet.header.flags & FIN_FLAG))
+        {
+            closer_answer_fin(cl, packet.header.seq_num);
+            closer_next_step(cl);
+        }
+        else if (state == LAST_ACK && (packet.header.flags & ACK_FLAG))
+        {
+            log_event("RCV ACK=%u", packet.header.ack_num);
+            state = CLOSED;
+            cl->steps_left = 0;
+            reactor_stop(&cl->reactor);
         }
     }
-
-    return 0;
 }
 
 // 4-way handshake for connection close (safe + timeout)
 int four_way_handshake_close(int sockfd, struct sockaddr_in *addr, int is_initiator)
 {
-    struct sham_packet packet;
-    socklen_t addr_len = sizeof(*addr);
-    struct timeval tv;
-
-    // set 1s timeout so we don't hang forever
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    struct closer cl;
+    memset(&cl, 0, sizeof(cl));
+    cl.sockfd = sockfd;
+    cl.addr = addr;
+    timer_init(&cl.step_timer, closer_step_timeout, &cl);
+
+    if (reactor_init(&cl.reactor) < 0 ||
+        reactor_add(&cl.reactor, &cl.watch, sockfd, EPOLLIN | EPOLLET, closer_on_packet, &cl) < 0)
+    {
+        reactor_free(&cl.reactor);
+        return -1;
+    }
 
     if (is_initiator)
     {
-        // step 1: send FIN
-        packet.header.seq_num = server_seq;
-        packet.header.ack_num = 0;
-        packet.header.flags = FIN_FLAG;
-        packet.header.window_size = BUFFER_SIZE;
-        send_packet(sockfd, addr, &packet, 0);
+        // send FIN, then wait for its ACK and the peer's FIN
+        closer_send(&cl, FIN_FLAG, 0);
         log_event("SND FIN SEQ=%u", server_seq);
         state = FIN_WAIT_1;
-
-        // step 2: wait for ACK
-        int bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                                 (struct sockaddr *)addr, &addr_len);
-        if (bytes_recv > 0 && (packet.header.flags & ACK_FLAG))
-        {
-            log_event("RCV ACK FOR FIN");
-            state = FIN_WAIT_2;
-        }
-
-        // step 3: wait for peer's FIN
-        bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                             (struct sockaddr *)addr, &addr_len);
-        if (bytes_recv > 0 && (packet.header.flags & FIN_FLAG))
-        {
-            uint32_t peer_fin_seq = packet.header.seq_num;
-            log_event("RCV FIN SEQ=%u", peer_fin_seq);
-
-            // step 4: send final ACK
-            struct sham_packet ack_packet;
-            ack_packet.header.seq_num = server_seq;
-            ack_packet.header.ack_num = peer_fin_seq + 1;
-            ack_packet.header.flags = ACK_FLAG;
-            ack_packet.header.window_size = BUFFER_SIZE;
-            send_packet(sockfd, addr, &ack_packet, 0);
-            log_event("SND ACK=%u", ack_packet.header.ack_num);
-            state = TIME_WAIT;
-        }
+        cl.steps_left = 2;
+    }
+    else if (chat_fin_pending)
+    {
+        cl.passive = 1;
+        // chat mode already read the FIN; only the final ACK is left
+        chat_fin_pending = 0;
+        closer_answer_fin(&cl, chat_fin_seq);
+        cl.steps_left = 1;
     }
     else
     {
-        // passive side: wait for FIN
-        int bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                                 (struct sockaddr *)addr, &addr_len);
-        if (bytes_recv > 0 && (packet.header.flags & FIN_FLAG))
-        {
-            uint32_t peer_fin_seq = packet.header.seq_num;
-            log_event("RCV FIN SEQ=%u", peer_fin_seq);
-
-            // send ACK
-            struct sham_packet ack_packet;
-            ack_packet.header.seq_num = server_seq;
-            ack_packet.header.ack_num = peer_fin_seq + 1;
-            ack_packet.header.flags = ACK_FLAG;
-            ack_packet.header.window_size = BUFFER_SIZE;
-            send_packet(sockfd, addr, &ack_packet, 0);
-            log_event("SND ACK FOR FIN");
-            state = CLOSE_WAIT;
-
-            // send our own FIN
-            packet.header.seq_num = server_seq;
-            packet.header.ack_num = 0;
-            packet.header.flags = FIN_FLAG;
-            packet.header.window_size = BUFFER_SIZE;
-            send_packet(sockfd, addr, &packet, 0);
-            log_event("SND FIN SEQ=%u", server_seq);
-            state = LAST_ACK;
-
-            // wait for final ACK (with timeout)
-            bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                                 (struct sockaddr *)addr, &addr_len);
-            if (bytes_recv > 0 && (packet.header.flags & ACK_FLAG))
-            {
-                log_event("RCV ACK=%u", packet.header.ack_num);
-                state = CLOSED;
-            }
-        }
+        // passive side: wait for FIN, then for the final ACK
+        cl.passive = 1;
+        cl.steps_left = 2;
     }
+    timer_arm(&cl.reactor.timers, &cl.step_timer, monotonic_us() + CLOSE_STEP_MS * 1000L);
 
-    // restore blocking mode (remove timeout)
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
-    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-    return 0;
+    int result = reactor_run(&cl.reactor);
+    reactor_free(&cl.reactor);
+    return result;
 }
 
 int main(int argc, char *argv[])
@@ -479,9 +2132,35 @@ int main(int argc, char *argv[])
         fprintf(stderr, "Usage:\n");
         fprintf(stderr, "  File mode: %s <server_ip> <server_port> <input_file> <output_file> [loss_rate]\n", argv[0]);
         fprintf(stderr, "  Chat mode: %s <server_ip> <server_port> --chat [loss_rate]\n", argv[0]);
+        fprintf(stderr, "  Options:   --cc reno|newreno|cubic  (file mode, default newreno)\n");
+        fprintf(stderr, "             --no-sack                do not offer selective acks\n");
+        fprintf(stderr, "             --mmap                   send straight from a file mapping\n");
+        fprintf(stderr, "             --batch N                datagrams per sendmmsg (default %d)\n", SEND_BATCH);
+        fprintf(stderr, "             --no-gso                 do not coalesce batches with UDP GSO\n");
+        fprintf(stderr, "             --uring                  send batches through io_uring\n");
+        fprintf(stderr, "             --zerocopy               send large batches with MSG_ZEROCOPY\n");
+        fprintf(stderr, "             --zerocopy-min N         smallest sendmsg to send zerocopy (default %d bytes)\n",
+                ZEROCOPY_MIN_BYTES);
+        fprintf(stderr, "             --ack-freq N             ask the peer to ack every Nth segment (1 = no delayed acks)\n");
+        fprintf(stderr, "             --mss N                  largest payload to negotiate (default %d, %d with --no-pmtud)\n",
+                MAX_DATA_SIZE, BASE_MSS);
+        fprintf(stderr, "             --no-pmtud               send at the negotiated mss without probing the path\n");
+        fprintf(stderr, "             --digest NAME            end-to-end digest: md5, sha256, blake2s256, blake2b512\n"
+                        "                                      (default md5)\n");
+        fprintf(stderr, "             --no-crc                 do not offer a per-packet crc32c\n");
+        fprintf(stderr, "             --fec xor|rs             send repair segments for blocks of data (default off)\n");
+        fprintf(stderr, "             --fec-k N                data segments per fec block (default %d, at most %d)\n",
+                FEC_K, FEC_MAX_K);
+        fprintf(stderr, "             --fec-max N              most rs repairs per block (default %d, at most %d)\n",
+                FEC_PARITY, FEC_MAX_PARITY);
+        fprintf(stderr, "             --pipeline               read ahead and send on threads of their own\n");
+        fprintf(stderr, "             --streams N              stripe the file over N parallel connections (at most %d)\n",
+                MAX_STREAMS);
+        fprintf(stderr, "             --resume                 pick up where an interrupted transfer of the file stopped\n");
         fprintf(stderr, "\nExamples:\n");
         fprintf(stderr, "  %s 127.0.0.1 8080 input.txt output.txt\n", argv[0]);
         fprintf(stderr, "  %s 127.0.0.1 8080 input.txt output.txt 0.1\n", argv[0]);
+        fprintf(stderr, "  %s 127.0.0.1 8080 input.txt output.txt --cc cubic\n", argv[0]);
         fprintf(stderr, "  %s 127.0.0.1 8080 --chat\n", argv[0]);
         fprintf(stderr, "  %s 127.0.0.1 8080 --chat 0.1\n", argv[0]);
         exit(1);
@@ -494,23 +2173,196 @@ int main(int argc, char *argv[])
     char *input_file = NULL;
 
     // parse arguments
+    int first_opt;
     if (strcmp(argv[3], "--chat") == 0)
     {
         chat_mode_flag = 1;
-        if (argc > 4)
-        {
-            loss_rate = atof(argv[4]);
-        }
+        first_opt = 4;
     }
     else
     {
         input_file = argv[3];
-        if (argc > 5)
+        first_opt = 5;
+    }
+
+    // trailing options: [loss_rate] [--cc reno|newreno|cubic] [--no-sack] [--mmap]
+    //                   [--batch N] [--no-gso] [--uring] [--zerocopy] [--zerocopy-min N]
+    //                   [--ack-freq N] [--mss N] [--no-pmtud] [--digest NAME] [--no-crc]
+    //                   [--fec xor|rs] [--fec-k N] [--fec-max N] [--pipeline] [--streams N]
+    //                   [--resume]
+    for (int i = first_opt; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-sack") == 0)
+        {
+            sack_enabled = 0;
+            continue;
+        }
+        if (strcmp(argv[i], "--mmap") == 0)
+        {
+            use_mmap = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--no-crc") == 0)
+        {
+            crc_enabled = 0;
+            continue;
+        }
+        if (strcmp(argv[i], "--resume") == 0)
+        {
+            use_resume = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--pipeline") == 0)
+        {
+            use_pipeline = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--fec") == 0 && i + 1 < argc)
+        {
+            if (fec_from_name(argv[++i], &fec_mode) < 0)
+            {
+                fprintf(stderr, "Error: unknown fec '%s' (xor, rs, none)\n", argv[i]);
+                exit(1);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--streams") == 0 && i + 1 < argc)
+        {
+            stream_count = atoi(argv[++i]);
+            if (stream_count < 1 || stream_count > MAX_STREAMS)
+            {
+                fprintf(stderr, "Error: --streams must be between 1 and %d\n", MAX_STREAMS);
+                exit(1);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--fec-k") == 0 && i + 1 < argc)
+        {
+            fec_k = atoi(argv[++i]);
+            if (fec_k < 1 || fec_k > FEC_MAX_K)
+            {
+                fprintf(stderr, "Error: --fec-k must be between 1 and %d\n", FEC_MAX_K);
+                exit(1);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--fec-max") == 0 && i + 1 < argc)
+        {
+            fec_parity_max = atoi(argv[++i]);
+            if (fec_parity_max < 1 || fec_parity_max > FEC_MAX_PARITY)
+            {
+                fprintf(stderr, "Error: --fec-max must be between 1 and %d\n", FEC_MAX_PARITY);
+                exit(1);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--ack-freq") == 0 && i + 1 < argc)
+        {
+            ack_freq_wanted = atoi(argv[++i]);
+            if (ack_freq_wanted < 1 || ack_freq_wanted > 65535)
+            {
+                fprintf(stderr, "Error: --ack-freq must be between 1 and 65535\n");
+                exit(1);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--no-gso") == 0)
+        {
+            use_gso = 0;
+            continue;
+        }
+        if (strcmp(argv[i], "--uring") == 0)
+        {
+            use_uring = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--no-pmtud") == 0)
+        {
+            use_pmtud = 0;
+            continue;
+        }
+        if (strcmp(argv[i], "--mss") == 0 && i + 1 < argc)
+        {
+            mss_wanted = atoi(argv[++i]);
+            if (mss_wanted < 64 || mss_wanted > MAX_DATA_SIZE)
+            {
+                fprintf(stderr, "Error: --mss must be between 64 and %d\n", MAX_DATA_SIZE);
+                exit(1);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--zerocopy") == 0)
+        {
+            use_zerocopy = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--zerocopy-min") == 0 && i + 1 < argc)
+        {
+            use_zerocopy = 1;
+            zerocopy_min = atoi(argv[++i]);
+            if (zerocopy_min < 1)
+            {
+                fprintf(stderr, "Error: --zerocopy-min must be at least 1\n");
+                exit(1);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            batch_size = atoi(argv[++i]);
+            if (batch_size < 1 || batch_size > MAX_WINDOW)
+            {
+                fprintf(stderr, "Error: --batch must be between 1 and %d\n", MAX_WINDOW);
+                exit(1);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--digest") == 0 && i + 1 < argc)
+        {
+            if (digest_from_name(argv[++i], &digest_algo) < 0)
+            {
+                fprintf(stderr, "Error: unknown digest '%s' (md5, sha256, blake2s256, blake2b512)\n", argv[i]);
+                exit(1);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--cc") == 0 && i + 1 < argc)
+        {
+            if (cc_from_name(argv[++i], &cc_algo) < 0)
+            {
+                fprintf(stderr, "Error: unknown congestion control '%s' (reno, newreno, cubic)\n", argv[i]);
+                exit(1);
+            }
+        }
+        else
         {
-            loss_rate = atof(argv[5]);
+            loss_rate = atof(argv[i]);
         }
     }
 
+    // the pipeline's batches own their payload copies and outlive any one
+    // flush: they cannot point into a sliding mapping or wait on zerocopy
+    if (use_pipeline && (use_mmap || use_zerocopy))
+    {
+        fprintf(stderr, "--pipeline copies segments out of its read-ahead ring: ignoring --mmap and --zerocopy\n");
+        use_mmap = 0;
+        use_zerocopy = 0;
+    }
+
+    // the read-ahead ring follows one stream through the file in order, and
+    // a repair's ack_num has no room for a segment's stripe offset
+    if (stream_count > 1 && (use_pipeline || fec_mode != FEC_NONE))
+    {
+        fprintf(stderr, "--streams sends ranges of the file in parallel: ignoring --pipeline and --fec\n");
+        use_pipeline = 0;
+        fec_mode = FEC_NONE;
+    }
+    if (stream_count > 1 && use_resume)
+    {
+        fprintf(stderr, "--resume needs one connection writing the file in order: ignoring it with --streams\n");
+        use_resume = 0;
+    }
+
     // Validate input file exists (add this after argument parsing, before socket creation)
     if (!chat_mode_flag && input_file) {
         // Check if input file exists and is readable
@@ -522,8 +2374,8 @@ int main(int argc, char *argv[])
         }
         
         // Check if file is empty
-        fseek(test_file, 0, SEEK_END);
-        long file_size = ftell(test_file);
+        fseeko(test_file, 0, SEEK_END);
+        off_t file_size = ftello(test_file);
         fclose(test_file);
         
         if (file_size <= 0) {
@@ -531,7 +2383,21 @@ int main(int argc, char *argv[])
             exit(1);
         }
         
-        printf("Input file '%s' validated (%ld bytes)\n", input_file, file_size);
+        printf("Input file '%s' validated (%lld bytes)\n", input_file, (long long)file_size);
+        input_size = file_size;
+
+        // the same file, by path and size, is the same transfer
+        if (use_resume)
+        {
+            char *path = realpath(input_file, NULL);
+            const char *name = path ? path : input_file;
+            resume_id = crc32c(crc32c(0, name, strlen(name)), &input_size, sizeof(input_size));
+            if (resume_id == 0)
+                resume_id = 1;
+            resume_limit = (uint64_t)input_size;
+            resume_input = input_file;
+            free(path);
+        }
     }
 
     // initialize logging
@@ -540,17 +2406,6 @@ int main(int argc, char *argv[])
     // create socket
     sockfd = create_socket(0);
 
-    // Set connection timeout
-    struct timeval timeout;
-    timeout.tv_sec = 10;  // 10 second timeout
-    timeout.tv_usec = 0;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-        perror("failed to set socket timeout");
-        cleanup_logging();
-        close(sockfd);
-        exit(1);
-    }
-
     // setup server address
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
@@ -565,6 +2420,18 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    // striped: every stream has a socket and a handshake of its own
+    if (!chat_mode_flag && stream_count > 1)
+    {
+        close(sockfd);
+        if (send_file_striped(&server_addr, input_file, stream_count) < 0)
+            fprintf(stderr, "file transfer failed\n");
+        else
+            printf("file sent successfully\n");
+        cleanup_logging();
+        return 0;
+    }
+
     // perform handshake
     uint32_t initial_seq;
     if (three_way_handshake_client(sockfd, &server_addr, &initial_seq) < 0)
@@ -0,0 +1,92 @@
+#include "sham.h"
+
+// logdump: decode a binary packet log (client_log.bin / server_log.bin) into
+// the same text lines log_event writes. records from different threads are
+// drained in batches, so they are sorted by timestamp before printing;
+// ties keep file order, which is the order each thread logged them in.
+
+static const struct log_record *sort_base;
+
+static int compare_records(const void *a, const void *b)
+{
+    size_t ia = *(const size_t *)a;
+    size_t ib = *(const size_t *)b;
+    if (sort_base[ia].ts_us != sort_base[ib].ts_us)
+        return sort_base[ia].ts_us < sort_base[ib].ts_us ? -1 : 1;
+    return ia < ib ? -1 : ia > ib;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <log.bin>\n", argv[0]);
+        fprintf(stderr, "merge with the text log: %s client_log.bin | sort -m - client_log.txt\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file)
+    {
+        perror("failed to open binary log");
+        return 1;
+    }
+
+    struct log_file_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, LOG_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "%s is not a binary log\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    size_t count = 0, cap = 0;
+    struct log_record *records = NULL;
+    while (1)
+    {
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 4096;
+            struct log_record *grown = realloc(records, cap * sizeof(*records));
+            if (!grown)
+            {
+                perror("failed to allocate records");
+                free(records);
+                fclose(file);
+                return 1;
+            }
+            records = grown;
+        }
+        size_t n = fread(&records[count], sizeof(*records), cap - count, file);
+        count += n;
+        if (n == 0)
+            break;
+    }
+    fclose(file);
+
+    size_t *order = malloc((count ? count : 1) * sizeof(*order));
+    if (!order)
+    {
+        perror("failed to allocate records");
+        free(records);
+        return 1;
+    }
+    for (size_t i = 0; i < count; i++)
+        order[i] = i;
+    sort_base = records;
+    qsort(order, count, sizeof(*order), compare_records);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct log_record *r = &records[order[i]];
+        char prefix[64], msg[128];
+        log_format_time(header.wall_us + (r->ts_us - header.mono_us), prefix, sizeof(prefix));
+        log_record_format(r, msg, sizeof(msg));
+        printf("%s%s\n", prefix, msg);
+    }
+
+    free(order);
+    free(records);
+    return 0;
+}
@@ -1,4 +1,7 @@
 #include "sham.h"
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 
 // server state
 static connection_state_t state = CLOSED;
@@ -6,377 +9,2183 @@ static uint32_t server_seq = 0;
 static uint32_t client_seq = 0;
 static int sockfd = -1;
 // static struct sockaddr_in client_addr;  // not used
-static char received_filename[256] = {0};
+static int sack_ok = 0; // client offered sack in its SYN
+static int recv_batch_size = RECV_BATCH; // datagrams per recvmmsg
+static int use_gro = 0;  // let the kernel coalesce datagrams (UDP_GRO)
+static int use_uring = 0; // receive through io_uring when the kernel allows
+static struct sham_syn_options syn_opts; // negotiated handshake options
+static int ack_freq_max = ACK_FREQ;      // most segments we will cover with one ack
+static uint8_t rcv_wscale = 0;           // shift applied to the windows we advertise
+static int mss_max = MAX_DATA_SIZE;      // largest payload we accept from a client
+static off_t writeback_bytes = 0;        // sync_file_range pacing per output file, 0 = off
+static int crc_allowed = 1;              // accept a client's per-packet crc32c offer
+static int crc_reported = 0;             // the crc32c in use was logged (atomic: workers share it)
+static int fec_allowed = 1;              // accept a client's repair segments
+static int resume_allowed = 1;           // keep checkpoints for clients that ask to resume
+static volatile sig_atomic_t stop_requested = 0; // SIGINT/SIGTERM in --multi mode
+
+// out-of-order bookkeeping: segments are written at their file offset as
+// they arrive, so only the sorted, disjoint ranges received beyond
+// expected_seq are kept, for sack and for advancing expected_seq when a
+// hole fills. capacity bounds how far ahead of expected_seq data may land
+struct reasm_buffer
+{
+    uint32_t capacity;
+    struct sham_sack_block *ranges;
+    int count; // ranges held
+};
+
+static int reasm_init(struct reasm_buffer *rb, uint32_t capacity)
+{
+    rb->ranges = calloc(REASM_SLOTS, sizeof(*rb->ranges));
+    if (!rb->ranges)
+        return -1;
+    rb->capacity = capacity;
+    return 0;
+}
+
+static void reasm_free(struct reasm_buffer *rb)
+{
+    free(rb->ranges);
+    memset(rb, 0, sizeof(*rb));
+}
+
+// note a segment that arrived ahead of expected_seq; -1 if it does not fit
+static int reasm_store(struct reasm_buffer *rb, uint32_t expected_seq, uint32_t start, int data_len)
+{
+    uint32_t end = start + data_len;
+    if (start - expected_seq + data_len > rb->capacity)
+        return -1;
+
+    // ranges before the new one, ranges it overlaps or touches, the rest
+    int lo = 0;
+    while (lo < rb->count && (int32_t)(rb->ranges[lo].end - start) < 0)
+        lo++;
+    int hi = lo;
+    while (hi < rb->count && (int32_t)(rb->ranges[hi].start - end) <= 0)
+        hi++;
+    if (hi == lo && rb->count == REASM_SLOTS)
+        return -1;
+
+    struct sham_sack_block merged = {start, end};
+    for (int i = lo; i < hi; i++)
+    {
+        if ((int32_t)(rb->ranges[i].start - merged.start) < 0)
+            merged.start = rb->ranges[i].start;
+        if ((int32_t)(rb->ranges[i].end - merged.end) > 0)
+            merged.end = rb->ranges[i].end;
+    }
+    memmove(&rb->ranges[lo + 1], &rb->ranges[hi], (rb->count - hi) * sizeof(rb->ranges[0]));
+    rb->ranges[lo] = merged;
+    rb->count += 1 - (hi - lo);
+    return 0;
+}
+
+// expected_seq just advanced: move it past every range that is now in
+// order. those bytes are already on their way to the file
+static void reasm_deliver(struct reasm_buffer *rb, uint32_t *expected_seq)
+{
+    while (rb->count > 0)
+    {
+        struct sham_sack_block *r = &rb->ranges[0];
+        if ((int32_t)(r->start - *expected_seq) > 0)
+            break;
+        if ((int32_t)(r->end - *expected_seq) > 0)
+            *expected_seq = r->end;
+        memmove(&rb->ranges[0], &rb->ranges[1], (rb->count - 1) * sizeof(rb->ranges[0]));
+        rb->count--;
+    }
+}
+
+// describe buffered ranges as sack blocks, the one holding latest_seq first
+static int reasm_sack_blocks(const struct reasm_buffer *rb, uint32_t latest_seq,
+                             struct sham_sack_block *blocks)
+{
+    int count = 1; // blocks[0] is reserved for the latest arrival
+    int have_latest = 0;
+
+    for (int i = 0; i < rb->count; i++)
+    {
+        struct sham_sack_block run = rb->ranges[i];
+        if (!have_latest && (int32_t)(latest_seq - run.start) >= 0 &&
+            (int32_t)(latest_seq - run.end) < 0)
+        {
+            blocks[0] = run;
+            have_latest = 1;
+        }
+        else if (count < MAX_SACK_BLOCKS)
+        {
+            blocks[count++] = run;
+        }
+    }
+
+    if (!have_latest)
+    {
+        // latest arrival was in order or a duplicate: shift the rest down
+        memmove(&blocks[0], &blocks[1], (count - 1) * sizeof(blocks[0]));
+        return count - 1;
+    }
+    return count;
+}
+
+// forward error correction: every segment that arrives is also copied to
+// a ring indexed by file offset, which reaches a full block behind the
+// receive window. repair segments are held per block until enough are in
+// to rebuild what is missing from the block
+struct fec_block
+{
+    uint32_t start; // first byte
+    int len;        // bytes per segment, 0 when the slot is free
+    int k;
+    uint8_t have;   // bit per repair row held
+};
+
+struct fec_decoder
+{
+    char *ring; // NULL when fec is off
+    size_t ring_size;
+    int parity_max;
+    int mss;
+    struct fec_block blocks[FEC_BLOCKS];
+    uint8_t *repairs; // parity_max rows of mss per block
+    struct sham_fec_report report;
+};
+
+static int fec_decoder_init(struct fec_decoder *fd, uint32_t capacity, int mss, int parity_max)
+{
+    memset(fd, 0, sizeof(*fd));
+    fd->ring_size = capacity + (size_t)FEC_MAX_K * mss;
+    fd->ring = malloc(fd->ring_size);
+    fd->repairs = malloc((size_t)FEC_BLOCKS * parity_max * mss);
+    if (!fd->ring || !fd->repairs)
+    {
+        free(fd->ring);
+        free(fd->repairs);
+        fd->ring = NULL;
+        return -1;
+    }
+    fd->parity_max = parity_max;
+    fd->mss = mss;
+    return 0;
+}
+
+static void fec_decoder_free(struct fec_decoder *fd)
+{
+    free(fd->ring);
+    free(fd->repairs);
+    memset(fd, 0, sizeof(*fd));
+}
+
+static void fec_ring_store(struct fec_decoder *fd, uint64_t offset, const char *data, int len)
+{
+    size_t pos = offset % fd->ring_size;
+    size_t first = fd->ring_size - pos < (size_t)len ? fd->ring_size - pos : (size_t)len;
+    memcpy(fd->ring + pos, data, first);
+    memcpy(fd->ring, data + first, len - first);
+}
+
+// dst ^= c * the len bytes kept for offset
+static void fec_ring_mul_add(const struct fec_decoder *fd, uint8_t *dst, uint64_t offset, int len, uint8_t c)
+{
+    size_t pos = offset % fd->ring_size;
+    size_t first = fd->ring_size - pos < (size_t)len ? fd->ring_size - pos : (size_t)len;
+    fec_mul_add(dst, fd->ring + pos, c, first);
+    fec_mul_add(dst + first, fd->ring, c, len - first);
+}
+
+static uint8_t *fec_repair_row(struct fec_decoder *fd, int slot, int row)
+{
+    return fd->repairs + ((size_t)slot * fd->parity_max + row) * fd->mss;
+}
+
+// settle handshake options from a client's SYN; returns whether sack is on
+static int accept_syn(const struct sham_packet *packet, int bytes_recv, struct sham_syn_options *opts)
+{
+    // accept the client's ack frequency up to our own limit
+    syn_options_parse(packet, bytes_recv, opts);
+    if (opts->ack_freq > ack_freq_max)
+        opts->ack_freq = ack_freq_max;
+    if (opts->ack_freq <= 1)
+        opts->ack_delay_ms = 0;
+
+    // the smaller of the two limits; receive buffers are sized for mss_max
+    if (opts->mss > mss_max)
+        opts->mss = mss_max;
+
+    if (!fec_allowed)
+        opts->fec = FEC_NONE;
+    if (!resume_allowed)
+    {
+        opts->resume = 0;
+        opts->resume_from = 0;
+    }
+
+    // window scale is per direction: the SYN-ACK carries our own shift
+    opts->wscale = rcv_wscale;
+    return (packet->header.flags & SACK_FLAG) != 0;
+}
+
+static int send_syn_ack(int sockfd, struct sockaddr_in *addr, uint32_t seq_num, uint32_t ack_num,
+                        int sack, uint16_t crc_flag, const struct sham_syn_options *opts)
+{
+    struct sham_packet packet;
+    packet.header.seq_num = seq_num;
+    packet.header.ack_num = ack_num;
+    packet.header.flags = SYN_FLAG | ACK_FLAG | (sack ? SACK_FLAG : 0) | crc_flag;
+    packet.header.window_size = (uint16_t)(((uint32_t)REASM_SLOTS * opts->mss) >> rcv_wscale);
+    memcpy(packet.data, opts, sizeof(*opts));
+
+    if (send_packet(sockfd, addr, &packet, sizeof(*opts)) < 0)
+        return -1;
+    log_event("SND SYN-ACK SEQ=%u ACK=%u WIN=%u WSCALE=%u MSS=%u CRC=%d", seq_num, ack_num,
+              packet.header.window_size, rcv_wscale, opts->mss, crc_flag != 0);
+    return 0;
+}
+
+// three way handshake for server (chat mode): the SYN and the ACK that
+// completes it are awaited on a reactor
+struct handshake
+{
+    struct reactor reactor;
+    struct io_watch watch;
+    struct sham_timer timeout;
+    int sockfd;
+    struct sockaddr_in *addr;
+    int result; // 1 while waiting, then 0 or -1
+};
+
+static void handshake_timeout(void *arg)
+{
+    struct handshake *hs = arg;
+    fprintf(stderr, "connection timeout: client did not complete the handshake\n");
+    hs->result = -1;
+    reactor_stop(&hs->reactor);
+}
+
+// step 1 done: record what the client offered and send the SYN-ACK
+static int handshake_syn(struct handshake *hs, struct sham_packet *packet, int bytes_recv)
+{
+    if (!(packet->header.flags & SYN_FLAG))
+    {
+        fprintf(stderr, "expected SYN packet\n");
+        return -1;
+    }
+
+    client_seq = packet->header.seq_num;
+    sack_ok = accept_syn(packet, bytes_recv, &syn_opts);
+    syn_opts.fec = FEC_NONE;
+    log_event("RCV SYN SEQ=%u SACK=%d ACKFREQ=%u", client_seq, sack_ok, syn_opts.ack_freq);
+
+    // step 2: send SYN-ACK
+    server_seq = generate_initial_seq();
+    // chat mode keeps plain headers: crc is not offered back
+    if (send_syn_ack(hs->sockfd, hs->addr, server_seq, client_seq + 1, sack_ok, 0, &syn_opts) < 0)
+    {
+        return -1;
+    }
+    state = SYN_RCVD;
+
+    // a lost final ACK must not hang the server
+    timer_arm(&hs->reactor.timers, &hs->timeout, monotonic_us() + CONNECT_TIMEOUT_MS * 1000L);
+    return 1;
+}
+
+// step 3: the ACK for our SYN
+static int handshake_ack(struct sham_packet *packet)
+{
+    if (!(packet->header.flags & ACK_FLAG) || packet->header.ack_num != server_seq + 1)
+    {
+        fprintf(stderr, "invalid ACK in handshake\n");
+        return -1;
+    }
+
+    log_event("RCV ACK FOR SYN");
+    state = ESTABLISHED;
+    return 0;
+}
+
+static void handshake_readable(void *arg, uint32_t events)
+{
+    struct handshake *hs = arg;
+    struct sham_packet packet;
+    (void)events;
+
+    while (hs->result == 1)
+    {
+        socklen_t addr_len = sizeof(*hs->addr);
+        int bytes_recv = recvfrom(hs->sockfd, &packet, sizeof(packet), MSG_DONTWAIT,
+                                  (struct sockaddr *)hs->addr, &addr_len);
+        if (bytes_recv < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            perror("recvfrom failed in handshake");
+            hs->result = -1;
+        }
+        // a SYN that offers crc carries a trailer: check it and take it off
+        else if (!packet_intact(&packet, &bytes_recv, 0))
+        {
+            log_event(state == SYN_RCVD ? "DROP CORRUPT ACK" : "DROP CORRUPT SYN");
+            continue; // as if lost: keep waiting
+        }
+        else if (state == SYN_RCVD)
+            hs->result = handshake_ack(&packet);
+        else
+            hs->result = handshake_syn(hs, &packet, bytes_recv);
+    }
+    reactor_stop(&hs->reactor);
+}
+
+int three_way_handshake_server(int sockfd, struct sockaddr_in *client_addr, uint32_t *initial_seq)
+{
+    struct handshake hs;
+    hs.sockfd = sockfd;
+    hs.addr = client_addr;
+    hs.result = 1;
+    if (reactor_init(&hs.reactor) < 0)
+        return -1;
+    if (reactor_add(&hs.reactor, &hs.watch, sockfd, EPOLLIN | EPOLLET, handshake_readable, &hs) < 0)
+    {
+        reactor_free(&hs.reactor);
+        return -1;
+    }
+    // step 1 waits for as long as it takes: the server is listening
+    timer_init(&hs.timeout, handshake_timeout, &hs);
+
+    if (reactor_run(&hs.reactor) < 0)
+        hs.result = -1;
+    reactor_free(&hs.reactor);
+    if (hs.result != 0)
+        return -1;
+
+    *initial_seq = server_seq;
+    return 0;
+}
+
+// per-connection control block: everything one file transfer needs, so a
+// single server loop can drive any number of them side by side
+struct conn_table;
+
+// --streams: the connections of one striped transfer write into one output
+// file, each at the offsets its segments carry. they may be spread over
+// several workers, so the groups are shared and kept under a lock
+struct stripe_group
+{
+    struct stripe_group *next;
+    in_addr_t peer;
+    uint32_t id;
+    int flows;    // connections the client opens
+    int refs;     // connections attached
+    int finished; // connections whose FIN has come
+    int fd;       // -1 until the first connection is established
+    uint64_t size;
+    char filename[64];
+};
+
+static struct stripe_group *stripe_groups = NULL;
+static pthread_mutex_t stripe_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// --resume: the connection that owns each resumable output. an attempt
+// whose client went away may linger on another worker until it is reaped;
+// a new attempt at the same transfer takes the output over, and from then
+// on the old one leaves the file and its checkpoint alone
+struct resume_claim
+{
+    struct resume_claim *next;
+    in_addr_t peer;
+    uint32_t id;
+    const struct connection *owner;
+    char filename[64];
+};
+
+static struct resume_claim *resume_claims = NULL;
+static pthread_mutex_t resume_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct connection
+{
+    struct sockaddr_in addr;
+    struct connection *hash_next;
+    struct connection *dirty_next; // on the table's list for the current batch
+    struct conn_table *table;
+    connection_state_t state;
+    uint32_t server_seq;
+    uint32_t client_seq;   // peer's initial sequence number
+    uint32_t expected_seq; // next in-order byte
+    uint32_t latest_seq;   // most recent arrival, reported first in sack
+    uint64_t delivered;    // bytes written so far: expected_seq without the 4 GB wrap
+    int sack_ok;
+    uint16_t crc_flag; // CRC_FLAG when negotiated: required on, and stamped on, every packet
+    struct sham_syn_options syn_opts;
+    struct stripe_group *stripe; // NULL unless the transfer is striped
+    int stripe_last; // the group's last connection: it verified the whole file
+    struct reasm_buffer reasm;
+    struct fec_decoder fec;
+    struct sham_ack ack; // every data ACK is built in place here
+    int fd;                     // output file, -1 when closed
+    struct write_stage stage;   // segments the disk writer has not written yet
+    struct connection *wait_next; // on the table's list of connections waiting on the writer
+    int waiting;
+    int window_low; // advertised a nearly closed window: update it when writes finish
+    uint32_t window_sent; // bytes the last ack advertised
+    int finishing;  // closed, output still being written
+    // digest over the bytes committed in order. bytes that became in order
+    // only when a hole filled went to the writer unhashed; they are read
+    // back from the file once the writer is past digest_mark
+    struct sham_digest digest;
+    int digest_lagging;
+    uint64_t digest_mark;     // stage bytes queued when the lag was noticed
+    uint64_t digest_mark_end; // file offset the lag reached then
+    unsigned char final_digest[DIGEST_MAX];
+    int final_len;  // -1 until the peer's FIN
+    int digesting;  // our FIN waits on the writer for final_digest
+    int stripe_done; // counted in the group's finished
+    unsigned char peer_digest[DIGEST_MAX]; // the one the peer's FIN carried
+    int peer_len;
+    int verified;   // 1 the peer's digest matched, -1 it did not, 0 not sent
+    struct sham_checkpoint ckpt; // --resume: crcs of the committed prefix (crcs NULL otherwise)
+    char filename[64];
+    int unacked; // in-order segments waiting for a delayed ack
+    int ack_now;
+    int dirty;
+    int fin_tries;
+    uint64_t last_active_us;
+    struct sham_timer delack_timer;
+    struct sham_timer fin_timer;
+    struct sham_timer idle_timer;
+};
+
+// connections keyed by peer address, plus the reactor whose timers they share
+struct conn_table
+{
+    struct connection *buckets[CONN_BUCKETS];
+    int count;
+    int sockfd;
+    float loss_rate;
+    int multi;             // keep serving; name every output after its peer
+    int max_transfers;     // stop after this many, 0 for no limit
+    struct server_stats *stats;
+    struct reactor reactor;
+    struct io_watch watch;
+    struct sham_timer tick_timer; // notices stop_requested
+    struct recv_batch batch;
+    int result;
+    struct connection *dirty; // touched by the batch being processed
+    struct disk_writer writer;
+    struct io_watch writer_watch;
+    struct connection *waiting; // need a look once the writer catches up
+    uint8_t *fec_scratch; // syndromes and rebuilt segments, allocated on first use
+};
+
+static unsigned conn_hash(const struct sockaddr_in *addr)
+{
+    uint32_t h = addr->sin_addr.s_addr ^ ((uint32_t)addr->sin_port * 0x9e3779b1u);
+    h ^= h >> 16;
+    h *= 0x45d9f3bu;
+    h ^= h >> 16;
+    return h & (CONN_BUCKETS - 1);
+}
+
+static struct connection *conn_lookup(struct conn_table *table, const struct sockaddr_in *addr)
+{
+    struct connection *conn = table->buckets[conn_hash(addr)];
+    while (conn && (conn->addr.sin_addr.s_addr != addr->sin_addr.s_addr ||
+                    conn->addr.sin_port != addr->sin_port))
+        conn = conn->hash_next;
+    return conn;
+}
+
+static void conn_delack_fire(void *arg);
+static void conn_fin_fire(void *arg);
+static void conn_idle_fire(void *arg);
+
+static struct connection *conn_create(struct conn_table *table, const struct sockaddr_in *addr)
+{
+    struct connection *conn = calloc(1, sizeof(*conn));
+    if (!conn)
+    {
+        perror("failed to allocate connection");
+        return NULL;
+    }
+    conn->addr = *addr;
+    conn->table = table;
+    conn->state = CLOSED;
+    conn->fd = -1;
+    conn->final_len = -1;
+    timer_init(&conn->delack_timer, conn_delack_fire, conn);
+    timer_init(&conn->fin_timer, conn_fin_fire, conn);
+    timer_init(&conn->idle_timer, conn_idle_fire, conn);
+
+    unsigned bucket = conn_hash(addr);
+    conn->hash_next = table->buckets[bucket];
+    table->buckets[bucket] = conn;
+    table->count++;
+    table->stats->accepted++;
+
+    if (!table->multi)
+        snprintf(conn->filename, sizeof(conn->filename), "received_file");
+    else
+        snprintf(conn->filename, sizeof(conn->filename), "received_file_%s_%u",
+                 inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+    return conn;
+}
+
+// join the group of a striped transfer, starting it if this is the first of
+// its connections; the group's output file is named after that one
+static int stripe_attach(struct connection *conn)
+{
+    pthread_mutex_lock(&stripe_lock);
+    struct stripe_group *g = stripe_groups;
+    while (g && (g->peer != conn->addr.sin_addr.s_addr || g->id != conn->syn_opts.stripe))
+        g = g->next;
+    if (!g)
+    {
+        g = calloc(1, sizeof(*g));
+        if (!g)
+        {
+            pthread_mutex_unlock(&stripe_lock);
+            perror("failed to allocate stripe group");
+            return -1;
+        }
+        g->peer = conn->addr.sin_addr.s_addr;
+        g->id = conn->syn_opts.stripe;
+        g->flows = conn->syn_opts.stripe_flows;
+        g->fd = -1;
+        g->size = conn->syn_opts.file_size;
+        snprintf(g->filename, sizeof(g->filename), "%s", conn->filename);
+        g->next = stripe_groups;
+        stripe_groups = g;
+    }
+    g->refs++;
+    conn->stripe = g;
+    snprintf(conn->filename, sizeof(conn->filename), "%s", g->filename);
+    pthread_mutex_unlock(&stripe_lock);
+    return 0;
+}
+
+// a descriptor of its own for the group's file, which the first connection
+// to get here creates and preallocates
+static int stripe_open(struct stripe_group *g)
+{
+    int fd = -1;
+    pthread_mutex_lock(&stripe_lock);
+    if (g->fd < 0)
+    {
+        g->fd = open(g->filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (g->fd >= 0 && g->size > 0 && fallocate(g->fd, 0, 0, (off_t)g->size) < 0)
+            log_event("FALLOCATE FAILED: %s", strerror(errno));
+    }
+    if (g->fd >= 0)
+        fd = fcntl(g->fd, F_DUPFD_CLOEXEC, 0);
+    pthread_mutex_unlock(&stripe_lock);
+    return fd;
+}
+
+static void stripe_detach(struct connection *conn)
+{
+    struct stripe_group *g = conn->stripe;
+    if (!g)
+        return;
+    conn->stripe = NULL;
+    pthread_mutex_lock(&stripe_lock);
+    if (--g->refs == 0)
+    {
+        struct stripe_group **link = &stripe_groups;
+        while (*link != g)
+            link = &(*link)->next;
+        *link = g->next;
+        if (g->fd >= 0)
+            close(g->fd);
+        free(g);
+    }
+    pthread_mutex_unlock(&stripe_lock);
+}
+
+// with resume_lock held
+static struct resume_claim **resume_find(const struct connection *conn)
+{
+    struct resume_claim **link = &resume_claims;
+    while (*link && ((*link)->peer != conn->addr.sin_addr.s_addr || (*link)->id != conn->syn_opts.resume))
+        link = &(*link)->next;
+    return link;
+}
+
+// own the transfer's output, under the name an earlier attempt gave it
+static int resume_claim(struct connection *conn)
+{
+    pthread_mutex_lock(&resume_lock);
+    struct resume_claim *c = *resume_find(conn);
+    if (!c)
+    {
+        c = calloc(1, sizeof(*c));
+        if (!c)
+        {
+            pthread_mutex_unlock(&resume_lock);
+            perror("failed to allocate resume claim");
+            return -1;
+        }
+        c->peer = conn->addr.sin_addr.s_addr;
+        c->id = conn->syn_opts.resume;
+        snprintf(c->filename, sizeof(c->filename), "%s", conn->filename);
+        c->next = resume_claims;
+        resume_claims = c;
+    }
+    c->owner = conn;
+    snprintf(conn->filename, sizeof(conn->filename), "%s", c->filename);
+    pthread_mutex_unlock(&resume_lock);
+    return 0;
+}
+
+static int resume_owned(const struct connection *conn)
+{
+    pthread_mutex_lock(&resume_lock);
+    struct resume_claim *c = *resume_find(conn);
+    int owned = c && c->owner == conn;
+    pthread_mutex_unlock(&resume_lock);
+    return owned;
+}
+
+static void resume_release(const struct connection *conn)
+{
+    pthread_mutex_lock(&resume_lock);
+    struct resume_claim **link = resume_find(conn);
+    struct resume_claim *c = *link;
+    if (c && c->owner == conn)
+    {
+        *link = c->next;
+        free(c);
+    }
+    pthread_mutex_unlock(&resume_lock);
+}
+
+// look at the connection again the next time the disk writer finishes jobs
+static void conn_wait_writer(struct connection *conn)
+{
+    if (conn->waiting)
+        return;
+    conn->waiting = 1;
+    conn->wait_next = conn->table->waiting;
+    conn->table->waiting = conn;
+    disk_writer_want(&conn->table->writer);
+}
+
+// wait for the writer to drain this file, trim a preallocated file to what
+// actually arrived, and close it. a resumable transfer that did not finish
+// is left as it is, with a checkpoint of its committed prefix beside it
+static void conn_close_file(struct connection *conn)
+{
+    if (conn->fd < 0)
+        return;
+    int failed = write_stage_wait(&conn->stage) < 0;
+    if (failed)
+        fprintf(stderr, "%s: write errors, output is incomplete\n", conn->filename);
+    // a striped connection's bytes are only part of the file, and a
+    // resumable one may have been taken over by a later attempt
+    if (!conn->stripe && !conn->ckpt.crcs && conn->syn_opts.file_size > 0 &&
+        conn->delivered != conn->syn_opts.file_size && ftruncate(conn->fd, (off_t)conn->delivered) < 0)
+        perror("failed to trim output file");
+    if (conn->ckpt.crcs && resume_owned(conn))
+    {
+        if (conn->delivered == conn->syn_opts.file_size)
+            ckpt_remove(&conn->ckpt);
+        else if (!failed && fdatasync(conn->fd) == 0)
+            ckpt_save(&conn->ckpt, (uint64_t)conn->ckpt.count * CKPT_CHUNK);
+    }
+    close(conn->fd);
+    conn->fd = -1;
+    write_stage_free(&conn->stage);
+}
+
+static void conn_destroy(struct connection *conn)
+{
+    struct conn_table *table = conn->table;
+    struct connection **link = &table->buckets[conn_hash(&conn->addr)];
+    while (*link != conn)
+        link = &(*link)->hash_next;
+    *link = conn->hash_next;
+    table->count--;
+
+    if (conn->waiting)
+    {
+        link = &table->waiting;
+        while (*link != conn)
+            link = &(*link)->wait_next;
+        *link = conn->wait_next;
+    }
+
+    timer_cancel(&table->reactor.timers, &conn->delack_timer);
+    timer_cancel(&table->reactor.timers, &conn->fin_timer);
+    timer_cancel(&table->reactor.timers, &conn->idle_timer);
+    conn_close_file(conn);
+    stripe_detach(conn);
+    if (conn->ckpt.crcs)
+        resume_release(conn);
+    reasm_free(&conn->reasm);
+    fec_decoder_free(&conn->fec);
+    digest_free(&conn->digest);
+    ckpt_free(&conn->ckpt);
+    free(conn);
+}
+
+// the transfer is over: once the writer has caught up, report the digest
+// of a complete file and drop the block
+static void conn_finish(struct connection *conn)
+{
+    struct conn_table *table = conn->table;
+    if (conn->fd >= 0 && write_stage_pending(&conn->stage) > 0)
+    {
+        conn->finishing = 1;
+        timer_cancel(&table->reactor.timers, &conn->fin_timer);
+        conn_wait_writer(conn);
+        return;
+    }
+    conn_close_file(conn);
+    log_event("CLOSED %s:%u FILE=%s BYTES=%llu", inet_ntoa(conn->addr.sin_addr),
+              ntohs(conn->addr.sin_port), conn->filename, (unsigned long long)conn->delivered);
+    if (conn->fec.ring)
+        log_event("FEC REBUILT=%u FAILED=%u", conn->fec.report.repaired, conn->fec.report.failed);
+    // a striped transfer counts once, when its last connection is done
+    if (!conn->stripe || conn->stripe_last)
+        table->stats->completed++;
+    if (table->max_transfers > 0 && table->stats->completed >= (unsigned long)table->max_transfers)
+        reactor_stop(&table->reactor);
+    if (conn->verified < 0)
+    {
+        fprintf(stderr, "%s: digest does not match the sender's, transfer failed\n", conn->filename);
+        if (!table->multi)
+            table->result = -1;
+    }
+    if (conn->final_len > 0)
+    {
+        flockfile(stdout);
+        if (table->multi)
+            printf("%s ", conn->filename);
+        digest_print(conn->digest.algo, conn->final_digest, conn->final_len);
+        fflush(stdout);
+        funlockfile(stdout);
+    }
+    conn_destroy(conn);
+}
+
+// free receive buffer, scaled for the window_size field. segments the
+// disk writer has not written yet use up buffer space
+static uint32_t free_window(const struct connection *conn)
+{
+    uint32_t pending = conn->fd >= 0 ? write_stage_pending(&conn->stage) : 0;
+    return conn->reasm.capacity - pending;
+}
+
+// cumulative ACK for everything in order, plus sack blocks for what we hold
+static void send_data_ack(struct connection *conn)
+{
+    struct sham_ack *ack = &conn->ack;
+    uint32_t *payload = ack->payload;
+    int nblocks = 0;
+    if (conn->fec.ring)
+    {
+        *payload++ = conn->fec.report.repaired;
+        *payload++ = conn->fec.report.failed;
+    }
+    if (conn->sack_ok)
+    {
+        nblocks = reasm_sack_blocks(&conn->reasm, conn->latest_seq, (struct sham_sack_block *)payload);
+        payload += nblocks * sizeof(struct sham_sack_block) / sizeof(*payload);
+    }
+    ack->header.seq_num = conn->server_seq;
+    ack->header.ack_num = conn->expected_seq;
+    ack->header.flags = ACK_FLAG | (nblocks > 0 ? SACK_FLAG : 0) | conn->crc_flag |
+                        (conn->fec.ring ? FEC_FLAG : 0);
+    uint32_t window = free_window(conn);
+    ack->header.window_size = (uint16_t)(window >> rcv_wscale);
+    send_datagram(conn->table->sockfd, &conn->addr, &ack->header, (char *)payload - (char *)ack->payload);
+    log_packet(LOG_SND_ACK, 0, ack->header.ack_num, nblocks, ack->header.window_size);
+
+    conn->unacked = 0;
+    conn->ack_now = 0;
+    timer_cancel(&conn->table->reactor.timers, &conn->delack_timer);
+
+    // the sender may stall on this: reopen the window once the disk catches up
+    conn->window_sent = window;
+    conn->window_low = window < conn->reasm.capacity / 4;
+    if (conn->window_low)
+        conn_wait_writer(conn);
+}
+
+static void send_control(struct connection *conn, uint16_t flags, uint32_t ack_num)
+{
+    struct sham_packet packet;
+    packet.header.seq_num = conn->server_seq;
+    packet.header.ack_num = ack_num;
+    packet.header.flags = flags | conn->crc_flag;
+    packet.header.window_size = BUFFER_SIZE;
+    send_packet(conn->table->sockfd, &conn->addr, &packet, 0);
+}
+
+// our FIN carries the digest of what we received, so the sender can check it too
+static void send_fin(struct connection *conn)
+{
+    struct sham_packet packet;
+    int len = conn->final_len > 0 ? conn->final_len : 0;
+    packet.header.seq_num = conn->server_seq;
+    packet.header.ack_num = 0;
+    packet.header.flags = FIN_FLAG | conn->crc_flag;
+    packet.header.window_size = BUFFER_SIZE;
+    memcpy(packet.data, conn->final_digest, len);
+    send_packet(conn->table->sockfd, &conn->addr, &packet, len);
+}
+
+// fold the lagging bytes into the digest once the writer has them on disk,
+// or come back when it has
+static void conn_digest_catch_up(struct connection *conn)
+{
+    char buf[65536];
+    while (conn->digest.ctx && conn->digest.bytes < conn->delivered)
+    {
+        if (!conn->digest_lagging)
+        {
+            conn->digest_lagging = 1;
+            conn->digest_mark = conn->stage.queued;
+            conn->digest_mark_end = conn->delivered;
+        }
+        if (conn->stage.queued - write_stage_pending(&conn->stage) < conn->digest_mark)
+        {
+            conn_wait_writer(conn);
+            return;
+        }
+
+        // written moments ago, so this comes from the page cache
+        while (conn->digest.bytes < conn->digest_mark_end)
+        {
+            uint64_t want = conn->digest_mark_end - conn->digest.bytes;
+            ssize_t n = pread(conn->fd, buf, want < sizeof(buf) ? want : sizeof(buf),
+                              (off_t)conn->digest.bytes);
+            if (n <= 0)
+            {
+                // without these bytes the transfer cannot be verified
+                perror("failed to read back output for digest");
+                digest_free(&conn->digest);
+                return;
+            }
+            ckpt_extend(&conn->ckpt, conn->digest.bytes, buf, n);
+            digest_extend(&conn->digest, conn->digest.bytes, buf, n);
+        }
+        conn->digest_lagging = 0;
+    }
+}
+
+// --resume: once CKPT_INTERVAL more of the prefix is hashed, have the
+// writer sync it behind what is queued and save the checkpoint
+static void conn_checkpoint(struct connection *conn)
+{
+    uint64_t committed = (uint64_t)conn->ckpt.count * CKPT_CHUNK;
+    if (!conn->ckpt.crcs || committed < conn->ckpt.saved + CKPT_INTERVAL)
+        return;
+    if (disk_writer_checkpoint(&conn->table->writer, &conn->stage, &conn->ckpt, committed) == 0)
+        conn->ckpt.saved = committed;
+}
+
+static void conn_delack_fire(void *arg)
+{
+    struct connection *conn = arg;
+    if (conn->unacked > 0)
+        send_data_ack(conn);
+}
+
+// our FIN went unanswered: resend it, then give up after FIN_RETRIES
+static void conn_fin_fire(void *arg)
+{
+    struct connection *conn = arg;
+    if (++conn->fin_tries > FIN_RETRIES)
+    {
+        log_event("FIN GIVE UP");
+        conn_finish(conn);
+        return;
+    }
+    send_fin(conn);
+    log_event("RETX FIN SEQ=%u", conn->server_seq);
+    timer_arm(&conn->table->reactor.timers, &conn->fin_timer, monotonic_us() + RTO_MS * 1000L);
+}
+
+// reap connections whose peer went silent; partial output is left on disk
+static void conn_idle_fire(void *arg)
+{
+    struct connection *conn = arg;
+    uint64_t idle_until = conn->last_active_us + IDLE_TIMEOUT_MS * 1000L;
+    if (monotonic_us() < idle_until)
+    {
+        timer_arm(&conn->table->reactor.timers, &conn->idle_timer, idle_until);
+        return;
+    }
+    log_event("REAP %s:%u STATE=%d", inet_ntoa(conn->addr.sin_addr),
+              ntohs(conn->addr.sin_port), conn->state);
+    conn->table->stats->reaped++;
+    conn_destroy(conn);
+}
+
+// queue the connection for the ack decision made after the batch
+static void conn_touch(struct connection *conn)
+{
+    if (conn->dirty)
+        return;
+    conn->dirty = 1;
+    conn->dirty_next = conn->table->dirty;
+    conn->table->dirty = conn;
+}
+
+// a resumed transfer keeps the prefix it already has
+static int conn_open_file(struct connection *conn)
+{
+    conn->fd = conn->stripe ? stripe_open(conn->stripe) :
+               open(conn->filename, O_RDWR | O_CREAT | O_CLOEXEC | (conn->delivered > 0 ? 0 : O_TRUNC), 0644);
+    if (conn->fd < 0)
+    {
+        perror("failed to create output file");
+        return -1;
+    }
+    if (write_stage_init(&conn->stage, conn->fd, conn->reasm.capacity) < 0)
+    {
+        perror("failed to allocate write buffer");
+        close(conn->fd);
+        conn->fd = -1;
+        return -1;
+    }
+
+    // reserve the whole file up front: no block allocation on the write path,
+    // and out-of-order segments land inside the file rather than past its end
+    if (!conn->stripe && conn->syn_opts.file_size > 0 &&
+        fallocate(conn->fd, 0, 0, (off_t)conn->syn_opts.file_size) < 0)
+        log_event("FALLOCATE FAILED: %s", strerror(errno));
+    conn->state = ESTABLISHED;
+    log_event("RCV ACK FOR SYN");
+    return 0;
+}
+
+// without --multi every transfer goes to received_file: a new one closes
+// whatever earlier attempt is still open (its client went away), sparing
+// only the other connections of its own striped transfer
+static void conn_supersede(struct connection *conn)
+{
+    for (int b = 0; b < CONN_BUCKETS; b++)
+    {
+        struct connection *c = conn->table->buckets[b];
+        while (c)
+        {
+            struct connection *next = c->hash_next;
+            if (c != conn && !(conn->syn_opts.stripe && c->syn_opts.stripe == conn->syn_opts.stripe &&
+                               c->addr.sin_addr.s_addr == conn->addr.sin_addr.s_addr))
+            {
+                log_event("SUPERSEDE %s:%u FILE=%s", inet_ntoa(c->addr.sin_addr), ntohs(c->addr.sin_port),
+                          c->filename);
+                conn_destroy(c);
+            }
+            c = next;
+        }
+    }
+}
+
+// another connection from the same peer with the same resumable transfer
+static struct connection *conn_find_resume(const struct connection *conn)
+{
+    for (int b = 0; b < CONN_BUCKETS; b++)
+    {
+        for (struct connection *c = conn->table->buckets[b]; c; c = c->hash_next)
+        {
+            if (c != conn && c->addr.sin_addr.s_addr == conn->addr.sin_addr.s_addr &&
+                c->syn_opts.resume == conn->syn_opts.resume)
+                return c;
+        }
+    }
+    return NULL;
+}
+
+// --resume: pick up the checkpoint an earlier attempt at this transfer
+// left. the prefix it vouches for is read back against its crcs and into
+// the digest, and the SYN-ACK offers as much of it as is intact and the
+// client will take; the output is then written from there on
+static int conn_resume(struct connection *conn)
+{
+    struct sham_syn_options *opts = &conn->syn_opts;
+    if (resume_claim(conn) < 0)
+        return -1;
+    if (ckpt_init(&conn->ckpt, conn->filename, opts->resume, opts->file_size) < 0)
+    {
+        resume_release(conn);
+        return -1;
+    }
+    uint64_t held = ckpt_load(&conn->ckpt);
+    if (held > opts->resume_from)
+        held = opts->resume_from / CKPT_CHUNK * CKPT_CHUNK;
+
+    uint64_t intact = 0;
+    uint32_t chain = 0;
+    int fd = held > 0 ? open(conn->filename, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd >= 0)
+    {
+        intact = ckpt_scan(fd, held, conn->ckpt.crcs, &chain, &conn->digest);
+        close(fd);
+    }
+    ckpt_rewind(&conn->ckpt, intact);
+    conn->delivered = intact;
+    opts->resume_from = intact;
+    opts->resume_crc = intact > 0 ? chain : 0;
+    log_event("RESUME %s ID=%08x HELD=%llu INTACT=%llu", conn->ckpt.path, opts->resume,
+              (unsigned long long)held, (unsigned long long)intact);
+    return 0;
+}
+
+// a SYN from a new peer (or one restarting with a fresh sequence number)
+static void conn_on_syn(struct conn_table *table, struct connection *conn,
+                        const struct sham_packet *packet, int bytes_recv,
+                        const struct sockaddr_in *addr)
+{
+    if (conn && packet->header.seq_num == conn->client_seq)
+    {
+        // our SYN-ACK was lost
+        send_syn_ack(table->sockfd, &conn->addr, conn->server_seq, conn->client_seq + 1,
+                     conn->sack_ok, conn->crc_flag, &conn->syn_opts);
+        return;
+    }
+    // a restarted peer goes on writing the same output
+    char filename[sizeof(conn->filename)] = "";
+    if (conn)
+    {
+        log_event("RESET %s:%u", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+        snprintf(filename, sizeof(filename), "%s", conn->filename);
+        conn_destroy(conn);
+    }
+
+    conn = conn_create(table, addr);
+    if (!conn)
+        return;
+    if (filename[0])
+        snprintf(conn->filename, sizeof(conn->filename), "%s", filename);
+
+    conn->client_seq = packet->header.seq_num;
+    conn->sack_ok = accept_syn(packet, bytes_recv, &conn->syn_opts);
+    conn->crc_flag = crc_allowed ? packet->header.flags & CRC_FLAG : 0;
+    log_event("RCV SYN SEQ=%u SACK=%d ACKFREQ=%u MSS=%u SIZE=%llu CRC=%d STRIPE=%u/%u RESUME=%08x",
+              conn->client_seq, conn->sack_ok, conn->syn_opts.ack_freq, conn->syn_opts.mss,
+              (unsigned long long)conn->syn_opts.file_size, conn->crc_flag != 0, conn->syn_opts.stripe,
+              conn->syn_opts.stripe_flows, conn->syn_opts.resume);
+    if (conn->crc_flag && !__atomic_exchange_n(&crc_reported, 1, __ATOMIC_RELAXED))
+        log_event("CRC32C %s", crc32c_impl());
+    // a resumable transfer has to find its checkpoint again, whether or not
+    // the earlier attempt is still open. without --multi that is
+    // received_file; with it the output is named after the peer's port,
+    // which a later attempt will not share, so it goes by the transfer id.
+    // an earlier attempt still open on this worker (its client went away)
+    // is closed first, so its last checkpoint is as late as it can be
+    struct connection *stale = NULL;
+    if (!table->multi)
+        conn_supersede(conn);
+    else if (conn->syn_opts.resume)
+    {
+        snprintf(conn->filename, sizeof(conn->filename), "received_file_%s_%08x",
+                 inet_ntoa(addr->sin_addr), conn->syn_opts.resume);
+        stale = conn_find_resume(conn);
+    }
+    if (stale)
+    {
+        log_event("SUPERSEDE %s:%u FILE=%s", inet_ntoa(stale->addr.sin_addr), ntohs(stale->addr.sin_port),
+                  stale->filename);
+        snprintf(conn->filename, sizeof(conn->filename), "%s", stale->filename);
+        conn_destroy(stale);
+    }
+    if (conn->syn_opts.stripe && stripe_attach(conn) < 0)
+    {
+        conn_destroy(conn);
+        return;
+    }
+
+    // the receive window is REASM_SLOTS segments of the agreed size, and
+    // the writer's staging ring for the connection holds as much
+    if (reasm_init(&conn->reasm, (uint32_t)REASM_SLOTS * conn->syn_opts.mss) < 0)
+    {
+        perror("failed to allocate reassembly buffer");
+        conn_destroy(conn);
+        return;
+    }
+    // a striped connection's bytes are not the file in order: the whole
+    // file is hashed once all of them are in
+    conn->digest.algo = (digest_algo_t)conn->syn_opts.digest;
+    if (!conn->stripe && digest_init(&conn->digest, (digest_algo_t)conn->syn_opts.digest) < 0)
+    {
+        conn_destroy(conn);
+        return;
+    }
+    if (conn->syn_opts.resume && conn_resume(conn) < 0)
+    {
+        conn_destroy(conn);
+        return;
+    }
+    if (conn->syn_opts.fec != FEC_NONE &&
+        fec_decoder_init(&conn->fec, conn->reasm.capacity, conn->syn_opts.mss, conn->syn_opts.fec_parity) < 0)
+    {
+        log_event("FEC DECLINED: no memory");
+        conn->syn_opts.fec = FEC_NONE;
+    }
+
+    conn->server_seq = generate_initial_seq();
+    conn->expected_seq = conn->client_seq + 1;
+    conn->latest_seq = conn->expected_seq;
+    conn->state = SYN_RCVD;
+    conn->last_active_us = monotonic_us();
+    timer_arm(&table->reactor.timers, &conn->idle_timer, conn->last_active_us + IDLE_TIMEOUT_MS * 1000L);
+    send_syn_ack(table->sockfd, &conn->addr, conn->server_seq, conn->client_seq + 1,
+                 conn->sack_ok, conn->crc_flag, &conn->syn_opts);
+}
+
+// a striped connection's FIN: once its stage is written its share of the
+// file is in place. the last of the group to get here has the writer read
+// the whole file back for the digest; the others answer without one.
+// -1 while it waits on the writer
+static int stripe_on_fin(struct connection *conn)
+{
+    struct stripe_group *g = conn->stripe;
+    if (!conn->stripe_done)
+    {
+        if (conn->fd >= 0 && write_stage_pending(&conn->stage) > 0)
+            return -1;
+        conn->stripe_done = 1;
+        pthread_mutex_lock(&stripe_lock);
+        int finished = ++g->finished;
+        pthread_mutex_unlock(&stripe_lock);
+        log_event("STRIPE %u FLOW DONE %d/%d BYTES=%llu", g->id, finished, g->flows,
+                  (unsigned long long)conn->delivered);
+        if (finished != g->flows)
+            return 0;
+        conn->stripe_last = 1;
+    }
+    if (!conn->stripe_last || conn->fd < 0)
+        return 0;
+
+    // a full queue has room again after the writer's next pass
+    if (conn->stage.digests == 0 &&
+        disk_writer_digest(&conn->table->writer, &conn->stage, g->size, conn->digest.algo,
+                           conn->final_digest, &conn->final_len) < 0)
+        return -1;
+    return write_stage_digesting(&conn->stage) ? -1 : 0;
+}
+
+// our digest: the in-order one once its lagging bytes are folded in, or a
+// striped group's from the writer. -1 while it waits on the writer
+static int conn_fin_digest(struct connection *conn)
+{
+    if (conn->stripe)
+        return stripe_on_fin(conn);
+    conn_digest_catch_up(conn);
+    if (conn->digest.ctx && conn->digest.bytes < conn->delivered)
+        return -1;
+    conn->final_len = digest_final(&conn->digest, conn->final_digest);
+    return 0;
+}
+
+// our digest is settled: check it against the peer's and send our FIN
+static void conn_fin_ready(struct connection *conn)
+{
+    if (conn->final_len < 0 && (!conn->stripe || conn->stripe_last))
+        conn->verified = -1;
+    else if (conn->peer_len > 0 && conn->final_len > 0)
+    {
+        conn->verified = conn->peer_len == conn->final_len &&
+                         memcmp(conn->peer_digest, conn->final_digest, conn->peer_len) == 0 ? 1 : -1;
+        log_event("DIGEST %s %s", digest_name(conn->digest.algo),
+                  conn->verified > 0 ? "MATCH" : "MISMATCH");
+    }
+    conn->fin_tries = 0;
+    timer_arm(&conn->table->reactor.timers, &conn->fin_timer, monotonic_us() + RTO_MS * 1000L);
+    send_fin(conn);
+    log_event("SND FIN SEQ=%u", conn->server_seq);
+}
+
+// our FIN goes out once the digest is settled; until then table_written
+// calls this again each time the writer finishes jobs
+static void conn_fin_settle(struct connection *conn)
+{
+    if (conn_fin_digest(conn) < 0)
+    {
+        conn_wait_writer(conn);
+        return;
+    }
+    conn->digesting = 0;
+    conn_fin_ready(conn);
+}
+
+// the peer's FIN: ack any data still pending and the FIN itself, then
+// settle the digest against the one the FIN carries and send ours
+static void conn_on_fin(struct connection *conn, const struct sham_packet *packet, int data_len)
+{
+    uint32_t peer_fin_seq = packet->header.seq_num;
+    log_event("RCV FIN SEQ=%u", peer_fin_seq);
+
+    // also answers a retransmitted FIN whose reply was lost
+    if (conn->state != ESTABLISHED)
+    {
+        send_control(conn, ACK_FLAG, peer_fin_seq + 1);
+        log_event("SND ACK FOR FIN");
+        if (!conn->digesting)
+        {
+            send_fin(conn);
+            log_event("SND FIN SEQ=%u", conn->server_seq);
+        }
+        return;
+    }
+
+    if (conn->unacked > 0 || conn->ack_now)
+        send_data_ack(conn);
+
+    conn->peer_len = data_len > 0 ? data_len : 0;
+    memcpy(conn->peer_digest, packet->data, conn->peer_len < DIGEST_MAX ? conn->peer_len : DIGEST_MAX);
+    conn->state = LAST_ACK;
+
+    send_control(conn, ACK_FLAG, peer_fin_seq + 1);
+    log_event("SND ACK FOR FIN");
+    conn->digesting = 1;
+    conn_fin_settle(conn);
+}
+
+// a path mtu probe got through: echo its id so the sender can use its size.
+// the padding is not data and the ack is not delayed
+static void conn_on_mtu_probe(struct connection *conn, const struct sham_packet *pkt, int data_len)
+{
+    log_event("RCV MTU PROBE ID=%u LEN=%d", pkt->header.seq_num, data_len);
+    send_control(conn, MTU_PROBE_FLAG, pkt->header.seq_num);
+}
+
+// shift moves a striped connection's stream offsets to file offsets (0 otherwise)
+static void conn_on_data(struct connection *conn, uint32_t seq, int64_t shift, const char *data, int data_len)
+{
+    if (data_len == 0)
+    {
+        // zero window probe: answer with the current window
+        log_event("RCV PROBE SEQ=%u", seq);
+        conn->ack_now = 1;
+        return;
+    }
+    log_packet(LOG_RCV_DATA, seq, 0, data_len, 0);
+    if (conn->stripe)
+    {
+        int64_t offset = (int64_t)conn->delivered + (int32_t)(seq - conn->expected_seq) + shift;
+        if (offset < 0 || offset + data_len > (int64_t)conn->stripe->size)
+        {
+            log_event("DROP STRIPE SEQ=%u OFFSET=%lld: outside the file", seq, (long long)offset);
+            return;
+        }
+    }
+    conn->latest_seq = seq;
+
+    // after an mss change a resent segment may start below expected_seq
+    // and end above it: only its new tail counts
+    int32_t behind = (int32_t)(conn->expected_seq - seq);
+    if (behind > 0 && behind < data_len)
+    {
+        data += behind;
+        data_len -= behind;
+        behind = 0;
+    }
+
+    if (behind == 0)
+    {
+        // a segment that fills a hole is acked at once (RFC 5681)
+        if (conn->reasm.count > 0)
+            conn->ack_now = 1;
+        uint32_t before = conn->expected_seq;
+        disk_writer_submit(&conn->table->writer, &conn->stage, (off_t)(conn->delivered + shift), data, data_len);
+        if (conn->fec.ring)
+            fec_ring_store(&conn->fec, conn->delivered, data, data_len);
+        ckpt_extend(&conn->ckpt, conn->delivered, data, data_len);
+        digest_extend(&conn->digest, conn->delivered, data, data_len);
+        conn->expected_seq += data_len;
+        reasm_deliver(&conn->reasm, &conn->expected_seq);
+        conn->delivered += conn->expected_seq - before;
+        conn->unacked++;
+        if (conn->digest.bytes < conn->delivered)
+            conn_digest_catch_up(conn);
+        conn_checkpoint(conn);
+    }
+    else
+    {
+        // out of order goes straight to its place in the file; either
+        // way, the sender needs to hear now
+        if (behind < 0 && reasm_store(&conn->reasm, conn->expected_seq, seq, data_len) == 0)
+        {
+            uint64_t offset = conn->delivered + (seq - conn->expected_seq);
+            disk_writer_submit(&conn->table->writer, &conn->stage, (off_t)(offset + shift), data, data_len);
+            if (conn->fec.ring)
+                fec_ring_store(&conn->fec, offset, data, data_len);
+        }
+        conn->ack_now = 1;
+    }
+}
+
+// whether [seq, seq + len) has arrived, in order or not
+static int conn_holds(const struct connection *conn, uint32_t seq, int len)
+{
+    if ((int32_t)(seq + len - conn->expected_seq) <= 0)
+        return 1;
+    for (int i = 0; i < conn->reasm.count; i++)
+    {
+        const struct sham_sack_block *r = &conn->reasm.ranges[i];
+        if ((int32_t)(seq - r->start) >= 0 && (int32_t)(seq + len - r->end) <= 0)
+            return 1;
+    }
+    return 0;
+}
+
+// the slot holding repairs for the block at start, or one to reuse: a
+// free slot, then one whose block is all in order, then the oldest
+static int fec_block_slot(struct connection *conn, uint32_t start, int len, int k)
+{
+    struct fec_decoder *fd = &conn->fec;
+    int victim = -1;
+    for (int b = 0; b < FEC_BLOCKS; b++)
+    {
+        struct fec_block *blk = &fd->blocks[b];
+        if (blk->len == len && blk->start == start && blk->k == k)
+            return b;
+        if (blk->len == 0 || (int32_t)(blk->start + blk->k * blk->len - conn->expected_seq) <= 0)
+            victim = b;
+        else if (victim < 0 || (blk->len > 0 && fd->blocks[victim].len > 0 &&
+                                (int32_t)(blk->start - fd->blocks[victim].start) < 0))
+            victim = b;
+    }
+
+    struct fec_block *blk = &fd->blocks[victim];
+    if (blk->len > 0 && (int32_t)(blk->start + blk->k * blk->len - conn->expected_seq) > 0)
+        fd->report.failed++; // pushed out before enough repairs came
+    blk->start = start;
+    blk->len = len;
+    blk->k = k;
+    blk->have = 0;
+    return victim;
+}
+
+// a repair segment: once a block holds as many repairs as it has missing
+// segments, rebuild them from the repairs and the segments that arrived
+// (still in the ring) and take them in as if they had been received
+static void conn_on_repair(struct connection *conn, const struct sham_packet *pkt, int data_len)
+{
+    struct fec_decoder *fd = &conn->fec;
+    uint32_t info = pkt->header.ack_num;
+    int k = FEC_INFO_K(info);
+    int row = FEC_INFO_ROW(info);
+    uint32_t start = pkt->header.seq_num;
+    if (!fd->ring || k < 1 || k > FEC_MAX_K || row >= (int)FEC_INFO_R(info) || row >= fd->parity_max ||
+        data_len <= 0 || data_len > fd->mss)
+        return;
+    if ((int32_t)(start + k * data_len - conn->expected_seq) <= 0)
+        return; // all in order already
+
+    int slot = fec_block_slot(conn, start, data_len, k);
+    struct fec_block *blk = &fd->blocks[slot];
+    if (!(blk->have & (1u << row)))
+    {
+        memcpy(fec_repair_row(fd, slot, row), pkt->data, data_len);
+        blk->have |= 1u << row;
+    }
+
+    int missing[FEC_MAX_PARITY];
+    int rows[FEC_MAX_PARITY];
+    int nmissing = 0;
+    int nrows = 0;
+    for (int i = 0; i < k; i++)
+    {
+        if (conn_holds(conn, start + i * data_len, data_len))
+            continue;
+        if (nmissing == FEC_MAX_PARITY)
+            return; // more than any block can rebuild; wait for retransmissions
+        missing[nmissing++] = i;
+    }
+    for (int j = 0; j < fd->parity_max && nrows < nmissing; j++)
+        if (blk->have & (1u << j))
+            rows[nrows++] = j;
+    if (nmissing == 0)
+    {
+        blk->len = 0;
+        return;
+    }
+    if (nrows < nmissing)
+        return;
+
+    // the segments that did arrive must still be in the ring
+    int64_t ring_low = (int64_t)conn->delivered + conn->reasm.capacity - (int64_t)fd->ring_size;
+    int64_t first = (int64_t)conn->delivered + (int32_t)(start - conn->expected_seq);
+    if (first < ring_low)
+    {
+        log_event("FEC GIVE UP SEQ=%u: segments left the ring", start);
+        fd->report.failed++;
+        blk->len = 0;
+        return;
+    }
+
+    struct conn_table *table = conn->table;
+    if (!table->fec_scratch)
+        table->fec_scratch = malloc((size_t)2 * FEC_MAX_PARITY * MAX_DATA_SIZE);
+    if (!table->fec_scratch)
+        return;
+    uint8_t *syn[FEC_MAX_PARITY];
+    uint8_t *out[FEC_MAX_PARITY];
+    for (int r = 0; r < nmissing; r++)
+    {
+        syn[r] = table->fec_scratch + (size_t)r * MAX_DATA_SIZE;
+        out[r] = table->fec_scratch + (size_t)(FEC_MAX_PARITY + r) * MAX_DATA_SIZE;
+        memcpy(syn[r], fec_repair_row(fd, slot, rows[r]), data_len);
+    }
+
+    // syndrome: each repair less what the arrived segments put into it
+    for (int i = 0, m = 0; i < k; i++)
+    {
+        if (m < nmissing && missing[m] == i)
+        {
+            m++;
+            continue;
+        }
+        for (int r = 0; r < nmissing; r++)
+            fec_ring_mul_add(fd, syn[r], (uint64_t)(first + (int64_t)i * data_len), data_len,
+                             fec_coef(rows[r], i));
+    }
+    blk->len = 0;
+    if (fec_solve(nmissing, rows, missing, syn, out, data_len) < 0)
+        return;
+
+    for (int m = 0; m < nmissing; m++)
+    {
+        uint32_t seq = start + missing[m] * data_len;
+        log_event("FEC REBUILT SEQ=%u LEN=%d", seq, data_len);
+        conn_on_data(conn, seq, 0, (const char *)out[m], data_len);
+    }
+    fd->report.repaired += nmissing;
+}
+
+// one datagram for an existing connection, dispatched on its state
+static void conn_on_packet(struct connection *conn, const struct sham_packet *pkt, int bytes_recv)
+{
+    uint16_t flags = pkt->header.flags;
+    int data_len = bytes_recv - (int)sizeof(struct sham_header);
+    conn->last_active_us = monotonic_us();
+    conn_touch(conn);
+
+    if (flags & FIN_FLAG)
+    {
+        if (conn->state == ESTABLISHED || conn->state == LAST_ACK)
+            conn_on_fin(conn, pkt, data_len);
+        return;
+    }
+
+    switch (conn->state)
+    {
+    case SYN_RCVD:
+        if ((flags & ACK_FLAG) && pkt->header.ack_num == conn->server_seq + 1)
+        {
+            conn_open_file(conn);
+            return;
+        }
+        // data before the handshake ACK means that ACK was lost
+        if ((flags & ~CRC_FLAG) != 0 || data_len <= 0 || conn_open_file(conn) < 0)
+            return;
+        break;
+    case ESTABLISHED:
+        // a duplicate handshake ACK has no payload; older clients leave
+        // ACK_FLAG set on the data segments that follow it
+        if ((flags & ACK_FLAG) && data_len <= 0)
+            return;
+        break;
+    case LAST_ACK:
+        // nothing is acked before our FIN is out
+        if ((flags & ACK_FLAG) && !conn->digesting)
+        {
+            log_event("RCV ACK=%u", pkt->header.ack_num);
+            conn->state = CLOSED;
+        }
+        return;
+    default:
+        return;
+    }
+
+    if (is_packet_lost(conn->table->loss_rate))
+    {
+        log_packet(LOG_DROP_DATA, pkt->header.seq_num, 0, 0, 0);
+        return;
+    }
+    if (flags & MTU_PROBE_FLAG)
+        conn_on_mtu_probe(conn, pkt, data_len);
+    else if (flags & FEC_FLAG)
+        conn_on_repair(conn, pkt, data_len);
+    else
+        conn_on_data(conn, pkt->header.seq_num, conn->stripe ? STRIPE_OFFSET(pkt->header.ack_num) : 0,
+                     pkt->data, data_len);
+}
+
+// after a batch: one ack decision per connection the batch touched
+static void conn_flush_dirty(struct conn_table *table)
+{
+    while (table->dirty)
+    {
+        struct connection *conn = table->dirty;
+        table->dirty = conn->dirty_next;
+        conn->dirty = 0;
+
+        if (conn->state == CLOSED)
+        {
+            conn_finish(conn);
+            continue;
+        }
+        if (conn->state != ESTABLISHED)
+            continue;
+
+        if (conn->ack_now || conn->unacked >= conn->syn_opts.ack_freq)
+            send_data_ack(conn);
+        else if (conn->unacked > 0 && !timer_armed(&conn->delack_timer))
+            timer_arm(&table->reactor.timers, &conn->delack_timer,
+                      monotonic_us() + conn->syn_opts.ack_delay_ms * 1000L);
+    }
+}
+
+// edge-triggered: drain the socket one recvmmsg batch at a time, making the
+// ack decisions after each batch
+static void table_readable(void *arg, uint32_t events)
+{
+    struct conn_table *table = arg;
+    struct recv_batch *batch = &table->batch;
+    (void)events;
+
+    while (table->reactor.running)
+    {
+        int n = recv_batch_read(batch, table->sockfd);
+        if (n < 0)
+        {
+            table->result = -1;
+            reactor_stop(&table->reactor);
+            return;
+        }
+        if (n == 0)
+            return;
+
+        struct sham_packet *pkt;
+        int bytes_recv;
+        struct sockaddr_in addr;
+        while (recv_batch_next(batch, &pkt, &bytes_recv, &addr))
+        {
+            table->stats->datagrams++;
+            table->stats->bytes += bytes_recv;
+            if (bytes_recv < (int)sizeof(struct sham_header))
+                continue;
+
+            // O(1) demultiplexing on the peer address
+            struct connection *conn = conn_lookup(table, &addr);
+
+            // a corrupted packet is dropped so the sender sees it as lost. a
+            // SYN is checked if it carries a crc, it may be a new connection
+            int required = conn && conn->crc_flag && !(pkt->header.flags & SYN_FLAG);
+            if (!packet_intact(pkt, &bytes_recv, required))
+            {
+                table->stats->corrupt++;
+                log_event("DROP CORRUPT SEQ=%u LEN=%d", pkt->header.seq_num, bytes_recv);
+                continue;
+            }
+            if (pkt->header.flags & SYN_FLAG)
+            {
+                // it may close this peer's connection, or a resumable
+                // transfer's stale one: settle the batch's acks first
+                if (table->dirty)
+                    conn_flush_dirty(table);
+                conn_on_syn(table, conn_lookup(table, &addr), pkt, bytes_recv, &addr);
+                continue;
+            }
+            if (conn)
+                conn_on_packet(conn, pkt, bytes_recv);
+        }
+        conn_flush_dirty(table);
+    }
+}
 
-// three way handshake for server
-int three_way_handshake_server(int sockfd, struct sockaddr_in *client_addr, uint32_t *initial_seq)
+// the disk writer finished some jobs: close out transfers whose output is
+// now complete, and reopen windows that were nearly shut
+static void table_written(void *arg, uint32_t events)
 {
-    struct sham_packet packet;
-    socklen_t addr_len = sizeof(*client_addr);
+    struct conn_table *table = arg;
+    (void)events;
+    disk_writer_reap(&table->writer);
 
-    // step 1: receive SYN from client
-    int bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                              (struct sockaddr *)client_addr, &addr_len);
-    if (bytes_recv < 0)
+    struct connection *list = table->waiting;
+    table->waiting = NULL;
+    while (list)
     {
-        perror("recvfrom failed in handshake");
-        return -1;
+        struct connection *conn = list;
+        list = conn->wait_next;
+        conn->waiting = 0;
+
+        if (conn->finishing)
+        {
+            conn_finish(conn);
+            continue;
+        }
+        if (conn->digesting)
+        {
+            conn_fin_settle(conn);
+            continue;
+        }
+        if (conn->state != ESTABLISHED)
+            continue;
+        if (conn->digest.bytes < conn->delivered)
+            conn_digest_catch_up(conn);
+        if (conn->window_low)
+        {
+            // receiver-side silly window avoidance (RFC 1122): only once
+            // the window can move by a full segment or half the buffer
+            uint32_t step = conn->syn_opts.mss < conn->reasm.capacity / 2 ?
+                            conn->syn_opts.mss : conn->reasm.capacity / 2;
+            if (free_window(conn) >= conn->window_sent + step)
+                send_data_ack(conn);
+            else
+                conn_wait_writer(conn);
+        }
     }
+}
 
-    if (!(packet.header.flags & SYN_FLAG))
+// wake at least once a second to notice stop_requested
+static void table_tick(void *arg)
+{
+    struct conn_table *table = arg;
+    if (stop_requested)
     {
-        fprintf(stderr, "expected SYN packet\n");
-        return -1;
+        reactor_stop(&table->reactor);
+        return;
     }
+    timer_arm(&table->reactor.timers, &table->tick_timer, monotonic_us() + 1000000);
+}
 
-    client_seq = packet.header.seq_num;
-    log_event("RCV SYN SEQ=%u", client_seq);
-
-    // step 2: send SYN-ACK
-    server_seq = generate_initial_seq();
-    packet.header.seq_num = server_seq;
-    packet.header.ack_num = client_seq + 1;
-    packet.header.flags = SYN_FLAG | ACK_FLAG;
-    packet.header.window_size = BUFFER_SIZE;
-
-    if (send_packet(sockfd, client_addr, &packet, 0) < 0)
+// receive files from any number of clients on one socket; returns after
+// max_transfers completed transfers, or on SIGINT/SIGTERM when it is 0
+int receive_files(int sockfd, float loss_rate, int max_transfers, struct server_stats *stats)
+{
+    struct conn_table *table = calloc(1, sizeof(*table));
+    if (!table)
     {
+        perror("failed to allocate connection table");
         return -1;
     }
+    table->sockfd = sockfd;
+    table->loss_rate = loss_rate;
+    table->multi = max_transfers != 1;
+    table->max_transfers = max_transfers;
+    table->stats = stats;
 
-    log_event("SND SYN-ACK SEQ=%u ACK=%u", server_seq, client_seq + 1);
-    state = SYN_RCVD;
+    if (recv_batch_init(&table->batch, sockfd, recv_batch_size, mss_max, use_gro, use_uring) < 0)
+    {
+        free(table);
+        return -1;
+    }
 
-    // step 3: receive ACK from client
-    bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                          (struct sockaddr *)client_addr, &addr_len);
-    if (bytes_recv < 0)
+    if (disk_writer_start(&table->writer, writeback_bytes) < 0)
     {
-        perror("recvfrom failed in handshake step 3");
+        recv_batch_free(&table->batch);
+        free(table);
         return -1;
     }
 
-    if (!(packet.header.flags & ACK_FLAG) || packet.header.ack_num != server_seq + 1)
+    // with io_uring the ring's completion queue, not the socket, signals data
+    if (reactor_init(&table->reactor) < 0 ||
+        reactor_add(&table->reactor, &table->watch, table->batch.wait_fd, EPOLLIN | EPOLLET,
+                    table_readable, table) < 0 ||
+        reactor_add(&table->reactor, &table->writer_watch, table->writer.event_fd, EPOLLIN | EPOLLET,
+                    table_written, table) < 0)
     {
-        fprintf(stderr, "invalid ACK in handshake\n");
+        reactor_free(&table->reactor);
+        disk_writer_stop(&table->writer);
+        recv_batch_free(&table->batch);
+        free(table);
         return -1;
     }
+    timer_init(&table->tick_timer, table_tick, table);
+    timer_arm(&table->reactor.timers, &table->tick_timer, monotonic_us() + 1000000);
+
+    if (!stop_requested && reactor_run(&table->reactor) < 0)
+        table->result = -1;
+
+    struct recv_batch *batch = &table->batch;
+    log_event("RECV BATCH DATAGRAMS=%lu SEGMENTS=%lu SYSCALLS=%lu GRO=%d WAKEUPS=%lu",
+              batch->datagrams, batch->segments, batch->syscalls, batch->gro, table->reactor.wakeups);
+    recv_batch_free(batch);
+
+    for (int i = 0; i < CONN_BUCKETS; i++)
+        while (table->buckets[i])
+            conn_destroy(table->buckets[i]);
+    disk_writer_stop(&table->writer);
+    reactor_free(&table->reactor);
+
+    int ret = table->result;
+    free(table->fec_scratch);
+    free(table);
+    return ret;
+}
 
-    log_event("RCV ACK FOR SYN");
-    state = ESTABLISHED;
-    *initial_seq = server_seq;
+// one receive loop per SO_REUSEPORT socket, each with its own table
+struct worker
+{
+    int id;
+    int sockfd;
+    int cpu; // -1 when not pinned
+    float loss_rate;
+    pthread_t thread;
+    struct server_stats stats;
+};
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    if (w->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            fprintf(stderr, "worker %d: failed to pin to cpu %d\n", w->id, w->cpu);
+    }
+    receive_files(w->sockfd, w->loss_rate, 0, &w->stats);
+    return NULL;
+}
 
-    return 0;
+static void request_stop(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
 }
 
-// receive file
-int receive_file(int sockfd, struct sockaddr_in *addr, const char *filename, float loss_rate)
+// --multi: serve until SIGINT/SIGTERM with nthreads workers, then report
+// what each one handled so an uneven spread is easy to spot
+static int serve_forever(int port, float loss_rate, int nthreads, int pin, int steer)
 {
-    FILE *file = fopen(filename, "wb");
-    if (!file)
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct worker *workers = calloc(nthreads, sizeof(*workers));
+    int *fds = calloc(nthreads, sizeof(*fds));
+    if (!workers || !fds)
     {
-        perror("failed to create output file");
+        perror("failed to allocate workers");
+        free(workers);
+        free(fds);
         return -1;
     }
 
-    uint32_t expected_seq = client_seq + 1;
-    struct sham_packet ack_packet;
-    ack_packet.header.flags = ACK_FLAG;
-    ack_packet.header.window_size = BUFFER_SIZE;
+    if (nthreads > 1)
+        create_reuseport_sockets(port, nthreads, fds, steer);
+    else
+        fds[0] = create_socket(port);
+    fprintf(stderr, "server listening on port %d (%d thread%s)\n", port, nthreads, nthreads > 1 ? "s" : "");
 
-    while (1)
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < nthreads; i++)
     {
-        struct sham_packet packet;
-        socklen_t addr_len = sizeof(*addr);
-        int bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                                  (struct sockaddr *)addr, &addr_len);
-        if (bytes_recv < 0)
+        workers[i].id = i;
+        workers[i].sockfd = fds[i];
+        workers[i].cpu = pin ? (int)(i % (ncpu > 0 ? ncpu : 1)) : -1;
+        workers[i].loss_rate = loss_rate;
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
         {
-            perror("recvfrom failed");
+            fprintf(stderr, "failed to start worker %d\n", i);
+            stop_requested = 1;
+            nthreads = i;
             break;
         }
+    }
 
-        if (packet.header.flags & FIN_FLAG)
-        {
-            log_event("RCV FIN SEQ=%u", packet.header.seq_num);
-            uint32_t peer_fin_seq = packet.header.seq_num;
-
-            // ACK their FIN
-            ack_packet.header.seq_num = server_seq; // FIX
-            ack_packet.header.ack_num = peer_fin_seq + 1;
-            ack_packet.header.flags = ACK_FLAG;
-            send_packet(sockfd, addr, &ack_packet, 0);
-            log_event("SND ACK FOR FIN");
-
-            // send our FIN
-            ack_packet.header.seq_num = server_seq;
-            ack_packet.header.flags = FIN_FLAG;
-            send_packet(sockfd, addr, &ack_packet, 0);
-            log_event("SND FIN SEQ=%u", server_seq);
-
-            // wait final ACK
-            bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                                  (struct sockaddr *)addr, &addr_len);
-            if (bytes_recv > 0 && (packet.header.flags & ACK_FLAG))
-            {
-                log_event("RCV ACK=%u", packet.header.ack_num);
-            }
-            break;
-        }
+    struct server_stats total = {0};
+    for (int i = 0; i < nthreads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        struct server_stats *st = &workers[i].stats;
+        fprintf(stderr, "worker %d cpu=%d: connections=%lu completed=%lu reaped=%lu datagrams=%lu bytes=%lu corrupt=%lu\n",
+                i, workers[i].cpu, st->accepted, st->completed, st->reaped, st->datagrams, st->bytes, st->corrupt);
+        log_event("WORKER %d CONNS=%lu COMPLETED=%lu DATAGRAMS=%lu BYTES=%lu",
+                  i, st->accepted, st->completed, st->datagrams, st->bytes);
+        total.completed += st->completed;
+        close(fds[i]);
+    }
+    fprintf(stderr, "server stopped, %lu transfers completed\n", total.completed);
 
-        if (is_packet_lost(loss_rate))
-        {
-            log_event("DROP DATA SEQ=%u", packet.header.seq_num);
-            continue;
-        }
+    free(workers);
+    free(fds);
+    return 0;
+}
 
-        int data_len = bytes_recv - sizeof(struct sham_header);
-        log_event("RCV DATA SEQ=%u LEN=%d", packet.header.seq_num, data_len);
+// acknowledge chat messages up to ack_num
+static void send_chat_ack(int sockfd, struct sockaddr_in *addr, uint32_t seq_num, uint32_t ack_num)
+{
+    struct sham_packet ack_packet;
+    ack_packet.header.seq_num = seq_num;
+    ack_packet.header.ack_num = ack_num;
+    ack_packet.header.flags = ACK_FLAG;
+    ack_packet.header.window_size = BUFFER_SIZE;
+    send_packet(sockfd, addr, &ack_packet, 0);
+    log_event("SND ACK=%u", ack_num);
+}
 
-        if (packet.header.seq_num == expected_seq)
-        {
-            fwrite(packet.data, 1, data_len, file);
-            expected_seq += data_len;
-        }
+// chat session: stdin is watched level-triggered because fgets buffers it,
+// the socket edge-triggered and drained on every wakeup
+enum chat_end
+{
+    CHAT_RUNNING,
+    CHAT_QUIT,      // local /quit: we send the first FIN
+    CHAT_PEER_FIN,  // peer sent FIN: answer it
+    CHAT_PEER_QUIT, // peer sent /quit as a message
+};
 
-        // always ACK the next expected byte
-        ack_packet.header.seq_num = server_seq; // FIX
-        ack_packet.header.ack_num = expected_seq;
-        ack_packet.header.flags = ACK_FLAG;
-        ack_packet.header.window_size = BUFFER_SIZE;
-        send_packet(sockfd, addr, &ack_packet, 0);
-        log_event("SND ACK=%u WIN=%u", ack_packet.header.ack_num, ack_packet.header.window_size);
-    }
+struct chat
+{
+    struct reactor reactor;
+    struct io_watch input_watch;
+    struct io_watch sock_watch;
+    int sockfd;
+    struct sockaddr_in *addr;
 
-    fclose(file);
-    return 0;
+    // delayed ack: one ACK per ack_freq messages or ack_delay_ms, whichever first
+    struct sham_timer delack_timer;
+    int unacked;
+    uint32_t pending_ack;
+
+    enum chat_end end;
+};
+
+// the FIN that ended chat mode, so the passive close can answer it at once
+static int chat_fin_pending = 0;
+static uint32_t chat_fin_seq = 0;
+
+static void chat_delack(void *arg)
+{
+    struct chat *c = arg;
+    if (c->unacked > 0)
+    {
+        send_chat_ack(c->sockfd, c->addr, server_seq, c->pending_ack);
+        c->unacked = 0;
+    }
 }
 
-// chat mode for server
-int chat_mode(int sockfd, struct sockaddr_in *addr, int is_server)
+static void chat_input(void *arg, uint32_t events)
 {
-    (void)is_server; // suppress unused parameter warning
-    fd_set readfds;
+    struct chat *c = arg;
     char input_buffer[1024];
     struct sham_packet packet;
+    (void)events;
 
-    printf("chat mode started. type /quit to exit\n");
+    // end of input closes the session like /quit
+    if (!fgets(input_buffer, sizeof(input_buffer), stdin))
+    {
+        c->end = CHAT_QUIT;
+        reactor_stop(&c->reactor);
+        return;
+    }
+
+    // strip newline
+    int msg_len = strlen(input_buffer);
+    if (msg_len > 0 && input_buffer[msg_len - 1] == '\n')
+    {
+        input_buffer[msg_len - 1] = '\0';
+        msg_len--;
+    }
 
-    while (1)
+    if (strcmp(input_buffer, "/quit") == 0)
     {
-        FD_ZERO(&readfds);
-        FD_SET(0, &readfds); // stdin
-        FD_SET(sockfd, &readfds);
+        // initiate 4-way handshake close
+        c->end = CHAT_QUIT;
+        reactor_stop(&c->reactor);
+        return;
+    }
+
+    // send message
+    packet.header.seq_num = server_seq;
+    packet.header.ack_num = 0;
+    packet.header.flags = 0;
+    packet.header.window_size = BUFFER_SIZE;
+
+    if (msg_len > 0 && msg_len < MAX_DATA_SIZE)
+    {
+        memcpy(packet.data, input_buffer, msg_len);
+        packet.data[msg_len] = '\0';
+    }
+
+    send_packet(c->sockfd, c->addr, &packet, msg_len);
+    log_event("SND DATA SEQ=%u LEN=%d", server_seq, msg_len);
+    server_seq += msg_len;
+}
 
-        int max_fd = (sockfd > 0) ? sockfd : 0;
+static void chat_readable(void *arg, uint32_t events)
+{
+    struct chat *c = arg;
+    struct sham_packet packet;
+    (void)events;
 
-        if (select(max_fd + 1, &readfds, NULL, NULL, NULL) < 0)
+    while (c->end == CHAT_RUNNING)
+    {
+        socklen_t addr_len = sizeof(*c->addr);
+        int bytes_recv = recvfrom(c->sockfd, &packet, sizeof(packet), MSG_DONTWAIT,
+                                  (struct sockaddr *)c->addr, &addr_len);
+        if (bytes_recv < 0)
         {
-            perror("select failed");
-            break;
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (bytes_recv == 0)
+            continue;
+
+        if (packet.header.flags & FIN_FLAG)
+        {
+            // handle connection close
+            chat_fin_pending = 1;
+            chat_fin_seq = packet.header.seq_num;
+            c->end = CHAT_PEER_FIN;
+            reactor_stop(&c->reactor);
+            return;
         }
 
-        // check for input from stdin
-        if (FD_ISSET(0, &readfds))
+        int data_len = bytes_recv - sizeof(struct sham_header);
+        if (data_len > 0)
         {
-            if (fgets(input_buffer, sizeof(input_buffer), stdin))
+            if (data_len >= MAX_DATA_SIZE)
+                data_len = MAX_DATA_SIZE - 1;
+            packet.data[data_len] = '\0';
+
+            // check if peer sent /quit
+            if (strcmp(packet.data, "/quit") == 0)
             {
-                // strip newline
-                int msg_len = strlen(input_buffer);
-                if (msg_len > 0 && input_buffer[msg_len - 1] == '\n')
-                {
-                    input_buffer[msg_len - 1] = '\0';
-                    msg_len--;
-                }
-
-                if (strcmp(input_buffer, "/quit") == 0)
-                {
-                    // initiate 4-way handshake close
-                    four_way_handshake_close(sockfd, addr, 1);
-                    break;
-                }
-
-                // send message
-                packet.header.seq_num = server_seq;
-                packet.header.ack_num = 0;
-                packet.header.flags = 0;
-                packet.header.window_size = BUFFER_SIZE;
-
-                if (msg_len > 0 && msg_len < MAX_DATA_SIZE)
-                {
-                    memcpy(packet.data, input_buffer, msg_len);
-                    packet.data[msg_len] = '\0';
-                }
-
-                send_packet(sockfd, addr, &packet, msg_len);
-                log_event("SND DATA SEQ=%u LEN=%d", server_seq, msg_len);
-                server_seq += msg_len;
+                printf("peer disconnected\n");
+                c->end = CHAT_PEER_QUIT;
+                reactor_stop(&c->reactor);
+                return;
             }
+
+            printf("received: %s\n", packet.data);
         }
 
-        // check for data from network
-        if (FD_ISSET(sockfd, &readfds))
+        // ACK messages only, never pure ACKs; a gap in the
+        // sequence is acked at once, in-order data may wait
+        if (data_len > 0)
         {
-            socklen_t addr_len = sizeof(*addr);
-            int bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                                      (struct sockaddr *)addr, &addr_len);
-            if (bytes_recv > 0)
+            int in_order = c->unacked == 0 || packet.header.seq_num == c->pending_ack;
+            c->pending_ack = packet.header.seq_num + data_len;
+            c->unacked++;
+            if (!in_order || c->unacked >= syn_opts.ack_freq)
+            {
+                send_chat_ack(c->sockfd, c->addr, server_seq, c->pending_ack);
+                c->unacked = 0;
+                timer_cancel(&c->reactor.timers, &c->delack_timer);
+            }
+            else if (!timer_armed(&c->delack_timer))
             {
-                if (packet.header.flags & FIN_FLAG)
-                {
-                    // handle connection close
-                    four_way_handshake_close(sockfd, addr, 0);
-                    break;
-                }
-                else
-                {
-                    int data_len = bytes_recv - sizeof(struct sham_header);
-                    if (data_len > 0)
-                    {
-                        if (data_len >= MAX_DATA_SIZE)
-                            data_len = MAX_DATA_SIZE - 1;
-                        packet.data[data_len] = '\0';
-
-                        // detect peer quit
-                        if (strcmp(packet.data, "/quit") == 0)
-                        {
-                            printf("peer disconnected\n");
-                            break;
-                        }
-
-                        printf("received: %s\n", packet.data);
-                    }
-
-                    // send ACK
-                    struct sham_packet ack_packet;
-                    ack_packet.header.seq_num = server_seq;
-                    ack_packet.header.ack_num = packet.header.seq_num + data_len;
-                    ack_packet.header.flags = ACK_FLAG;
-                    ack_packet.header.window_size = BUFFER_SIZE;
-
-                    send_packet(sockfd, addr, &ack_packet, 0);
-                    log_event("SND ACK=%u", ack_packet.header.ack_num);
-                }
+                timer_arm(&c->reactor.timers, &c->delack_timer,
+                          monotonic_us() + syn_opts.ack_delay_ms * 1000L);
             }
         }
     }
+}
 
-    return 0;
+// chat mode for server
+int chat_mode(int sockfd, struct sockaddr_in *addr, int is_server)
+{
+    (void)is_server; // suppress unused parameter warning
+
+    struct chat c;
+    memset(&c, 0, sizeof(c));
+    c.sockfd = sockfd;
+    c.addr = addr;
+    c.end = CHAT_RUNNING;
+    timer_init(&c.delack_timer, chat_delack, &c);
+
+    if (reactor_init(&c.reactor) < 0 ||
+        reactor_add(&c.reactor, &c.input_watch, 0, EPOLLIN, chat_input, &c) < 0 ||
+        reactor_add(&c.reactor, &c.sock_watch, sockfd, EPOLLIN | EPOLLET, chat_readable, &c) < 0)
+    {
+        reactor_free(&c.reactor);
+        return -1;
+    }
+
+    printf("chat mode started. type /quit to exit\n");
+    fflush(stdout);
+
+    int result = reactor_run(&c.reactor);
+    reactor_free(&c.reactor);
+
+    if (c.end == CHAT_QUIT)
+        four_way_handshake_close(sockfd, addr, 1);
+    else if (c.end == CHAT_PEER_FIN)
+        four_way_handshake_close(sockfd, addr, 0);
+    return result;
 }
 
-// 4-way handshake for connection close (safe + timeout)
-int four_way_handshake_close(int sockfd, struct sockaddr_in *addr, int is_initiator)
+// 4-way close: each step waits at most CLOSE_STEP_MS for its packet so a
+// lost FIN or ACK never hangs the session
+struct closer
+{
+    struct reactor reactor;
+    struct io_watch watch;
+    struct sham_timer step_timer;
+    int sockfd;
+    struct sockaddr_in *addr;
+    int passive;    // answering the peer's FIN rather than sending the first
+    int steps_left;
+};
+
+static void closer_send(struct closer *cl, uint8_t flags, uint32_t ack_num)
 {
     struct sham_packet packet;
-    socklen_t addr_len = sizeof(*addr);
-    struct timeval tv;
-
-    // set 1s timeout so we don’t hang forever
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    packet.header.seq_num = server_seq;
+    packet.header.ack_num = ack_num;
+    packet.header.flags = flags;
+    packet.header.window_size = BUFFER_SIZE;
+    send_packet(cl->sockfd, cl->addr, &packet, 0);
+}
 
-    if (is_initiator)
+// one step done or timed out: wait for the next one, or finish
+static void closer_next_step(struct closer *cl)
+{
+    if (--cl->steps_left <= 0)
     {
-        // step 1: send FIN
-        packet.header.seq_num = server_seq;
-        packet.header.ack_num = 0;
-        packet.header.flags = FIN_FLAG;
-        packet.header.window_size = BUFFER_SIZE;
+        reactor_stop(&cl->reactor);
+        return;
+    }
+    timer_arm(&cl->reactor.timers, &cl->step_timer, monotonic_us() + CLOSE_STEP_MS * 1000L);
+}
 
-        send_packet(sockfd, addr, &packet, 0);
-        log_event("SND FIN SEQ=%u", server_seq);
-        state = FIN_WAIT_1;
+static void closer_step_timeout(void *arg)
+{
+    closer_next_step(arg);
+}
+
+// passive side, FIN in hand: ACK it and send our own
+static void closer_answer_fin(struct closer *cl, uint32_t fin_seq)
+{
+    log_event("RCV FIN SEQ=%u", fin_seq);
+
+    // send ACK
+    closer_send(cl, ACK_FLAG, fin_seq + 1);
+    log_event("SND ACK FOR FIN");
+    state = CLOSE_WAIT;
+
+    // send our own FIN
+    closer_send(cl, FIN_FLAG, 0);
+    log_event("SND FIN SEQ=%u", server_seq);
+    state = LAST_ACK;
+}
+
+static void closer_on_packet(void *arg, uint32_t events)
+{
+    struct closer *cl = arg;
+    struct sham_packet packet;
+    (void)events;
+
+    while (cl->steps_left > 0)
+    {
+        socklen_t addr_len = sizeof(*cl->addr);
+        int bytes_recv = recvfrom(cl->sockfd, &packet, sizeof(packet), MSG_DONTWAIT,
+                                  (struct sockaddr *)cl->addr, &addr_len);
+        if (bytes_recv < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
 
-        // step 2: wait for ACK
-        int bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                                  (struct sockaddr *)addr, &addr_len);
-        if (bytes_recv > 0 && (packet.header.flags & ACK_FLAG))
+        if (state == FIN_WAIT_1 && (packet.header.flags & ACK_FLAG))
         {
             log_event("RCV ACK FOR FIN");
             state = FIN_WAIT_2;
+            closer_next_step(cl);
         }
-
-        // step 3: wait for peer’s FIN
-        bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                              (struct sockaddr *)addr, &addr_len);
-        if (bytes_recv > 0 && (packet.header.flags & FIN_FLAG))
+        else if ((state == FIN_WAIT_1 || state == FIN_WAIT_2) && (packet.header.flags & FIN_FLAG))
         {
-            uint32_t peer_fin_seq = packet.header.seq_num;
-            log_event("RCV FIN SEQ=%u", peer_fin_seq);
+            uint32_t fin_seq = packet.header.seq_num;
+            log_event("RCV FIN SEQ=%u", fin_seq);
 
             // step 4: send final ACK
-            struct sham_packet ack_packet;
-            ack_packet.header.seq_num = server_seq;
-            ack_packet.header.ack_num = peer_fin_seq + 1;
-            ack_packet.header.flags = ACK_FLAG;
-            ack_packet.header.window_size = BUFFER_SIZE;
-
-            send_packet(sockfd, addr, &ack_packet, 0);
-            log_event("SND ACK=%u", ack_packet.header.ack_num);
+            closer_send(cl, ACK_FLAG, fin_seq + 1);
+            log_event("SND ACK=%u", fin_seq + 1);
             state = TIME_WAIT;
+            cl->steps_left = 0;
+            reactor_stop(&cl->reactor);
+        }
+        else if (cl->passive && state != LAST_ACK && (packet.header.flags & FIN_FLAG))
+        {
+            closer_answer_fin(cl, packet.header.seq_num);
+            closer_next_step(cl);
+        }
+        else if (state == LAST_ACK && (packet.header.flags & ACK_FLAG))
+        {
+            log_event("RCV ACK=%u", packet.header.ack_num);
+            state = CLOSED;
+            cl->steps_left = 0;
+            reactor_stop(&cl->reactor);
         }
     }
-    else
+}
+
+// 4-way handshake for connection close (safe + timeout)
+int four_way_handshake_close(int sockfd, struct sockaddr_in *addr, int is_initiator)
+{
+    struct closer cl;
+    memset(&cl, 0, sizeof(cl));
+    cl.sockfd = sockfd;
+    cl.addr = addr;
+    timer_init(&cl.step_timer, closer_step_timeout, &cl);
+
+    if (reactor_init(&cl.reactor) < 0 ||
+        reactor_add(&cl.reactor, &cl.watch, sockfd, EPOLLIN | EPOLLET, closer_on_packet, &cl) < 0)
     {
-        // passive side: wait for FIN
-        int bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                                  (struct sockaddr *)addr, &addr_len);
-        if (bytes_recv > 0 && (packet.header.flags & FIN_FLAG))
-        {
-            uint32_t peer_fin_seq = packet.header.seq_num;
-            log_event("RCV FIN SEQ=%u", peer_fin_seq);
-
-            // send ACK
-            struct sham_packet ack_packet;
-            ack_packet.header.seq_num = server_seq;
-            ack_packet.header.ack_num = peer_fin_seq + 1;
-            ack_packet.header.flags = ACK_FLAG;
-            ack_packet.header.window_size = BUFFER_SIZE;
-
-            send_packet(sockfd, addr, &ack_packet, 0);
-            log_event("SND ACK FOR FIN");
-            state = CLOSE_WAIT;
-
-            // send our own FIN
-            packet.header.seq_num = server_seq;
-            packet.header.ack_num = 0;
-            packet.header.flags = FIN_FLAG;
-            packet.header.window_size = BUFFER_SIZE;
-
-            send_packet(sockfd, addr, &packet, 0);
-            log_event("SND FIN SEQ=%u", server_seq);
-            state = LAST_ACK;
-
-            // wait for final ACK (with timeout)
-            bytes_recv = recvfrom(sockfd, &packet, sizeof(packet), 0,
-                                  (struct sockaddr *)addr, &addr_len);
-            if (bytes_recv > 0 && (packet.header.flags & ACK_FLAG))
-            {
-                log_event("RCV ACK=%u", packet.header.ack_num);
-                state = CLOSED;
-            }
-        }
+        reactor_free(&cl.reactor);
+        return -1;
     }
 
-    // restore blocking mode (remove timeout)
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
-    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (is_initiator)
+    {
+        // send FIN, then wait for its ACK and the peer's FIN
+        closer_send(&cl, FIN_FLAG, 0);
+        log_event("SND FIN SEQ=%u", server_seq);
+        state = FIN_WAIT_1;
+        cl.steps_left = 2;
+    }
+    else if (chat_fin_pending)
+    {
+        cl.passive = 1;
+        // chat mode already read the FIN; only the final ACK is left
+        chat_fin_pending = 0;
+        closer_answer_fin(&cl, chat_fin_seq);
+        cl.steps_left = 1;
+    }
+    else
+    {
+        // passive side: wait for FIN, then for the final ACK
+        cl.passive = 1;
+        cl.steps_left = 2;
+    }
+    timer_arm(&cl.reactor.timers, &cl.step_timer, monotonic_us() + CLOSE_STEP_MS * 1000L);
 
-    return 0;
+    int result = reactor_run(&cl.reactor);
+    reactor_free(&cl.reactor);
+    return result;
 }
 
 int main(int argc, char *argv[])
 {
     if (argc < 2)
     {
-        fprintf(stderr, "usage: %s <port> [--chat] [loss_rate]\n", argv[0]);
+        fprintf(stderr, "usage: %s <port> [--chat] [loss_rate] [--batch N] [--gro] [--ack-freq N] [--multi]\n"
+                        "       [--threads N] [--pin] [--steer] [--uring] [--mss N] [--writeback-mb N]\n"
+                        "       [--no-crc] [--no-fec] [--no-resume]\n", argv[0]);
         exit(1);
     }
 
     int port = atoi(argv[1]);
     int chat_mode_flag = 0;
+    int multi = 0;
+    int nthreads = 1;
+    int pin = 0;
+    int steer = 0;
     float loss_rate = 0.0;
 
     // parse arguments
@@ -386,6 +2195,86 @@ int main(int argc, char *argv[])
         {
             chat_mode_flag = 1;
         }
+        else if (strcmp(argv[i], "--ack-freq") == 0 && i + 1 < argc)
+        {
+            ack_freq_max = atoi(argv[++i]);
+            if (ack_freq_max < 1)
+            {
+                fprintf(stderr, "--ack-freq must be at least 1\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--multi") == 0)
+        {
+            multi = 1;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            // sharding only makes sense for many clients
+            nthreads = atoi(argv[++i]);
+            multi = 1;
+            if (nthreads < 1)
+            {
+                fprintf(stderr, "--threads must be at least 1\n");
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--pin") == 0)
+        {
+            pin = 1;
+        }
+        else if (strcmp(argv[i], "--steer") == 0)
+        {
+            steer = 1;
+        }
+        else if (strcmp(argv[i], "--gro") == 0)
+        {
+            use_gro = 1;
+        }
+        else if (strcmp(argv[i], "--uring") == 0)
+        {
+            use_uring = 1;
+        }
+        else if (strcmp(argv[i], "--no-crc") == 0)
+        {
+            crc_allowed = 0;
+        }
+        else if (strcmp(argv[i], "--no-fec") == 0)
+        {
+            fec_allowed = 0;
+        }
+        else if (strcmp(argv[i], "--no-resume") == 0)
+        {
+            resume_allowed = 0;
+        }
+        else if (strcmp(argv[i], "--mss") == 0 && i + 1 < argc)
+        {
+            mss_max = atoi(argv[++i]);
+            if (mss_max < 64 || mss_max > MAX_DATA_SIZE)
+            {
+                fprintf(stderr, "--mss must be between 64 and %d\n", MAX_DATA_SIZE);
+                exit(1);
+            }
+        }
+        else if (strcmp(argv[i], "--writeback-mb") == 0 && i + 1 < argc)
+        {
+            int mb = atoi(argv[++i]);
+            if (mb < 0)
+            {
+                fprintf(stderr, "--writeback-mb must not be negative\n");
+                exit(1);
+            }
+            writeback_bytes = (off_t)mb * 1024 * 1024;
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            recv_batch_size = atoi(argv[++i]);
+            if (recv_batch_size < 1)
+            {
+                fprintf(stderr, "--batch must be at least 1\n");
+                exit(1);
+            }
+        }
         else
         {
             loss_rate = atof(argv[i]);
@@ -395,42 +2284,51 @@ int main(int argc, char *argv[])
     // initialize logging
     init_logging("server_log.txt");
 
-    // create socket
-    sockfd = create_socket(port);
-    fprintf(stderr, "server listening on port %d\n", port);
-    // wait for client connection
-    struct sockaddr_in client_addr;
-    uint32_t initial_seq;
+    rcv_wscale = window_scale_for((uint32_t)REASM_SLOTS * mss_max);
 
-    if (three_way_handshake_server(sockfd, &client_addr, &initial_seq) < 0)
+    if (multi && !chat_mode_flag)
     {
-        fprintf(stderr, "handshake failed\n");
+        int ret = serve_forever(port, loss_rate, nthreads, pin, steer);
         cleanup_logging();
-        close(sockfd);
-        exit(1);
+        return ret < 0 ? 1 : 0;
     }
 
-    fprintf(stderr, "connection established\n");
+    // create socket
+    sockfd = create_socket(port);
+    fprintf(stderr, "server listening on port %d\n", port);
 
-    if (chat_mode_flag)
-    {
-        chat_mode(sockfd, &client_addr, 1);
-    }
-    else
+    if (!chat_mode_flag)
     {
-        // file transfer mode
-        strcpy(received_filename, "received_file");
-        if (receive_file(sockfd, &client_addr, received_filename, loss_rate) < 0)
+        // file transfer mode: a single transfer into received_file
+        struct server_stats stats = {0};
+        if (receive_files(sockfd, loss_rate, 1, &stats) < 0)
         {
             fprintf(stderr, "file transfer failed\n");
         }
         else
         {
             fprintf(stderr, "file received successfully\n");
-            calculate_md5(received_filename); 
         }
+        cleanup_logging();
+        close(sockfd);
+        return 0;
+    }
+
+    // chat mode: a single peer
+    struct sockaddr_in client_addr;
+    uint32_t initial_seq;
+
+    if (three_way_handshake_server(sockfd, &client_addr, &initial_seq) < 0)
+    {
+        fprintf(stderr, "handshake failed\n");
+        cleanup_logging();
+        close(sockfd);
+        exit(1);
     }
 
+    fprintf(stderr, "connection established\n");
+    chat_mode(sockfd, &client_addr, 1);
+
     cleanup_logging();
     close(sockfd);
     return 0;
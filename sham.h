@@ -13,6 +13,20 @@
 #include <sys/time.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103   // linux/udp.h, missing from older libc headers
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
 // #include <openssl/md5.h>  // commented out for now
 
 // S.H.A.M. packet header structure
@@ -23,21 +37,137 @@ struct sham_header {
     uint16_t window_size;  // flow control window size
 };
 
+// a packet with CRC_FLAG ends in a crc32c of its header and payload, after
+// the payload; the header itself keeps its original 12 bytes
+#define CRC_TRAILER 4
+
 // flag definitions
 #define SYN_FLAG 0x1
 #define ACK_FLAG 0x2
 #define FIN_FLAG 0x4
+#define SACK_FLAG 0x8  // SYN/SYN-ACK: sack permitted; ACK: payload carries sack blocks
+#define MTU_PROBE_FLAG 0x10 // padding-only path mtu probe, echoed back with ack_num = its seq_num
+#define CRC_FLAG 0x20  // crc trailer present; in SYN/SYN-ACK also: every later packet carries one
+#define FEC_FLAG 0x40  // repair segment (ack_num holds FEC_INFO); ACK: payload starts with a fec report
+
+// selective acknowledgement block [start, end), sent in the payload of
+// an ACK with SACK_FLAG set
+struct sham_sack_block {
+    uint32_t start;
+    uint32_t end;
+};
+
+#define MAX_SACK_BLOCKS 4
+
+// handshake options, carried in the payload of SYN and SYN-ACK. the
+// client proposes, the server answers with what it accepted; a SYN
+// without a payload gets the defaults that predate each option
+struct sham_syn_options {
+    uint16_t ack_freq;       // ack every Nth in-order segment (1 = every segment)
+    uint16_t ack_delay_ms;   // longest a pending ack may wait
+    uint8_t wscale;          // sender's own receive window shift (not negotiated)
+    uint8_t digest;          // end-to-end digest the client will send in its FIN (digest_algo_t)
+    uint16_t mss;            // largest payload accepted; the SYN-ACK holds the agreed value
+    uint64_t file_size;      // bytes the client will send, 0 if unknown (chat)
+    uint8_t fec;             // repair segments the client will send (fec_mode_t)
+    uint8_t fec_k;           // data segments per block
+    uint8_t fec_parity;      // most repair segments per block
+    uint8_t reserved;
+    uint32_t stripe;         // striped transfer the connection belongs to, 0 for none
+    uint16_t stripe_flows;   // connections the client stripes the file over
+    uint16_t reserved2;
+    uint32_t resume;         // SYN: id of a resumable transfer, 0 for none; SYN-ACK: echoed if accepted
+    uint32_t resume_crc;     // SYN-ACK: crc32c over the crc32c of each CKPT_CHUNK before resume_from
+    uint64_t resume_from;    // SYN: most the client will skip; SYN-ACK: bytes the server already holds
+};
+
+// a striped connection's data segments carry in ack_num how far their file
+// offset is from their offset in the connection's own byte stream, as a
+// signed count of STRIPE_UNITs
+#define STRIPE_SHIFT(file_offset, stream_offset) \
+    ((uint32_t)(int32_t)(((off_t)(file_offset) - (off_t)(stream_offset)) / STRIPE_UNIT))
+#define STRIPE_OFFSET(shift) ((int64_t)(int32_t)(shift) * STRIPE_UNIT)
+
+// a repair segment's ack_num: block size, repairs sent for the block and
+// this one's row. its seq_num is the block's first byte, and its payload
+// is as long as each of the block's segments
+#define FEC_INFO(k, r, row) (((uint32_t)(k) << 16) | ((uint32_t)(r) << 8) | (uint32_t)(row))
+#define FEC_INFO_K(info) (((info) >> 16) & 0xff)
+#define FEC_INFO_R(info) (((info) >> 8) & 0xff)
+#define FEC_INFO_ROW(info) ((info) & 0xff)
+
+// receiver counters at the front of an ACK with FEC_FLAG, ahead of any sack blocks
+struct sham_fec_report {
+    uint32_t repaired; // segments rebuilt from repairs so far
+    uint32_t failed;   // blocks given up on (too few repairs arrived)
+};
 
 // protocol constants
-#define MAX_DATA_SIZE 1024
-#define WINDOW_SIZE 10
-#define RTO_MS 500
+#define MAX_DATA_SIZE 8956 // largest payload: 9000-byte jumbo mtu less ip, udp and sham headers and crc trailer
+#define BASE_MSS 1024      // payload assumed to fit every path, and peers without the mss option
+#define WINDOW_SIZE 10     // initial congestion window (packets)
+#define MAX_WINDOW 1024    // packet_info ring capacity, caps cwnd (packets)
+#define RTO_MS 500             // initial rto before the first rtt sample
+#define RTO_MIN_MS 10
+#define RTO_MAX_MS 60000
+#define RTO_GRANULARITY_US 1000 // clock granularity term G in rto
 #define BUFFER_SIZE 8192
+#define REASM_SLOTS 256       // receive buffer, in segments of the negotiated mss
+#define DUPACK_THRESHOLD 3
+#define ACK_FREQ 2            // default delayed-ack frequency (segments)
+#define ACK_DELAY_MS 2        // delayed-ack timer, kept well below RTO_MIN_MS
+#define SEND_BATCH 32         // datagrams per sendmmsg flush (default)
+#define RECV_BATCH 32         // datagrams per recvmmsg (default)
+#define ZEROCOPY_MIN_BYTES 4096 // smallest sendmsg worth pinning pages for
+#define ZEROCOPY_MAX_FRAGS 15 // pages one zerocopy skb may pin (MAX_SKB_FRAGS, less slack)
+#define ZEROCOPY_SLABS 8      // batch buffers that can wait on the kernel at once
+#define MAP_WINDOW_BYTES (64L * 1024 * 1024) // mmap send window for large inputs
+#define FIN_RETRIES 5
+#define TIME_WAIT_MS 200     // linger to re-ACK a retransmitted peer FIN
+#define CONN_BUCKETS 1024    // server connection table size, power of two
+#define IDLE_TIMEOUT_MS 30000 // reap server connections silent this long
+#define REACTOR_EVENTS 16    // epoll events handled per wakeup
+#define CONNECT_TIMEOUT_MS 10000 // either end gives up waiting on the handshake
+#define CLOSE_STEP_MS 1000   // chat close: longest wait for each FIN/ACK step
+#define PMTU_MAX_PROBES 3    // unanswered probes before a size counts as too big
+#define PMTU_SEARCH_STEP 32  // stop searching once the bounds are this close (bytes)
+#define PMTU_RAISE_MS 600000 // after a search settles, look for a larger mtu again
+#define PMTU_BLACKHOLE_RTOS 3 // back-to-back timeouts that drop the mss to BASE_MSS
+#define DIGEST_MAX 64         // largest digest carried in a FIN (EVP_MAX_MD_SIZE)
+#define WRITE_QUEUE_JOBS 4096 // segments queued to a disk writer, power of two
+#define WRITE_IOV 64          // adjacent segments merged into one pwritev
+#define WRITE_HASH_CHUNK (1 << 20) // file read back per writer pass for a digest job
+#define FEC_MAX_K 32          // data segments per fec block
+#define FEC_MAX_PARITY 8      // repair segments per fec block
+#define FEC_K 16              // default block size
+#define FEC_PARITY 4          // default cap on repairs per block (rs)
+#define FEC_BLOCKS 16         // blocks a receiver holds repairs for at once
+#define FEC_RESIDUAL 0.01     // target chance that a block still needs a retransmission
+#define FEC_SAMPLE_SEGMENTS 64 // segments per loss-rate sample
+#define CACHE_LINE 64         // padding between indices written by different threads
+#define PIPE_READ_AHEAD (8 * 1024 * 1024) // file bytes the reader thread may run ahead
+#define PIPE_READ_CHUNK (256 * 1024) // bytes per read in the reader thread
+#define PIPE_BATCHES 4        // send batches circulating between sender and transmitter
+#define MAX_STREAMS 16        // connections one file may be striped over
+#define STRIPE_UNIT (64 * 1024) // alignment of every striped range
+#define STRIPE_CHUNK (4 * 1024 * 1024) // range a stream claims at a time
+#define STRIPE_STEAL_MIN (4 * STRIPE_UNIT) // smallest unsent tail worth splitting with an idle stream
+#define CKPT_CHUNK (1024 * 1024) // bytes per crc in a receiver checkpoint
+#define CKPT_INTERVAL (64L * 1024 * 1024) // newly committed bytes between checkpoints
+#define RESUME_TIMEOUT_MS 120000 // SYN-ACK wait when resuming: the server reads its partial copy back first
 
 // packet structure with header and data
 struct sham_packet {
     struct sham_header header;
-    char data[MAX_DATA_SIZE];
+    char data[MAX_DATA_SIZE + CRC_TRAILER];
+};
+
+// an ACK as a receiver builds it in place: the fec report and sack blocks
+// follow the header as its payload
+struct sham_ack {
+    struct sham_header header;
+    uint32_t payload[(sizeof(struct sham_fec_report) + MAX_SACK_BLOCKS * sizeof(struct sham_sack_block) +
+                      CRC_TRAILER) / sizeof(uint32_t)];
 };
 
 // connection state
@@ -57,9 +187,403 @@ typedef enum {
 struct packet_info {
     uint32_t seq_num;
     int data_len;
-    long     file_offset;
-    struct timeval sent_time;
+    off_t    file_offset;
+    uint64_t sent_us;    // monotonic send time
     int retransmitted;
+    int sacked;          // receiver holds it out of order
+    int lost;            // queued for retransmission
+    uint32_t fec_block;  // fec block it was first sent in, 0 for none
+    int buffered;        // its packet pool buffer holds the payload
+    uint32_t shift;      // ack_num of its datagrams: the stripe offset, 0 when not striped
+};
+
+// end-to-end digest algorithms, chosen by the client in the SYN
+typedef enum {
+    DIGEST_MD5,
+    DIGEST_SHA256,
+    DIGEST_BLAKE2S,
+    DIGEST_BLAKE2B,
+    DIGEST_COUNT
+} digest_algo_t;
+
+// running digest over a file's bytes in order; bytes is how far it got
+struct evp_md_ctx_st;
+
+struct sham_digest {
+    struct evp_md_ctx_st* ctx;
+    digest_algo_t algo;
+    uint64_t bytes;
+};
+
+// forward error correction, chosen by the client in the SYN
+typedef enum {
+    FEC_NONE,
+    FEC_XOR, // one parity segment per block
+    FEC_RS,  // up to fec_parity cauchy reed-solomon repairs per block
+    FEC_MODE_COUNT
+} fec_mode_t;
+
+// congestion control algorithms, selectable per connection
+typedef enum {
+    CC_RENO,
+    CC_NEWRENO,
+    CC_CUBIC
+} cc_algo_t;
+
+struct cc_state;
+
+// per-algorithm hooks; slow start and clamping are shared
+struct cc_ops {
+    const char* name;
+    void (*init)(struct cc_state* cc);
+    void (*on_ack)(struct cc_state* cc, uint32_t acked, uint32_t ack_seq);
+    void (*on_loss)(struct cc_state* cc, uint32_t in_flight);
+};
+
+// congestion control state (cwnd/ssthresh in bytes)
+struct cc_state {
+    cc_algo_t algo;
+    const struct cc_ops* ops;
+    uint32_t mss;
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t bytes_acked;  // congestion avoidance byte counter
+    int in_recovery;
+    uint32_t recover;      // snd_nxt when recovery started (newreno)
+    // cubic
+    double w_max;
+    double k;
+    double w_est;
+    double epoch_start;
+};
+
+// input file served from a sliding read-only mapping
+struct file_map {
+    int fd;
+    off_t size;
+    char* base;          // current mapping
+    off_t map_off;       // file offset of base
+    size_t map_len;
+};
+
+// io_uring instance bound to one socket, driven without liburing
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+struct uring {
+    int fd;
+    void* sq_ring;
+    void* cq_ring;
+    size_t sq_ring_len;
+    size_t cq_ring_len;
+    size_t sqes_len;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail; // sqes prepared, published to the kernel on submit
+    unsigned queued;        // prepared but not yet submitted
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    // receive: provided buffer ring feeding one multishot recvmsg
+    struct io_uring_buf_ring* br;
+    size_t br_len;
+    unsigned short br_tail;
+    char* bufs;
+    unsigned nbufs;
+    unsigned buf_size;
+    unsigned short* held;   // buffer ids lent out by the last batch
+    int nheld;
+    struct msghdr recv_msg; // name/control layout for the multishot request
+    int recv_armed;
+    unsigned long enters;
+};
+
+// one generation of batch buffers; with MSG_ZEROCOPY the kernel may still
+// read them after the flush, until completions for [zc_lo, zc_hi) arrive
+struct batch_slab {
+    uint32_t zc_lo;
+    uint32_t zc_hi;
+    int pending;         // zerocopy sends not yet completed
+};
+
+// what a queued datagram carries besides its payload: the header in
+// front of it and, with CRC_FLAG, the crc trailer behind it
+struct batch_frame {
+    struct sham_header header;
+    uint32_t crc;
+};
+
+#define BATCH_IOV 3 // iovecs per queued datagram: header, payload, trailer
+
+// datagrams queued for one sendmmsg call
+struct send_batch {
+    int sockfd;
+    struct sockaddr_in* addr;
+    int max;
+    int count;
+    int gso;             // coalesce equal-size runs with UDP_SEGMENT
+    struct batch_frame* frames;
+    int* lens;
+    struct iovec* iov;   // BATCH_IOV per datagram
+    struct mmsghdr* msgs;
+    char* cmsgs;
+    int slot_size;       // payload bytes per slot: the largest segment the batch will carry
+    char* payload;       // slot_size per slot for callers without their own buffer
+    struct uring* ring;  // submit through io_uring instead of sendmmsg
+    // MSG_ZEROCOPY: sends of at least zc_min bytes pin the slab being sent
+    // and filling moves on to the next one
+    int zerocopy;
+    int zc_min;
+    int nslabs;
+    int slab;            // generation being filled
+    struct batch_slab* slabs;
+    uint32_t zc_next;    // notification id of the next zerocopy send
+    unsigned long zc_sends;
+    unsigned long zc_completed;
+    unsigned long zc_copied; // the kernel fell back to copying anyway
+    unsigned long syscalls;
+    unsigned long datagrams;
+};
+
+// preformatted datagrams for a sender's window, header and payload
+// contiguous, one cache-line aligned buffer per window slot plus the sends
+// that may still be queued: a segment is read from the file straight into
+// its buffer and sent from there until it is acked, retransmissions included
+struct packet_pool {
+    char* base;
+    size_t stride;       // bytes per buffer
+    size_t bytes;        // length of the mapping
+    int count;
+    int huge;            // backed by explicit huge pages
+    unsigned long fills;   // buffers read from the file
+    unsigned long resends; // buffers sent again as they were
+    unsigned long copied;  // payload bytes copied rather than read in place
+};
+
+// preallocated buffers for one recvmmsg call
+struct recv_batch {
+    int max;
+    int count;           // datagrams in the last read
+    int gro;             // UDP_GRO enabled: buffers may hold coalesced segments
+    size_t buf_size;
+    char* bufs;
+    struct mmsghdr* msgs;
+    struct iovec* iov;
+    struct sockaddr_in* addrs;
+    char* cmsgs;
+    struct uring* ring;  // multishot io_uring receive instead of recvmmsg
+    int wait_fd;         // what the event loop waits on: the socket or the ring
+    int cur;             // iteration over the last read
+    size_t cur_off;
+    unsigned long syscalls;
+    unsigned long datagrams;
+    unsigned long segments;
+};
+
+// timer, armed in a timer_heap by monotonic deadline
+typedef void (*timer_cb)(void* arg);
+
+struct sham_timer {
+    uint64_t deadline_us;
+    timer_cb cb;
+    void* arg;
+    int heap_idx;        // -1 when not armed
+};
+
+struct timer_heap {
+    struct sham_timer** items;
+    int count;
+    int cap;
+};
+
+// reactor: one epoll instance and the timers that share its wait
+typedef void (*io_cb)(void* arg, uint32_t events);
+
+struct io_watch {
+    int fd;
+    io_cb cb;
+    void* arg;
+};
+
+struct reactor {
+    int epfd;
+    struct timer_heap timers;
+    int running;
+    unsigned long wakeups;
+};
+
+// --resume, receiver side: crc32c of every CKPT_CHUNK of the output's
+// prefix, kept as it is committed and saved beside it as <output>.ckpt
+struct sham_checkpoint {
+    char path[80];
+    uint32_t id;         // the client's name for the transfer
+    uint64_t file_size;
+    uint32_t* crcs;      // one per whole chunk of the file
+    uint32_t count;      // chunks hashed so far
+    uint32_t crc;        // of the chunk being hashed
+    uint64_t bytes;      // how far the hashing got, like sham_digest
+    uint64_t saved;      // committed bytes last handed to the writer to save
+};
+
+// received segments waiting for the disk writer: copied into a fifo ring
+// per output file, released once the writer has put them at their offset
+struct write_stage {
+    int fd;
+    char* data;
+    uint32_t capacity;
+    uint32_t head;       // next free byte, receive loop only
+    uint64_t queued;     // ring bytes handed out, wrap padding included
+    uint64_t done;       // ring bytes the writer released (atomic)
+    int errors;          // failed writes (atomic)
+    uint32_t checkpoints;  // checkpoint jobs queued, receive loop only
+    uint32_t checkpointed; // and done (atomic)
+    uint32_t digests;    // digest jobs queued, receive loop only
+    uint32_t digested;   // and done (atomic)
+    // writeback pacing, writer only
+    uint64_t dirty;
+    off_t dirty_lo, dirty_hi;
+    off_t flush_lo, flush_hi;
+    // a digest job being read back a chunk at a time, writer only
+    struct write_stage* hash_next;
+    struct sham_digest hash;
+    uint64_t hash_size;
+    unsigned char* hash_out;
+    int* hash_len;
+};
+
+struct write_job {
+    struct write_stage* stage;
+    off_t offset;        // where the bytes go in the file
+    uint32_t pos;        // where they sit in the stage ring
+    uint32_t len;
+    uint32_t cost;       // ring bytes released when done: len plus wrap padding
+    struct sham_checkpoint* ckpt; // a checkpoint job: sync the file, then record offset bytes in it
+    unsigned char* digest; // a digest job: hash the first offset bytes of the file into it
+    int* digest_len;     // where its length (or -1) goes
+    digest_algo_t algo;
+};
+
+// one writer thread fed by one receive loop (single producer, single consumer)
+struct disk_writer {
+    struct write_job* jobs;
+    uint32_t head;       // next job the receive loop fills
+    uint32_t tail;       // next job the writer takes
+    int event_fd;        // readable after the writer finished some jobs
+    int running;
+    int wanted;          // the receive loop is waiting on a write (atomic)
+    struct write_stage* hashing; // files with a digest job under way, writer only
+    char* hash_buf;
+    pthread_t thread;
+    off_t writeback;     // start writeback every this many bytes per file, 0 = off
+    unsigned long queued;
+    unsigned long stalls; // segments written inline because the queue was full
+    unsigned long writes; // pwritev calls, writer only
+};
+
+// bounded single-producer single-consumer queue of pointers. each side
+// keeps its index, and a cached copy of the other's, on a cache line of its
+// own so that neither writes a line the other is reading in the common case
+struct spsc_queue {
+    uint32_t head;       // next slot the producer fills
+    uint32_t tail_seen;  // producer's last look at tail
+    char pad0[CACHE_LINE - 2 * sizeof(uint32_t)];
+    uint32_t tail;       // next slot the consumer takes
+    uint32_t head_seen;  // consumer's last look at head
+    char pad1[CACHE_LINE - 2 * sizeof(uint32_t)];
+    void** slots;
+    uint32_t size;       // power of two
+};
+
+// pipelined sender, first stage: a reader thread reads the input in order
+// into a byte ring and digests it; the sender takes segments out of it
+struct read_ahead {
+    uint64_t filled;     // file bytes read into the ring, reader only (atomic)
+    char pad0[CACHE_LINE - sizeof(uint64_t)];
+    uint64_t consumed;   // file bytes taken out, sender only (atomic)
+    char pad1[CACHE_LINE - sizeof(uint64_t)];
+    int fd;
+    char* data;
+    uint32_t capacity;
+    uint64_t size;
+    struct sham_digest* digest; // updated by the reader while it runs
+    int running;         // cleared to stop the reader early (atomic)
+    int failed;          // a read failed or came up short (atomic)
+    pthread_t thread;
+    unsigned long reads;
+    unsigned long full_waits;  // reader found the ring full
+    unsigned long empty_waits; // sender found the bytes not read yet
+};
+
+// last stage: a transmitter thread flushes the batches the sender fills
+// and hands them back empty
+struct tx_stage {
+    struct send_batch* batches;
+    int count;
+    struct spsc_queue full;  // sender -> transmitter
+    struct spsc_queue empty; // transmitter -> sender
+    int running;         // cleared once the sender queues no more (atomic)
+    int failed;          // a flush failed (atomic)
+    int idle;            // the transmitter sleeps on wake (atomic)
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    unsigned long waits; // sender found no empty batch
+};
+
+// rtt estimator (microseconds)
+struct rtt_state {
+    long srtt_us;
+    long rttvar_us;
+    long rto_us;
+    int backoff;
+    int has_sample;
+};
+
+// per-worker server counters, reported at shutdown to show load balance
+struct server_stats {
+    unsigned long datagrams;
+    unsigned long bytes;
+    unsigned long accepted;
+    unsigned long completed;
+    unsigned long reaped;
+    unsigned long corrupt; // datagrams dropped for a bad crc
+};
+
+// binary log: per-packet events recorded by log_packet and decoded by logdump
+enum log_event_id {
+    LOG_SND_DATA = 1,
+    LOG_RETX_DATA,
+    LOG_RCV_DATA,
+    LOG_DROP_DATA,
+    LOG_SND_ACK,
+    LOG_RCV_ACK,
+    LOG_RTT_SAMPLE,
+};
+
+struct log_record {
+    uint64_t ts_us; // monotonic
+    uint32_t seq;
+    uint32_t ack;
+    int32_t len;
+    uint32_t arg;   // event specific: window, rto, ...
+    uint16_t event;
+    uint16_t reserved;
+    uint32_t pad;
+};
+
+#define LOG_MAGIC "SHAMLOG1"
+
+// start of every .bin log: maps record timestamps to wall-clock time
+struct log_file_header {
+    char magic[8];
+    uint64_t mono_us;
+    uint64_t wall_us;
 };
 
 
@@ -71,13 +595,98 @@ extern int verbose_logging;
 
 // function prototypes
 void init_logging(const char* log_filename);
-void log_event(const char* format, ...);
+void log_text(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void log_record(uint16_t event, uint32_t seq, uint32_t ack, int32_t len, uint32_t arg);
+int log_record_format(const struct log_record* r, char* buf, size_t size);
+void log_format_time(uint64_t wall_us, char* buf, size_t size);
 void cleanup_logging(void);
 
+// both compile to a single predicted-not-taken branch when logging is off;
+// arguments are not evaluated then
+#define log_event(...) \
+    do { if (__builtin_expect(verbose_logging, 0)) log_text(__VA_ARGS__); } while (0)
+#define log_packet(event, seq, ack, len, arg) \
+    do { if (__builtin_expect(verbose_logging, 0)) log_record(event, seq, ack, len, arg); } while (0)
+
 int create_socket(int port);
+int create_reuseport_sockets(int port, int count, int* fds, int steer);
 int send_packet(int sockfd, struct sockaddr_in* addr, struct sham_packet* packet, int data_len);
+int send_datagram(int sockfd, struct sockaddr_in* addr, struct sham_header* header, int data_len);
 int recv_packet(int sockfd, struct sockaddr_in* addr, struct sham_packet* packet);
+int send_packet_iov(int sockfd, struct sockaddr_in* addr, const struct sham_header* header,
+                    const void* data, int data_len);
 int simulate_packet_loss(float loss_rate);
+int set_path_mtu_mode(int sockfd, int probe);
+void syn_options_default(struct sham_syn_options* opts);
+uint8_t window_scale_for(uint32_t buffer_bytes);
+int syn_options_parse(const struct sham_packet* packet, int bytes_recv,
+                      struct sham_syn_options* opts);
+
+// batched transmission
+int batch_init(struct send_batch* b, int sockfd, struct sockaddr_in* addr, int max, int mss,
+               int use_gso, int use_uring);
+void batch_free(struct send_batch* b);
+char* batch_slot(struct send_batch* b);
+int batch_add(struct send_batch* b, const struct sham_header* header, const void* data, int data_len);
+int batch_add_packet(struct send_batch* b, struct sham_packet* packet, int data_len);
+int packet_pool_init(struct packet_pool* pool, int count, int mss);
+void packet_pool_free(struct packet_pool* pool);
+struct sham_packet* packet_pool_get(struct packet_pool* pool, int index);
+int batch_flush(struct send_batch* b);
+int batch_zerocopy(struct send_batch* b, int min_bytes);
+int batch_reap(struct send_batch* b);
+int batch_release(struct send_batch* b);
+
+// batched receive
+int recv_batch_init(struct recv_batch* rb, int sockfd, int max, int mss, int use_gro, int use_uring);
+void recv_batch_free(struct recv_batch* rb);
+int recv_batch_read(struct recv_batch* rb, int sockfd);
+int recv_batch_next(struct recv_batch* rb, struct sham_packet** packet, int* len,
+                    struct sockaddr_in* addr);
+
+// io_uring transport (falls back to the socket calls when unavailable)
+int uring_init(struct uring* u, unsigned entries, unsigned cq_entries, int sockfd);
+void uring_free(struct uring* u);
+int uring_sendmsgs(struct uring* u, struct mmsghdr* msgs, int n, int flags);
+int uring_recv_start(struct uring* u, unsigned nbufs, unsigned buf_size, unsigned control_len);
+int uring_recv_batch(struct uring* u, struct recv_batch* rb);
+
+// memory-mapped input files
+int file_map_open(struct file_map* fm, const char* filename);
+const char* file_map_slice(struct file_map* fm, off_t offset, size_t len);
+int file_map_covers(const struct file_map* fm, off_t offset, size_t len);
+void file_map_close(struct file_map* fm);
+
+// background file writer
+int disk_writer_start(struct disk_writer* w, off_t writeback);
+void disk_writer_stop(struct disk_writer* w);
+int write_stage_init(struct write_stage* st, int fd, uint32_t capacity);
+void write_stage_free(struct write_stage* st);
+uint32_t write_stage_pending(const struct write_stage* st);
+int write_stage_wait(struct write_stage* st);
+int write_stage_digesting(const struct write_stage* st);
+int disk_writer_submit(struct disk_writer* w, struct write_stage* st, off_t offset,
+                       const char* data, uint32_t len);
+int disk_writer_checkpoint(struct disk_writer* w, struct write_stage* st, struct sham_checkpoint* ck,
+                           uint64_t committed);
+int disk_writer_digest(struct disk_writer* w, struct write_stage* st, uint64_t size, digest_algo_t algo,
+                       unsigned char* out, int* len);
+void disk_writer_want(struct disk_writer* w);
+void disk_writer_reap(struct disk_writer* w);
+
+// pipelined sender stages
+int spsc_init(struct spsc_queue* q, uint32_t size);
+void spsc_free(struct spsc_queue* q);
+int spsc_push(struct spsc_queue* q, void* item);
+void* spsc_pop(struct spsc_queue* q);
+int read_ahead_start(struct read_ahead* ra, const char* filename, uint64_t start, uint64_t size,
+                     struct sham_digest* digest);
+int read_ahead_take(struct read_ahead* ra, uint64_t offset, char* dst, uint32_t len);
+void read_ahead_stop(struct read_ahead* ra);
+int tx_stage_start(struct tx_stage* tx, int sockfd, struct sockaddr_in* addr, int max, int mss,
+                   int use_gso, int use_uring);
+struct send_batch* tx_stage_swap(struct tx_stage* tx, struct send_batch* filled);
+int tx_stage_stop(struct tx_stage* tx, struct send_batch* current);
 
 // connection management
 int three_way_handshake_client(int sockfd, struct sockaddr_in* server_addr, uint32_t* initial_seq);
@@ -86,14 +695,79 @@ int four_way_handshake_close(int sockfd, struct sockaddr_in* addr, int is_initia
 
 // data transmission
 int send_file(int sockfd, struct sockaddr_in* addr, const char* filename, float loss_rate);
-int receive_file(int sockfd, struct sockaddr_in* addr, const char* filename, float loss_rate);
+int receive_files(int sockfd, float loss_rate, int max_transfers, struct server_stats* stats);
 
 // chat functionality
 int chat_mode(int sockfd, struct sockaddr_in* addr, int is_server);
 
+// congestion control
+int cc_from_name(const char* name, cc_algo_t* algo);
+const char* cc_name(const struct cc_state* cc);
+void cc_init(struct cc_state* cc, cc_algo_t algo, uint32_t mss);
+void cc_on_ack(struct cc_state* cc, uint32_t acked, uint32_t ack_seq);
+void cc_on_loss(struct cc_state* cc, uint32_t in_flight, uint32_t snd_nxt);
+void cc_on_timeout(struct cc_state* cc, uint32_t in_flight);
+
+// end-to-end digest
+int digest_from_name(const char* name, digest_algo_t* algo);
+const char* digest_name(digest_algo_t algo);
+int digest_init(struct sham_digest* d, digest_algo_t algo);
+void digest_extend(struct sham_digest* d, uint64_t offset, const void* data, size_t len);
+int digest_final(struct sham_digest* d, unsigned char* out);
+void digest_free(struct sham_digest* d);
+void digest_print(digest_algo_t algo, const unsigned char* digest, int len);
+int digest_file(int fd, uint64_t size, digest_algo_t algo, unsigned char* out);
+
+// forward error correction
+const char* fec_name(fec_mode_t mode);
+int fec_from_name(const char* name, fec_mode_t* mode);
+uint8_t fec_coef(int row, int col);
+void fec_mul_add(void* dst, const void* src, uint8_t c, size_t len);
+int fec_solve(int n, const int* rows, const int* cols, uint8_t** syn, uint8_t** out, size_t len);
+int fec_parity_for(double loss, int k, int max);
+
+// receiver checkpoints (--resume)
+int ckpt_init(struct sham_checkpoint* ck, const char* output, uint32_t id, uint64_t file_size);
+void ckpt_free(struct sham_checkpoint* ck);
+uint64_t ckpt_load(struct sham_checkpoint* ck);
+void ckpt_rewind(struct sham_checkpoint* ck, uint64_t bytes);
+void ckpt_extend(struct sham_checkpoint* ck, uint64_t offset, const void* data, size_t len);
+int ckpt_save(const struct sham_checkpoint* ck, uint64_t committed);
+void ckpt_remove(const struct sham_checkpoint* ck);
+uint64_t ckpt_scan(int fd, uint64_t len, const uint32_t* expect, uint32_t* chain, struct sham_digest* digest);
+
+// per-packet crc32c
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len);
+const char* crc32c_impl(void);
+uint32_t packet_crc(const struct sham_header* header, const void* data, size_t len);
+int packet_seal(const struct sham_header* header, const void* data, size_t len, void* trailer);
+int packet_intact(const struct sham_packet* packet, int* len, int required);
+
+// rtt / rto estimation
+void rtt_init(struct rtt_state* rtt);
+void rtt_sample(struct rtt_state* rtt, long sample_us);
+void rtt_backoff(struct rtt_state* rtt);
+
+// timers (RTO, delayed ACK, persist, FIN, TIME_WAIT, idle reaping)
+uint64_t monotonic_us(void);
+void timer_init(struct sham_timer* t, timer_cb cb, void* arg);
+int timer_armed(const struct sham_timer* t);
+int timer_arm(struct timer_heap* h, struct sham_timer* t, uint64_t deadline_us);
+void timer_cancel(struct timer_heap* h, struct sham_timer* t);
+long timers_next_wait_us(const struct timer_heap* h, uint64_t now);
+int timers_run(struct timer_heap* h, uint64_t now);
+void timers_free(struct timer_heap* h);
+
+// reactor (edge-triggered epoll + timers)
+int reactor_init(struct reactor* r);
+int reactor_add(struct reactor* r, struct io_watch* w, int fd, uint32_t events,
+                io_cb cb, void* arg);
+int reactor_run(struct reactor* r);
+void reactor_stop(struct reactor* r);
+void reactor_free(struct reactor* r);
+
 // utility functions
 uint32_t generate_initial_seq(void);
-void calculate_md5(const char* filename);
 int is_packet_lost(float loss_rate);
 
 #endif
@@ -0,0 +1,245 @@
+#include "sham.h"
+#include <math.h>
+
+// congestion control: slow start + AIMD (reno/newreno) and cubic.
+// cwnd and ssthresh are kept in bytes, every algorithm shares slow start
+// and the per-ack byte counting; only congestion avoidance and the
+// reaction to loss differ.
+
+#define CUBIC_C    0.4
+#define CUBIC_BETA 0.7
+
+static uint32_t cc_max_cwnd(const struct cc_state* cc) {
+    return MAX_WINDOW * cc->mss;
+}
+
+static void cc_clamp(struct cc_state* cc) {
+    if (cc->cwnd < cc->mss) cc->cwnd = cc->mss;
+    if (cc->cwnd > cc_max_cwnd(cc)) cc->cwnd = cc_max_cwnd(cc);
+}
+
+// slow start: grow by the bytes acked, at most 2 mss per ack (RFC 3465)
+static void cc_slow_start(struct cc_state* cc, uint32_t acked) {
+    uint32_t limit = 2 * cc->mss;
+    cc->cwnd += acked < limit ? acked : limit;
+}
+
+// half the flight, never below two segments (RFC 5681)
+static uint32_t cc_half_flight(const struct cc_state* cc, uint32_t in_flight) {
+    uint32_t half = in_flight / 2;
+    return half > 2 * cc->mss ? half : 2 * cc->mss;
+}
+
+// ---- reno / newreno ----
+
+static void reno_init(struct cc_state* cc) {
+    (void)cc;
+}
+
+static void reno_on_ack(struct cc_state* cc, uint32_t acked, uint32_t ack_seq) {
+    if (cc->in_recovery) {
+        // newreno stays in recovery until everything outstanding at the
+        // time of the loss is acked; reno leaves on the first new ack
+        if (cc->algo == CC_NEWRENO && (int32_t)(ack_seq - cc->recover) < 0) {
+            return;
+        }
+        cc->in_recovery = 0;
+        cc->cwnd = cc->ssthresh;
+        return;
+    }
+
+    if (cc->cwnd < cc->ssthresh) {
+        cc_slow_start(cc, acked);
+        return;
+    }
+
+    // additive increase: one mss per cwnd worth of acked bytes
+    cc->bytes_acked += acked;
+    if (cc->bytes_acked >= cc->cwnd) {
+        cc->bytes_acked -= cc->cwnd;
+        cc->cwnd += cc->mss;
+    }
+}
+
+static void reno_on_loss(struct cc_state* cc, uint32_t in_flight) {
+    cc->ssthresh = cc_half_flight(cc, in_flight);
+    cc->cwnd = cc->ssthresh;
+}
+
+// ---- cubic (RFC 8312) ----
+
+// seconds on the monotonic clock, so a wall clock step cannot move the epoch
+static double cubic_now(void) {
+    return monotonic_us() / 1e6;
+}
+
+static void cubic_init(struct cc_state* cc) {
+    cc->w_max = 0;
+    cc->k = 0;
+    cc->w_est = 0;
+    cc->epoch_start = 0;
+}
+
+static void cubic_on_ack(struct cc_state* cc, uint32_t acked, uint32_t ack_seq) {
+    (void)ack_seq;
+    if (cc->in_recovery) {
+        cc->in_recovery = 0;
+        cc->cwnd = cc->ssthresh;
+        return;
+    }
+
+    if (cc->cwnd < cc->ssthresh) {
+        cc_slow_start(cc, acked);
+        return;
+    }
+
+    double mss = cc->mss;
+    double cwnd = cc->cwnd / mss;
+
+    if (cc->epoch_start == 0) {
+        // first congestion avoidance ack since the last loss
+        cc->epoch_start = cubic_now();
+        if (cc->w_max < cwnd) {
+            cc->w_max = cwnd;
+            cc->k = 0;
+        } else {
+            cc->k = cbrt(cc->w_max * (1 - CUBIC_BETA) / CUBIC_C);
+        }
+        cc->w_est = cwnd;
+    }
+
+    double t = cubic_now() - cc->epoch_start;
+    double target = CUBIC_C * pow(t - cc->k, 3) + cc->w_max;
+
+    // reno-friendly estimate, advanced per ack rather than per rtt
+    cc->w_est += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * (acked / mss) / cwnd;
+    if (cc->w_est > target) target = cc->w_est;
+
+    if (target > cwnd) {
+        cc->cwnd += (uint32_t)((target - cwnd) / cwnd * acked);
+    } else {
+        // plateau: creep forward so we keep probing
+        cc->cwnd += (uint32_t)(acked / (100 * cwnd));
+    }
+}
+
+static void cubic_on_loss(struct cc_state* cc, uint32_t in_flight) {
+    (void)in_flight;
+    double cwnd = cc->cwnd / (double)cc->mss;
+
+    // fast convergence: release bandwidth faster when w_max is shrinking
+    if (cwnd < cc->w_max) {
+        cc->w_max = cwnd * (1 + CUBIC_BETA) / 2;
+    } else {
+        cc->w_max = cwnd;
+    }
+    cc->epoch_start = 0;
+
+    cc->ssthresh = (uint32_t)(cc->cwnd * CUBIC_BETA);
+    if (cc->ssthresh < 2 * cc->mss) cc->ssthresh = 2 * cc->mss;
+    cc->cwnd = cc->ssthresh;
+}
+
+static const struct cc_ops cc_algorithms[] = {
+    [CC_RENO]    = { "reno",    reno_init,  reno_on_ack,  reno_on_loss  },
+    [CC_NEWRENO] = { "newreno", reno_init,  reno_on_ack,  reno_on_loss  },
+    [CC_CUBIC]   = { "cubic",   cubic_init, cubic_on_ack, cubic_on_loss },
+};
+
+#define CC_COUNT (int)(sizeof(cc_algorithms) / sizeof(cc_algorithms[0]))
+
+// ---- public interface ----
+
+int cc_from_name(const char* name, cc_algo_t* algo) {
+    for (int i = 0; i < CC_COUNT; i++) {
+        if (strcmp(name, cc_algorithms[i].name) == 0) {
+            *algo = (cc_algo_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char* cc_name(const struct cc_state* cc) {
+    return cc->ops->name;
+}
+
+void cc_init(struct cc_state* cc, cc_algo_t algo, uint32_t mss) {
+    memset(cc, 0, sizeof(*cc));
+    cc->algo = algo;
+    cc->ops = &cc_algorithms[algo];
+    cc->mss = mss;
+    cc->cwnd = WINDOW_SIZE * mss;
+    cc->ssthresh = cc_max_cwnd(cc);
+    cc->ops->init(cc);
+}
+
+void cc_on_ack(struct cc_state* cc, uint32_t acked, uint32_t ack_seq) {
+    if (acked == 0) return;
+    cc->ops->on_ack(cc, acked, ack_seq);
+    cc_clamp(cc);
+}
+
+// loss signalled by duplicate acks: multiplicative decrease, enter recovery
+void cc_on_loss(struct cc_state* cc, uint32_t in_flight, uint32_t snd_nxt) {
+    if (cc->in_recovery) return; // one reduction per window
+    cc->ops->on_loss(cc, in_flight);
+    cc->in_recovery = 1;
+    cc->recover = snd_nxt;
+    cc->bytes_acked = 0;
+    cc_clamp(cc);
+    log_event("CC %s LOSS CWND=%u SSTHRESH=%u", cc_name(cc), cc->cwnd, cc->ssthresh);
+}
+
+// retransmission timeout: collapse to one segment and slow start again
+void cc_on_timeout(struct cc_state* cc, uint32_t in_flight) {
+    cc->ops->on_loss(cc, in_flight);
+    cc->cwnd = cc->mss;
+    cc->in_recovery = 0;
+    cc->bytes_acked = 0;
+    log_event("CC %s TIMEOUT CWND=%u SSTHRESH=%u", cc_name(cc), cc->cwnd, cc->ssthresh);
+}
+
+// ---- rtt estimation and retransmission timeout (RFC 6298) ----
+
+static long rtt_clamp(long rto_us) {
+    if (rto_us < RTO_MIN_MS * 1000L) return RTO_MIN_MS * 1000L;
+    if (rto_us > RTO_MAX_MS * 1000L) return RTO_MAX_MS * 1000L;
+    return rto_us;
+}
+
+void rtt_init(struct rtt_state* rtt) {
+    memset(rtt, 0, sizeof(*rtt));
+    rtt->rto_us = RTO_MS * 1000L;
+}
+
+// feed one rtt measurement; callers must skip retransmitted segments (karn)
+void rtt_sample(struct rtt_state* rtt, long sample_us) {
+    if (sample_us < 0) return;
+
+    if (!rtt->has_sample) {
+        rtt->srtt_us = sample_us;
+        rtt->rttvar_us = sample_us / 2;
+        rtt->has_sample = 1;
+    } else {
+        long err = rtt->srtt_us - sample_us;
+        if (err < 0) err = -err;
+        rtt->rttvar_us = (3 * rtt->rttvar_us + err) / 4;
+        rtt->srtt_us = (7 * rtt->srtt_us + sample_us) / 8;
+    }
+
+    long var = 4 * rtt->rttvar_us;
+    if (var < RTO_GRANULARITY_US) var = RTO_GRANULARITY_US;
+    rtt->rto_us = rtt_clamp(rtt->srtt_us + var);
+    rtt->backoff = 0; // a fresh sample undoes any backoff
+
+    log_packet(LOG_RTT_SAMPLE, (uint32_t)sample_us, (uint32_t)rtt->srtt_us,
+               (int32_t)rtt->rttvar_us, (uint32_t)(rtt->rto_us / 1000));
+}
+
+// exponential backoff after a retransmission timeout
+void rtt_backoff(struct rtt_state* rtt) {
+    rtt->rto_us = rtt_clamp(rtt->rto_us * 2);
+    rtt->backoff++;
+    log_event("RTO BACKOFF=%d RTO=%ldms", rtt->backoff, rtt->rto_us / 1000);
+}
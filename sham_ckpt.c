@@ -0,0 +1,170 @@
+#include "sham.h"
+
+// receiver checkpoints for --resume. the server hashes the output's prefix
+// as it is committed, one crc32c per CKPT_CHUNK, and every CKPT_INTERVAL
+// its disk writer syncs the file and saves the crcs beside it. a later
+// attempt at the same transfer reads the prefix back against them, and
+// offers the client the part that is intact; the client takes it only if
+// its own input hashes to the same chain of crcs.
+
+// <output>.ckpt: this header, one crc per committed chunk, then a crc of
+// everything before it
+struct ckpt_header {
+    char magic[8];
+    uint32_t id;
+    uint32_t chunk;
+    uint64_t file_size;
+    uint64_t committed;
+};
+
+static const char ckpt_magic[8] = "SHAMCKP1";
+
+int ckpt_init(struct sham_checkpoint* ck, const char* output, uint32_t id, uint64_t file_size) {
+    memset(ck, 0, sizeof(*ck));
+    snprintf(ck->path, sizeof(ck->path), "%s.ckpt", output);
+    ck->id = id;
+    ck->file_size = file_size;
+    ck->crcs = malloc((file_size / CKPT_CHUNK + 1) * sizeof(*ck->crcs));
+    if (!ck->crcs) {
+        perror("failed to allocate checkpoint");
+        return -1;
+    }
+    return 0;
+}
+
+void ckpt_free(struct sham_checkpoint* ck) {
+    free(ck->crcs);
+    ck->crcs = NULL;
+}
+
+static int read_all(int fd, void* buf, size_t len) {
+    return read(fd, buf, len) == (ssize_t)len ? 0 : -1;
+}
+
+// the committed bytes the saved checkpoint vouches for, with their crcs
+// loaded; 0 if there is none, or it belongs to another transfer
+uint64_t ckpt_load(struct sham_checkpoint* ck) {
+    struct ckpt_header h;
+    uint32_t sum;
+    int fd = open(ck->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    uint64_t committed = 0;
+    int valid = 0;
+    if (read_all(fd, &h, sizeof(h)) == 0 && memcmp(h.magic, ckpt_magic, sizeof(h.magic)) == 0 &&
+        h.id == ck->id && h.chunk == CKPT_CHUNK && h.file_size == ck->file_size &&
+        h.committed <= ck->file_size && h.committed % CKPT_CHUNK == 0) {
+        size_t len = h.committed / CKPT_CHUNK * sizeof(*ck->crcs);
+        if (read_all(fd, ck->crcs, len) == 0 && read_all(fd, &sum, sizeof(sum)) == 0 &&
+            crc32c(crc32c(0, &h, sizeof(h)), ck->crcs, len) == sum) {
+            committed = h.committed;
+            valid = 1;
+        }
+    }
+    close(fd);
+    if (!valid) log_event("CHECKPOINT %s IGNORED: not this transfer's", ck->path);
+    return committed;
+}
+
+// start hashing again at bytes, a chunk boundary whose crcs are in place
+void ckpt_rewind(struct sham_checkpoint* ck, uint64_t bytes) {
+    ck->count = (uint32_t)(bytes / CKPT_CHUNK);
+    ck->crc = 0;
+    ck->bytes = bytes;
+    ck->saved = bytes;
+}
+
+// hash the part of [offset, offset + len) just past what the crcs cover
+void ckpt_extend(struct sham_checkpoint* ck, uint64_t offset, const void* data, size_t len) {
+    if (!ck->crcs || offset > ck->bytes || offset + len <= ck->bytes) return;
+    const char* p = (const char*)data + (ck->bytes - offset);
+    size_t left = offset + len - ck->bytes;
+    while (left > 0) {
+        size_t room = CKPT_CHUNK - ck->bytes % CKPT_CHUNK;
+        size_t n = left < room ? left : room;
+        ck->crc = crc32c(ck->crc, p, n);
+        ck->bytes += n;
+        p += n;
+        left -= n;
+        if (ck->bytes % CKPT_CHUNK == 0) {
+            ck->crcs[ck->count++] = ck->crc;
+            ck->crc = 0;
+        }
+    }
+}
+
+// record that the first committed bytes are on disk; the caller has synced
+// them. written aside and renamed over, so a crash leaves the old one
+int ckpt_save(const struct sham_checkpoint* ck, uint64_t committed) {
+    char tmp[sizeof(ck->path) + 4];
+    struct ckpt_header h;
+    memcpy(h.magic, ckpt_magic, sizeof(h.magic));
+    h.id = ck->id;
+    h.chunk = CKPT_CHUNK;
+    h.file_size = ck->file_size;
+    h.committed = committed;
+    size_t len = committed / CKPT_CHUNK * sizeof(*ck->crcs);
+    uint32_t sum = crc32c(crc32c(0, &h, sizeof(h)), ck->crcs, len);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", ck->path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_event("CHECKPOINT %s FAILED: %s", tmp, strerror(errno));
+        return -1;
+    }
+    struct iovec iov[3] = {
+        { &h, sizeof(h) },
+        { ck->crcs, len },
+        { &sum, sizeof(sum) },
+    };
+    ssize_t total = sizeof(h) + len + sizeof(sum);
+    int ok = writev(fd, iov, 3) == total && fdatasync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp, ck->path) < 0) {
+        log_event("CHECKPOINT %s FAILED: %s", ck->path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    log_event("CHECKPOINT %s COMMITTED=%llu", ck->path, (unsigned long long)committed);
+    return 0;
+}
+
+// the transfer is over, one way or the other: nothing left to resume
+void ckpt_remove(const struct sham_checkpoint* ck) {
+    if (unlink(ck->path) < 0 && errno != ENOENT) perror("failed to remove checkpoint");
+}
+
+// hash the first len bytes of a file, a whole number of chunks: each
+// chunk's crc goes into chain, and then the chunk into digest (if any).
+// with expect, stops at the first chunk whose crc differs. returns the
+// bytes that passed
+uint64_t ckpt_scan(int fd, uint64_t len, const uint32_t* expect, uint32_t* chain, struct sham_digest* digest) {
+    char* buf = malloc(CKPT_CHUNK);
+    uint64_t done = 0;
+    *chain = 0;
+    if (!buf) {
+        perror("failed to allocate checkpoint scan");
+        return 0;
+    }
+    posix_fadvise(fd, 0, (off_t)len, POSIX_FADV_SEQUENTIAL);
+    while (done + CKPT_CHUNK <= len) {
+        size_t got = 0;
+        while (got < CKPT_CHUNK) {
+            ssize_t n = pread(fd, buf + got, CKPT_CHUNK - got, (off_t)(done + got));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            got += n;
+        }
+        if (got < CKPT_CHUNK) break;
+        uint32_t crc = crc32c(0, buf, CKPT_CHUNK);
+        if (expect && crc != expect[done / CKPT_CHUNK]) {
+            log_event("CHECKPOINT CHUNK AT %llu DIFFERS", (unsigned long long)done);
+            break;
+        }
+        *chain = crc32c(*chain, &crc, sizeof(crc));
+        if (digest) digest_extend(digest, done, buf, CKPT_CHUNK);
+        done += CKPT_CHUNK;
+    }
+    free(buf);
+    return done;
+}
@@ -0,0 +1,242 @@
+#include "sham.h"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// crc32c (castagnoli), as used by iscsi and ext4. with the crc32
+// instruction three independent streams hide its three-cycle latency and
+// are joined with zero-extension tables (mark adler's method); without
+// it, slicing-by-8 tables. packet_crc covers the header and the payload,
+// and travels as a trailer after the payload.
+
+#define CRC32C_POLY 0x82f63b78 // reflected
+#define CRC_LONG 2048          // stream length for large buffers, power of two
+#define CRC_SHORT 256          // and for the rest of a datagram
+
+static uint32_t crc_table[8][256];   // slicing-by-8
+static uint32_t crc_long[4][256];    // append CRC_LONG zero bytes
+static uint32_t crc_short[4][256];   // append CRC_SHORT zero bytes
+static uint32_t (*crc_impl)(uint32_t crc, const unsigned char* next, size_t len);
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+// ---- zero-extension operators over gf(2) ----
+
+static uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t* square, const uint32_t* mat) {
+    for (int n = 0; n < 32; n++) square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+// operator that appends len zero bytes (len a power of two) to a crc
+static void crc_zeros_op(uint32_t* even, size_t len) {
+    uint32_t odd[32];
+    uint32_t row = 1;
+
+    odd[0] = CRC32C_POLY; // one zero bit
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2_matrix_square(even, odd); // two zero bits
+    gf2_matrix_square(odd, even); // four
+
+    // the first square gives one zero byte in even, the next two in odd...
+    do {
+        gf2_matrix_square(even, odd);
+        len >>= 1;
+        if (len == 0) return;
+        gf2_matrix_square(odd, even);
+        len >>= 1;
+    } while (len);
+    memcpy(even, odd, sizeof(odd));
+}
+
+static void crc_zeros(uint32_t zeros[][256], size_t len) {
+    uint32_t op[32];
+    crc_zeros_op(op, len);
+    for (uint32_t n = 0; n < 256; n++) {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+static uint32_t crc_shift(uint32_t zeros[][256], uint32_t crc) {
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+           zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+// ---- portable: slicing-by-8 ----
+
+static uint32_t crc_sw(uint32_t crc, const unsigned char* next, size_t len) {
+    while (len && ((uintptr_t)next & 7)) {
+        crc = crc_table[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, next, 8);
+        word ^= crc;
+        crc = crc_table[7][word & 0xff] ^ crc_table[6][(word >> 8) & 0xff] ^
+              crc_table[5][(word >> 16) & 0xff] ^ crc_table[4][(word >> 24) & 0xff] ^
+              crc_table[3][(word >> 32) & 0xff] ^ crc_table[2][(word >> 40) & 0xff] ^
+              crc_table[1][(word >> 48) & 0xff] ^ crc_table[0][word >> 56];
+        next += 8;
+        len -= 8;
+    }
+#endif
+    while (len) {
+        crc = crc_table[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    return crc;
+}
+
+// ---- hardware: sse4.2 or armv8 crc ----
+
+#if defined(__x86_64__)
+#define CRC_TARGET __attribute__((target("sse4.2")))
+#define crc_u8(crc, p) _mm_crc32_u8((crc), *(p))
+#define crc_u64(crc, p) _mm_crc32_u64((crc), *(const uint64_t*)(p))
+#elif defined(__aarch64__)
+#define CRC_TARGET __attribute__((target("+crc")))
+#define crc_u8(crc, p) __crc32cb((crc), *(p))
+#define crc_u64(crc, p) __crc32cd((crc), *(const uint64_t*)(p))
+#endif
+
+#ifdef CRC_TARGET
+// three streams of block bytes each, joined by shifting the earlier ones
+CRC_TARGET static uint32_t crc_streams(uint32_t crc, const unsigned char** next, size_t* len,
+                                       size_t block, uint32_t zeros[][256]) {
+    uint64_t crc0 = crc;
+    while (*len >= block * 3) {
+        const unsigned char* p = *next;
+        const unsigned char* end = p + block;
+        uint64_t crc1 = 0, crc2 = 0;
+        do {
+            crc0 = crc_u64(crc0, p);
+            crc1 = crc_u64(crc1, p + block);
+            crc2 = crc_u64(crc2, p + block * 2);
+            p += 8;
+        } while (p < end);
+        crc0 = crc_shift(zeros, (uint32_t)crc0) ^ crc1;
+        crc0 = crc_shift(zeros, (uint32_t)crc0) ^ crc2;
+        *next += block * 3;
+        *len -= block * 3;
+    }
+    return (uint32_t)crc0;
+}
+
+CRC_TARGET static uint32_t crc_hw(uint32_t crc, const unsigned char* next, size_t len) {
+    while (len && ((uintptr_t)next & 7)) {
+        crc = crc_u8(crc, next);
+        next++;
+        len--;
+    }
+    crc = crc_streams(crc, &next, &len, CRC_LONG, crc_long);
+    crc = crc_streams(crc, &next, &len, CRC_SHORT, crc_short);
+
+    uint64_t crc0 = crc;
+    while (len >= 8) {
+        crc0 = crc_u64(crc0, next);
+        next += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc0;
+    while (len) {
+        crc = crc_u8(crc, next);
+        next++;
+        len--;
+    }
+    return crc;
+}
+#endif
+
+static int crc_hw_supported(void) {
+#if defined(__x86_64__)
+    return __builtin_cpu_supports("sse4.2");
+#elif defined(__aarch64__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return 0;
+#endif
+}
+
+static void crc_init(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = crc_table[0][n];
+        for (int k = 1; k < 8; k++) {
+            crc = crc_table[0][crc & 0xff] ^ (crc >> 8);
+            crc_table[k][n] = crc;
+        }
+    }
+
+    crc_impl = crc_sw;
+#ifdef CRC_TARGET
+    if (crc_hw_supported()) {
+        crc_zeros(crc_long, CRC_LONG);
+        crc_zeros(crc_short, CRC_SHORT);
+        crc_impl = crc_hw;
+    }
+#endif
+}
+
+// ---- public interface ----
+
+// extend crc over len more bytes; start from 0
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len) {
+    pthread_once(&crc_once, crc_init);
+    return ~crc_impl(~crc, buf, len);
+}
+
+const char* crc32c_impl(void) {
+    pthread_once(&crc_once, crc_init);
+    return crc_impl == crc_sw ? "slicing-by-8" : "hardware";
+}
+
+uint32_t packet_crc(const struct sham_header* header, const void* data, size_t len) {
+    return crc32c(crc32c(0, header, sizeof(*header)), data, len);
+}
+
+// write the trailer of a packet that carries CRC_FLAG; returns its length,
+// 0 for a packet without one
+int packet_seal(const struct sham_header* header, const void* data, size_t len, void* trailer) {
+    if (!(header->flags & CRC_FLAG)) return 0;
+    uint32_t crc = packet_crc(header, data, len);
+    memcpy(trailer, &crc, sizeof(crc));
+    return CRC_TRAILER;
+}
+
+// whether a received packet may be used: one with CRC_FLAG must match its
+// trailer, which is then taken off *len, and once crc is negotiated every
+// packet must carry it
+int packet_intact(const struct sham_packet* packet, int* len, int required) {
+    if (*len < (int)sizeof(packet->header)) return 0;
+    if (!(packet->header.flags & CRC_FLAG)) return !required;
+    if (*len < (int)sizeof(packet->header) + CRC_TRAILER) return 0;
+    size_t data_len = (size_t)*len - sizeof(packet->header) - CRC_TRAILER;
+    uint32_t crc;
+    memcpy(&crc, packet->data + data_len, sizeof(crc));
+    if (crc != packet_crc(&packet->header, packet->data, data_len)) return 0;
+    *len -= CRC_TRAILER;
+    return 1;
+}
@@ -0,0 +1,246 @@
+#include "sham.h"
+#include <math.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// forward error correction over GF(2^8). a block is k equal-size data
+// segments followed by up to FEC_MAX_PARITY repair segments; repair j is
+// sum_i coef(j, i) * data_i. the coefficients are a cauchy matrix with its
+// columns scaled so that row 0 is all ones: the first repair is plain xor
+// parity, and any e repairs rebuild any e missing segments (the code is
+// MDS). region multiplies use pshufb/tbl nibble lookups where available.
+
+#define GF_POLY 0x11d
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t fec_coefs[FEC_MAX_PARITY][FEC_MAX_K];
+static void (*gf_region)(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len);
+static pthread_once_t fec_once = PTHREAD_ONCE_INIT;
+
+static uint8_t gf_mul(uint8_t a, uint8_t b) {
+    if (a == 0 || b == 0) return 0;
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static uint8_t gf_inv(uint8_t a) {
+    return gf_exp[255 - gf_log[a]];
+}
+
+// ---- region multiply-accumulate: dst ^= c * src ----
+
+static void gf_region_xor(uint8_t* dst, const uint8_t* src, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < len; i++) dst[i] ^= src[i];
+}
+
+static void gf_region_scalar(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len) {
+    uint8_t row[256];
+    for (int x = 0; x < 256; x++) row[x] = gf_mul(c, (uint8_t)x);
+    for (size_t i = 0; i < len; i++) dst[i] ^= row[src[i]];
+}
+
+// c * x = c * (x & 0x0f) ^ c * (x & 0xf0): two 16-entry tables
+static void gf_nibble_tables(uint8_t c, uint8_t* lo, uint8_t* hi) {
+    for (int x = 0; x < 16; x++) {
+        lo[x] = gf_mul(c, (uint8_t)x);
+        hi[x] = gf_mul(c, (uint8_t)(x << 4));
+    }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("ssse3")))
+static void gf_region_ssse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len) {
+    uint8_t lo[16], hi[16];
+    gf_nibble_tables(c, lo, hi);
+    __m128i tlo = _mm_loadu_si128((const __m128i*)lo);
+    __m128i thi = _mm_loadu_si128((const __m128i*)hi);
+    __m128i mask = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i l = _mm_shuffle_epi8(tlo, _mm_and_si128(s, mask));
+        __m128i h = _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+    }
+    for (; i < len; i++) dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+}
+
+__attribute__((target("avx2")))
+static void gf_region_avx2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len) {
+    uint8_t lo[16], hi[16];
+    gf_nibble_tables(c, lo, hi);
+    __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)lo));
+    __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)hi));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i l = _mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask));
+        __m256i h = _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, _mm256_xor_si256(l, h)));
+    }
+    for (; i < len; i++) dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+}
+#elif defined(__aarch64__)
+static void gf_region_neon(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len) {
+    uint8_t lo[16], hi[16];
+    gf_nibble_tables(c, lo, hi);
+    uint8x16_t tlo = vld1q_u8(lo);
+    uint8x16_t thi = vld1q_u8(hi);
+    uint8x16_t mask = vdupq_n_u8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t s = vld1q_u8(src + i);
+        uint8x16_t l = vqtbl1q_u8(tlo, vandq_u8(s, mask));
+        uint8x16_t h = vqtbl1q_u8(thi, vshrq_n_u8(s, 4));
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), veorq_u8(l, h)));
+    }
+    for (; i < len; i++) dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+}
+#endif
+
+static void fec_setup(void) {
+    int x = 1;
+    for (int i = 0; i < 255; i++) {
+        gf_exp[i] = (uint8_t)x;
+        gf_log[x] = (uint8_t)i;
+        x <<= 1;
+        if (x & 0x100) x ^= GF_POLY;
+    }
+    for (int i = 255; i < 512; i++) gf_exp[i] = gf_exp[i - 255];
+
+    // cauchy 1 / (x_j + y_i) with x_j = FEC_MAX_K + j, y_i = i, column i
+    // scaled by x_0 + y_i
+    for (int j = 0; j < FEC_MAX_PARITY; j++) {
+        for (int i = 0; i < FEC_MAX_K; i++) {
+            uint8_t scale = (uint8_t)(FEC_MAX_K ^ i);
+            fec_coefs[j][i] = gf_mul(scale, gf_inv((uint8_t)((FEC_MAX_K + j) ^ i)));
+        }
+    }
+
+    gf_region = gf_region_scalar;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2"))
+        gf_region = gf_region_avx2;
+    else if (__builtin_cpu_supports("ssse3"))
+        gf_region = gf_region_ssse3;
+#elif defined(__aarch64__)
+    gf_region = gf_region_neon;
+#endif
+}
+
+// ---- public interface ----
+
+const char* fec_name(fec_mode_t mode) {
+    switch (mode) {
+    case FEC_XOR: return "xor";
+    case FEC_RS: return "rs";
+    default: return "none";
+    }
+}
+
+int fec_from_name(const char* name, fec_mode_t* mode) {
+    for (int m = FEC_NONE; m < FEC_MODE_COUNT; m++) {
+        if (strcmp(name, fec_name((fec_mode_t)m)) == 0) {
+            *mode = (fec_mode_t)m;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+uint8_t fec_coef(int row, int col) {
+    pthread_once(&fec_once, fec_setup);
+    return fec_coefs[row][col];
+}
+
+// dst ^= c * src over len bytes
+void fec_mul_add(void* dst, const void* src, uint8_t c, size_t len) {
+    pthread_once(&fec_once, fec_setup);
+    if (c == 0) return;
+    if (c == 1)
+        gf_region_xor(dst, src, len);
+    else
+        gf_region(dst, src, c, len);
+}
+
+// given syndromes syn[r] (repair row rows[r] minus every segment that did
+// arrive) for n missing segments cols[], rebuild them into out[]; the
+// n x n submatrix is inverted by gauss-jordan elimination
+int fec_solve(int n, const int* rows, const int* cols, uint8_t** syn, uint8_t** out, size_t len) {
+    uint8_t m[FEC_MAX_PARITY][FEC_MAX_PARITY];
+    uint8_t inv[FEC_MAX_PARITY][FEC_MAX_PARITY];
+    pthread_once(&fec_once, fec_setup);
+    if (n <= 0 || n > FEC_MAX_PARITY) return -1;
+
+    for (int r = 0; r < n; r++) {
+        for (int c = 0; c < n; c++) {
+            m[r][c] = fec_coefs[rows[r]][cols[c]];
+            inv[r][c] = r == c;
+        }
+    }
+    for (int c = 0; c < n; c++) {
+        int pivot = c;
+        while (pivot < n && m[pivot][c] == 0) pivot++;
+        if (pivot == n) return -1;
+        if (pivot != c) {
+            for (int k = 0; k < n; k++) {
+                uint8_t t = m[c][k]; m[c][k] = m[pivot][k]; m[pivot][k] = t;
+                t = inv[c][k]; inv[c][k] = inv[pivot][k]; inv[pivot][k] = t;
+            }
+        }
+        uint8_t scale = gf_inv(m[c][c]);
+        for (int k = 0; k < n; k++) {
+            m[c][k] = gf_mul(m[c][k], scale);
+            inv[c][k] = gf_mul(inv[c][k], scale);
+        }
+        for (int r = 0; r < n; r++) {
+            uint8_t f = m[r][c];
+            if (r == c || f == 0) continue;
+            for (int k = 0; k < n; k++) {
+                m[r][k] ^= gf_mul(f, m[c][k]);
+                inv[r][k] ^= gf_mul(f, inv[c][k]);
+            }
+        }
+    }
+
+    for (int c = 0; c < n; c++) {
+        memset(out[c], 0, len);
+        for (int r = 0; r < n; r++) fec_mul_add(out[c], syn[r], inv[c][r], len);
+    }
+    return 0;
+}
+
+// fewest repairs for a block of k that leave it unrecoverable (more than
+// that many of its k + r segments lost) with probability below
+// FEC_RESIDUAL, for independent losses at rate loss
+int fec_parity_for(double loss, int k, int max) {
+    if (loss <= 0) return 0;
+    if (loss > 0.5) loss = 0.5;
+    for (int r = 0; r < max; r++) {
+        int n = k + r;
+        double ok = 0, term = pow(1 - loss, n); // P(X = 0)
+        for (int x = 0; x <= r; x++) {
+            ok += term;
+            term *= (double)(n - x) / (x + 1) * loss / (1 - loss);
+        }
+        if (1 - ok < FEC_RESIDUAL) return r;
+    }
+    return max;
+}
@@ -0,0 +1,254 @@
+#include "sham.h"
+#include <pthread.h>
+
+// logging: rare control events are written as text straight away, while
+// per-packet events are appended as fixed-size binary records to a
+// lock-free ring owned by the calling thread. a background writer drains
+// every ring into <name>.bin, which logdump turns back into text.
+
+#define LOG_RING_SIZE 8192 // records per thread, power of two
+#define LOG_MAX_RINGS 64   // threads that can own a ring
+
+// single producer (the owning thread), single consumer (the writer)
+struct log_ring {
+    struct log_record records[LOG_RING_SIZE];
+    uint32_t head; // next slot the producer fills
+    uint32_t tail; // next slot the writer drains
+    unsigned long dropped;
+};
+
+// global variables for logging
+FILE* log_file = NULL;
+int verbose_logging = 0;
+
+static FILE* bin_file = NULL;
+static pthread_t writer_thread;
+static int writer_running = 0;
+static struct log_ring* rings[LOG_MAX_RINGS];
+static int ring_count = 0;
+static __thread struct log_ring* my_ring = NULL;
+static __thread int my_ring_failed = 0;
+
+static const char* event_names[] = {
+    [LOG_SND_DATA]   = "SND DATA",
+    [LOG_RETX_DATA]  = "RETX DATA",
+    [LOG_RCV_DATA]   = "RCV DATA",
+    [LOG_DROP_DATA]  = "DROP DATA",
+    [LOG_SND_ACK]    = "SND ACK",
+    [LOG_RCV_ACK]    = "RCV ACK",
+    [LOG_RTT_SAMPLE] = "RTT SAMPLE",
+};
+
+// render a record in the same layout log_text uses for its message part
+int log_record_format(const struct log_record* r, char* buf, size_t size) {
+    switch (r->event) {
+    case LOG_SND_DATA:
+    case LOG_RETX_DATA:
+    case LOG_RCV_DATA:
+        return snprintf(buf, size, "%s SEQ=%u LEN=%d", event_names[r->event], r->seq, r->len);
+    case LOG_DROP_DATA:
+        return snprintf(buf, size, "DROP DATA SEQ=%u", r->seq);
+    case LOG_SND_ACK:
+        return snprintf(buf, size, "SND ACK=%u WIN=%u SACK=%d", r->ack, r->arg, r->len);
+    case LOG_RCV_ACK:
+        return snprintf(buf, size, "RCV ACK=%u RWND=%u SACK=%d", r->ack, r->arg, r->len);
+    case LOG_RTT_SAMPLE:
+        return snprintf(buf, size, "RTT SAMPLE=%uus SRTT=%uus RTTVAR=%dus RTO=%ums",
+                        r->seq, r->ack, r->len, r->arg);
+    default:
+        return snprintf(buf, size, "UNKNOWN EVENT=%u", r->event);
+    }
+}
+
+// the timestamp prefix shared by text lines and decoded records
+void log_format_time(uint64_t wall_us, char* buf, size_t size) {
+    char time_buffer[30];
+    time_t curtime = wall_us / 1000000;
+    strftime(time_buffer, sizeof(time_buffer), "%Y-%m-%d %H:%M:%S", localtime(&curtime));
+    snprintf(buf, size, "[%s.%06ld] [LOG] ", time_buffer, (long)(wall_us % 1000000));
+}
+
+// move whatever each ring holds into the binary file; returns records written
+static int drain_rings(void) {
+    int written = 0;
+    int count = __atomic_load_n(&ring_count, __ATOMIC_ACQUIRE);
+    if (count > LOG_MAX_RINGS) count = LOG_MAX_RINGS;
+
+    for (int i = 0; i < count; i++) {
+        struct log_ring* ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (!ring) continue;
+
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = ring->tail;
+        while (tail != head) {
+            uint32_t idx = tail % LOG_RING_SIZE;
+            uint32_t n = head - tail;
+            if (n > LOG_RING_SIZE - idx) n = LOG_RING_SIZE - idx;
+            fwrite(&ring->records[idx], sizeof(struct log_record), n, bin_file);
+            tail += n;
+            written += n;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    return written;
+}
+
+static void* writer_main(void* arg) {
+    (void)arg;
+    struct timespec idle = { 0, 1000000 }; // 1 ms between empty polls
+    while (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+        if (drain_rings() == 0) {
+            fflush(bin_file);
+            nanosleep(&idle, NULL);
+        }
+    }
+    drain_rings();
+    return NULL;
+}
+
+// client_log.txt -> client_log.bin
+static void binary_log_name(const char* log_filename, char* buf, size_t size) {
+    snprintf(buf, size, "%s", log_filename);
+    char* dot = strrchr(buf, '.');
+    if (dot && strchr(dot, '/') == NULL) *dot = '\0';
+    strncat(buf, ".bin", size - strlen(buf) - 1);
+}
+
+static int start_binary_log(const char* log_filename) {
+    char name[512];
+    binary_log_name(log_filename, name, sizeof(name));
+    bin_file = fopen(name, "wb");
+    if (!bin_file) {
+        perror("failed to open binary log file");
+        return -1;
+    }
+
+    // anchor monotonic record times to the wall clock for the decoder
+    struct log_file_header header;
+    struct timeval tv;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+    gettimeofday(&tv, NULL);
+    header.mono_us = monotonic_us();
+    header.wall_us = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    fwrite(&header, sizeof(header), 1, bin_file);
+
+    writer_running = 1;
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        fprintf(stderr, "failed to start log writer\n");
+        writer_running = 0;
+        fclose(bin_file);
+        bin_file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// initialize logging system
+void init_logging(const char* log_filename) {
+    const char* log_env = getenv("RUDP_LOG");
+    if (log_env && strcmp(log_env, "1") == 0) {
+        verbose_logging = 1;
+        log_file = fopen(log_filename, "w");
+        if (!log_file) {
+            perror("failed to open log file");
+            exit(1);
+        }
+        // without a writer, records fall back to text in log_record
+        start_binary_log(log_filename);
+        atexit(cleanup_logging);
+    }
+}
+
+// log event with timestamp; called through the log_event macro
+void log_text(const char* format, ...) {
+    if (!log_file) return;
+
+    char prefix[64];
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    log_format_time((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec, prefix, sizeof(prefix));
+
+    // one line at a time when several threads log
+    flockfile(log_file);
+    fputs(prefix, log_file);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(log_file, format, args);
+    va_end(args);
+
+    fprintf(log_file, "\n");
+    fflush(log_file);
+    funlockfile(log_file);
+}
+
+static struct log_ring* claim_ring(void) {
+    if (my_ring_failed) return NULL;
+
+    int slot = __atomic_fetch_add(&ring_count, 1, __ATOMIC_ACQ_REL);
+    struct log_ring* ring = slot < LOG_MAX_RINGS ? calloc(1, sizeof(*ring)) : NULL;
+    if (!ring) {
+        my_ring_failed = 1;
+        return NULL;
+    }
+    __atomic_store_n(&rings[slot], ring, __ATOMIC_RELEASE);
+    my_ring = ring;
+    return ring;
+}
+
+// append a packet event to this thread's ring; never blocks, drops when full
+void log_record(uint16_t event, uint32_t seq, uint32_t ack, int32_t len, uint32_t arg) {
+    struct log_record r;
+    r.ts_us = monotonic_us();
+    r.seq = seq;
+    r.ack = ack;
+    r.len = len;
+    r.arg = arg;
+    r.event = event;
+    r.reserved = 0;
+    r.pad = 0;
+
+    struct log_ring* ring = my_ring ? my_ring : (bin_file ? claim_ring() : NULL);
+    if (!ring) {
+        char msg[128];
+        log_record_format(&r, msg, sizeof(msg));
+        log_text("%s", msg);
+        return;
+    }
+
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+    ring->records[head % LOG_RING_SIZE] = r;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// cleanup logging
+void cleanup_logging(void) {
+    if (writer_running) {
+        __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+        pthread_join(writer_thread, NULL);
+
+        unsigned long dropped = 0;
+        for (int i = 0; i < LOG_MAX_RINGS && i < ring_count; i++) {
+            if (!rings[i]) continue;
+            dropped += rings[i]->dropped;
+            free(rings[i]);
+            rings[i] = NULL;
+        }
+        if (dropped > 0) log_text("LOG DROPPED=%lu", dropped);
+        ring_count = 0;
+        my_ring = NULL;
+    }
+    if (bin_file) {
+        fclose(bin_file);
+        bin_file = NULL;
+    }
+    if (log_file) {
+        fclose(log_file);
+        log_file = NULL;
+    }
+}
@@ -0,0 +1,279 @@
+#include "sham.h"
+#include <sched.h>
+
+// pipelined sender: a reader thread keeps the input ahead of the sender
+// in a byte ring, digesting it on the way; the sender's event loop owns
+// the scoreboard, processes acks and fills batches; a transmitter thread
+// flushes them. each stage hands work to the next through single-producer
+// single-consumer rings, so disk reads, hashing and sendmmsg run beside
+// ack processing instead of in front of it.
+
+#define PIPE_SPIN 1024 // empty polls before the transmitter sleeps
+
+// ---- spsc queue ----
+
+int spsc_init(struct spsc_queue* q, uint32_t size) {
+    memset(q, 0, sizeof(*q));
+    q->size = size;
+    q->slots = calloc(size, sizeof(*q->slots));
+    return q->slots ? 0 : -1;
+}
+
+void spsc_free(struct spsc_queue* q) {
+    free(q->slots);
+    q->slots = NULL;
+}
+
+// producer side; -1 when full
+int spsc_push(struct spsc_queue* q, void* item) {
+    uint32_t head = q->head;
+    if (head - q->tail_seen == q->size) {
+        q->tail_seen = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        if (head - q->tail_seen == q->size) return -1;
+    }
+    q->slots[head & (q->size - 1)] = item;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// consumer side; NULL when empty
+void* spsc_pop(struct spsc_queue* q) {
+    uint32_t tail = q->tail;
+    if (tail == q->head_seen) {
+        q->head_seen = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        if (tail == q->head_seen) return NULL;
+    }
+    void* item = q->slots[tail & (q->size - 1)];
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+// ---- reader ----
+
+static void* reader_main(void* arg) {
+    struct read_ahead* ra = arg;
+    struct timespec pause = { 0, 50000 };
+    uint64_t filled = ra->filled;
+
+    while (filled < ra->size && __atomic_load_n(&ra->running, __ATOMIC_ACQUIRE)) {
+        uint64_t want = ra->size - filled < PIPE_READ_CHUNK ? ra->size - filled : PIPE_READ_CHUNK;
+        uint64_t used = filled - __atomic_load_n(&ra->consumed, __ATOMIC_ACQUIRE);
+        if (ra->capacity - used < want) {
+            ra->full_waits++;
+            nanosleep(&pause, NULL);
+            continue;
+        }
+
+        uint32_t pos = filled % ra->capacity;
+        size_t len = ra->capacity - pos < want ? ra->capacity - pos : want;
+        ssize_t n = pread(ra->fd, ra->data + pos, len, (off_t)filled);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            log_event("READ AHEAD FAILED OFFSET=%llu errno=%d", (unsigned long long)filled, n < 0 ? errno : 0);
+            __atomic_store_n(&ra->failed, 1, __ATOMIC_RELEASE);
+            break;
+        }
+        digest_extend(ra->digest, filled, ra->data + pos, n);
+        ra->reads++;
+        filled += n;
+        __atomic_store_n(&ra->filled, filled, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// read [start, size) of the file; a resumed transfer starts past what the
+// server already holds
+int read_ahead_start(struct read_ahead* ra, const char* filename, uint64_t start, uint64_t size,
+                     struct sham_digest* digest) {
+    memset(ra, 0, sizeof(*ra));
+    ra->filled = start;
+    ra->consumed = start;
+    ra->size = size;
+    ra->digest = digest;
+    ra->capacity = PIPE_READ_AHEAD;
+    ra->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (ra->fd < 0) {
+        fprintf(stderr, "failed to open input file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+    posix_fadvise(ra->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    ra->data = malloc(ra->capacity);
+    if (!ra->data) {
+        perror("failed to allocate read-ahead ring");
+        close(ra->fd);
+        return -1;
+    }
+
+    ra->running = 1;
+    if (pthread_create(&ra->thread, NULL, reader_main, ra) != 0) {
+        fprintf(stderr, "failed to start reader thread\n");
+        free(ra->data);
+        close(ra->fd);
+        return -1;
+    }
+    return 0;
+}
+
+// copy [offset, offset + len) of the file out of the ring and release
+// everything before it. returns 0 for an offset the ring has already
+// released (a segment cut again after an mss change), which the caller
+// reads from the file itself, and -1 if the reader failed
+int read_ahead_take(struct read_ahead* ra, uint64_t offset, char* dst, uint32_t len) {
+    if (offset < ra->consumed) return 0;
+    if (__atomic_load_n(&ra->filled, __ATOMIC_ACQUIRE) < offset + len) {
+        ra->empty_waits++;
+        while (__atomic_load_n(&ra->filled, __ATOMIC_ACQUIRE) < offset + len) {
+            if (__atomic_load_n(&ra->failed, __ATOMIC_ACQUIRE)) return -1;
+            sched_yield();
+        }
+    }
+
+    uint32_t pos = offset % ra->capacity;
+    uint32_t first = ra->capacity - pos < len ? ra->capacity - pos : len;
+    memcpy(dst, ra->data + pos, first);
+    memcpy(dst + first, ra->data, len - first);
+    __atomic_store_n(&ra->consumed, offset + len, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// stops the reader if it is still going; the digest is the caller's again
+void read_ahead_stop(struct read_ahead* ra) {
+    if (!ra->data) return;
+    __atomic_store_n(&ra->running, 0, __ATOMIC_RELEASE);
+    pthread_join(ra->thread, NULL);
+    log_event("READ AHEAD READS=%lu FULL=%lu EMPTY=%lu", ra->reads, ra->full_waits, ra->empty_waits);
+    free(ra->data);
+    close(ra->fd);
+    ra->data = NULL;
+}
+
+// ---- transmitter ----
+
+// wake the transmitter if it went to sleep on an empty queue
+static void tx_kick(struct tx_stage* tx) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // the push before against the idle flag
+    if (__atomic_load_n(&tx->idle, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&tx->lock);
+        pthread_cond_signal(&tx->wake);
+        pthread_mutex_unlock(&tx->lock);
+    }
+}
+
+// poll for a while, then sleep until tx_kick
+static void tx_sleep(struct tx_stage* tx) {
+    pthread_mutex_lock(&tx->lock);
+    __atomic_store_n(&tx->idle, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&tx->full.head, __ATOMIC_ACQUIRE) == tx->full.tail &&
+        __atomic_load_n(&tx->running, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&tx->wake, &tx->lock);
+    __atomic_store_n(&tx->idle, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&tx->lock);
+}
+
+static void* tx_main(void* arg) {
+    struct tx_stage* tx = arg;
+    int polls = 0;
+
+    while (1) {
+        int running = __atomic_load_n(&tx->running, __ATOMIC_ACQUIRE);
+        struct send_batch* b = spsc_pop(&tx->full);
+        if (b) {
+            if (batch_flush(b) < 0) __atomic_store_n(&tx->failed, 1, __ATOMIC_RELEASE);
+            spsc_push(&tx->empty, b); // never full: it has room for every batch
+            polls = 0;
+            continue;
+        }
+        if (!running) break;
+        if (++polls < PIPE_SPIN) {
+            sched_yield();
+        } else {
+            tx_sleep(tx);
+            polls = 0;
+        }
+    }
+    return NULL;
+}
+
+static void tx_stage_free(struct tx_stage* tx) {
+    for (int i = 0; i < tx->count; i++) batch_free(&tx->batches[i]);
+    free(tx->batches);
+    spsc_free(&tx->full);
+    spsc_free(&tx->empty);
+    pthread_mutex_destroy(&tx->lock);
+    pthread_cond_destroy(&tx->wake);
+    tx->batches = NULL;
+}
+
+int tx_stage_start(struct tx_stage* tx, int sockfd, struct sockaddr_in* addr, int max, int mss,
+                   int use_gso, int use_uring) {
+    memset(tx, 0, sizeof(*tx));
+    pthread_mutex_init(&tx->lock, NULL);
+    pthread_cond_init(&tx->wake, NULL);
+    tx->batches = calloc(PIPE_BATCHES, sizeof(*tx->batches));
+    if (!tx->batches || spsc_init(&tx->full, PIPE_BATCHES) < 0 || spsc_init(&tx->empty, PIPE_BATCHES) < 0) {
+        perror("failed to allocate transmitter");
+        tx_stage_free(tx);
+        return -1;
+    }
+    for (; tx->count < PIPE_BATCHES; tx->count++) {
+        if (batch_init(&tx->batches[tx->count], sockfd, addr, max, mss, use_gso, use_uring) < 0) {
+            tx_stage_free(tx);
+            return -1;
+        }
+        spsc_push(&tx->empty, &tx->batches[tx->count]);
+    }
+
+    tx->running = 1;
+    if (pthread_create(&tx->thread, NULL, tx_main, tx) != 0) {
+        fprintf(stderr, "failed to start transmitter thread\n");
+        tx_stage_free(tx);
+        return -1;
+    }
+    return 0;
+}
+
+// hand a filled batch (or NULL) to the transmitter and get an empty one;
+// NULL once a flush has failed
+struct send_batch* tx_stage_swap(struct tx_stage* tx, struct send_batch* filled) {
+    if (__atomic_load_n(&tx->failed, __ATOMIC_ACQUIRE)) return NULL;
+    if (filled) {
+        if (filled->count == 0) return filled;
+        spsc_push(&tx->full, filled);
+        tx_kick(tx);
+    }
+
+    struct send_batch* b = spsc_pop(&tx->empty);
+    if (!b) {
+        tx->waits++;
+        while (!(b = spsc_pop(&tx->empty))) {
+            if (__atomic_load_n(&tx->failed, __ATOMIC_ACQUIRE)) return NULL;
+            sched_yield();
+        }
+    }
+    return b;
+}
+
+// send what current still holds, stop the transmitter and free the
+// batches; -1 if any flush failed
+int tx_stage_stop(struct tx_stage* tx, struct send_batch* current) {
+    if (!tx->batches) return 0;
+    if (current && current->count > 0) spsc_push(&tx->full, current);
+    pthread_mutex_lock(&tx->lock);
+    __atomic_store_n(&tx->running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&tx->wake);
+    pthread_mutex_unlock(&tx->lock);
+    pthread_join(tx->thread, NULL);
+
+    unsigned long datagrams = 0, syscalls = 0;
+    for (int i = 0; i < tx->count; i++) {
+        datagrams += tx->batches[i].datagrams;
+        syscalls += tx->batches[i].syscalls;
+    }
+    log_event("BATCH DATAGRAMS=%lu SYSCALLS=%lu GSO=%d BATCHES=%d WAITS=%lu", datagrams, syscalls,
+              tx->batches[0].gso, tx->count, tx->waits);
+
+    int failed = __atomic_load_n(&tx->failed, __ATOMIC_ACQUIRE);
+    tx_stage_free(tx);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,126 @@
+#include "sham.h"
+
+// timers: a binary min-heap of armed timers keyed by monotonic deadline.
+// each timer remembers its heap slot so arm/cancel are O(log n) and the
+// event loop only ever looks at the root to know how long to sleep.
+
+uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void heap_place(struct timer_heap* h, int i, struct sham_timer* t) {
+    h->items[i] = t;
+    t->heap_idx = i;
+}
+
+static void heap_sift_up(struct timer_heap* h, int i) {
+    struct sham_timer* t = h->items[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (h->items[parent]->deadline_us <= t->deadline_us) break;
+        heap_place(h, i, h->items[parent]);
+        i = parent;
+    }
+    heap_place(h, i, t);
+}
+
+static void heap_sift_down(struct timer_heap* h, int i) {
+    struct sham_timer* t = h->items[i];
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= h->count) break;
+        if (child + 1 < h->count &&
+            h->items[child + 1]->deadline_us < h->items[child]->deadline_us) {
+            child++;
+        }
+        if (t->deadline_us <= h->items[child]->deadline_us) break;
+        heap_place(h, i, h->items[child]);
+        i = child;
+    }
+    heap_place(h, i, t);
+}
+
+void timer_init(struct sham_timer* t, timer_cb cb, void* arg) {
+    t->deadline_us = 0;
+    t->cb = cb;
+    t->arg = arg;
+    t->heap_idx = -1;
+}
+
+int timer_armed(const struct sham_timer* t) {
+    return t->heap_idx >= 0;
+}
+
+// arm (or re-arm) a timer for an absolute monotonic deadline
+int timer_arm(struct timer_heap* h, struct sham_timer* t, uint64_t deadline_us) {
+    if (timer_armed(t)) {
+        uint64_t old = t->deadline_us;
+        t->deadline_us = deadline_us;
+        if (deadline_us < old) {
+            heap_sift_up(h, t->heap_idx);
+        } else {
+            heap_sift_down(h, t->heap_idx);
+        }
+        return 0;
+    }
+
+    if (h->count == h->cap) {
+        int cap = h->cap ? h->cap * 2 : 8;
+        struct sham_timer** items = realloc(h->items, cap * sizeof(*items));
+        if (!items) {
+            perror("failed to grow timer heap");
+            return -1;
+        }
+        h->items = items;
+        h->cap = cap;
+    }
+
+    t->deadline_us = deadline_us;
+    heap_place(h, h->count++, t);
+    heap_sift_up(h, t->heap_idx);
+    return 0;
+}
+
+void timer_cancel(struct timer_heap* h, struct sham_timer* t) {
+    if (!timer_armed(t)) return;
+
+    int i = t->heap_idx;
+    struct sham_timer* last = h->items[--h->count];
+    t->heap_idx = -1;
+    if (last == t) return;
+
+    heap_place(h, i, last);
+    heap_sift_down(h, i);
+    heap_sift_up(h, last->heap_idx);
+}
+
+// microseconds until the earliest deadline, 0 if overdue, -1 if none armed
+long timers_next_wait_us(const struct timer_heap* h, uint64_t now) {
+    if (h->count == 0) return -1;
+    uint64_t deadline = h->items[0]->deadline_us;
+    return deadline > now ? (long)(deadline - now) : 0;
+}
+
+// fire every timer whose deadline has passed; returns how many fired
+int timers_run(struct timer_heap* h, uint64_t now) {
+    int fired = 0;
+    while (h->count > 0 && h->items[0]->deadline_us <= now) {
+        struct sham_timer* t = h->items[0];
+        timer_cancel(h, t);
+        t->cb(t->arg);
+        fired++;
+    }
+    return fired;
+}
+
+void timers_free(struct timer_heap* h) {
+    for (int i = 0; i < h->count; i++) {
+        h->items[i]->heap_idx = -1;
+    }
+    free(h->items);
+    h->items = NULL;
+    h->count = 0;
+    h->cap = 0;
+}
@@ -0,0 +1,325 @@
+#include "sham.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+// io_uring transport, driven with raw syscalls (no liburing). sends queue
+// one linked SENDMSG per datagram or GSO run and submit a whole window with
+// a single io_uring_enter; receives keep one multishot RECVMSG armed that
+// fills buffers from a provided buffer ring, so reaping datagrams costs no
+// syscall at all. the socket is a registered (fixed) file for both.
+
+#define URING_BGID 0 // our only provided buffer group
+
+static int uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// every opcode we issue must be known to this kernel
+static int uring_probe(struct uring* u) {
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, len);
+    if (!probe) return -1;
+
+    int ok = uring_register(u->fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+             probe->last_op >= IORING_OP_RECVMSG &&
+             (probe->ops[IORING_OP_SENDMSG].flags & IO_URING_OP_SUPPORTED) &&
+             (probe->ops[IORING_OP_RECVMSG].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!ok) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    return 0;
+}
+
+int uring_init(struct uring* u, unsigned entries, unsigned cq_entries, int sockfd) {
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries > 2 * entries ? cq_entries : 2 * entries;
+    u->fd = uring_setup(entries, &p);
+    if (u->fd < 0) {
+        log_event("URING SETUP FAILED errno=%d", errno);
+        return -1;
+    }
+
+    // map the rings separately; older kernels have no single mmap
+    u->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sq_ring = mmap(NULL, u->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->fd, IORING_OFF_SQ_RING);
+    u->cq_ring = mmap(NULL, u->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+        log_event("URING MMAP FAILED errno=%d", errno);
+        uring_free(u);
+        return -1;
+    }
+
+    char* sq = u->sq_ring;
+    char* cq = u->cq_ring;
+    u->sq_head = (unsigned*)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    u->sq_local_tail = *u->sq_tail;
+
+    if (uring_probe(u) < 0) {
+        log_event("URING OPCODES UNSUPPORTED");
+        uring_free(u);
+        return -1;
+    }
+
+    // fixed file 0: skips the fd table lookup on every request
+    if (uring_register(u->fd, IORING_REGISTER_FILES, &sockfd, 1) < 0) {
+        log_event("URING REGISTER FILES FAILED errno=%d", errno);
+        uring_free(u);
+        return -1;
+    }
+    return 0;
+}
+
+void uring_free(struct uring* u) {
+    if (u->br) munmap(u->br, u->br_len);
+    free(u->bufs);
+    free(u->held);
+    if (u->sqes && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_len);
+    if (u->cq_ring && u->cq_ring != MAP_FAILED) munmap(u->cq_ring, u->cq_ring_len);
+    if (u->sq_ring && u->sq_ring != MAP_FAILED) munmap(u->sq_ring, u->sq_ring_len);
+    if (u->fd >= 0) close(u->fd);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+static struct io_uring_sqe* uring_get_sqe(struct uring* u) {
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (u->sq_local_tail - head >= u->sq_entries) return NULL;
+
+    unsigned idx = u->sq_local_tail & u->sq_mask;
+    struct io_uring_sqe* sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    u->sq_local_tail++;
+    u->queued++;
+    return sqe;
+}
+
+static unsigned uring_cq_ready(const struct uring* u) {
+    return __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) - *u->cq_head;
+}
+
+static struct io_uring_cqe* uring_peek_cqe(struct uring* u) {
+    if (uring_cq_ready(u) == 0) return NULL;
+    return &u->cqes[*u->cq_head & u->cq_mask];
+}
+
+static void uring_cqe_seen(struct uring* u) {
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// hand the queued sqes to the kernel and wait for want completions
+static int uring_submit_wait(struct uring* u, unsigned want) {
+    __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+    while (u->queued > 0 || uring_cq_ready(u) < want) {
+        unsigned ready = uring_cq_ready(u);
+        unsigned wait = ready < want ? want - ready : 0;
+        int r = uring_enter(u->fd, u->queued, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+        u->enters++;
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        u->queued -= r;
+    }
+    return 0;
+}
+
+// ---- send: one linked SENDMSG per message, one syscall per call ----
+
+// send up to sq_entries messages in order with sendmsg flags; like
+// sendmmsg, returns how many went out before the first failure, or -1 with
+// errno if the first failed
+int uring_sendmsgs(struct uring* u, struct mmsghdr* msgs, int n, int flags) {
+    if (n > (int)u->sq_entries) n = u->sq_entries;
+
+    for (int i = 0; i < n; i++) {
+        struct io_uring_sqe* sqe = uring_get_sqe(u);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = 0; // fixed file index
+        sqe->flags = IOSQE_FIXED_FILE | (i + 1 < n ? IOSQE_IO_LINK : 0);
+        sqe->addr = (uint64_t)(uintptr_t)&msgs[i].msg_hdr;
+        sqe->len = 1;
+        sqe->msg_flags = flags;
+        sqe->user_data = i;
+    }
+
+    // the link keeps datagrams in order when the socket buffer fills
+    if (uring_submit_wait(u, n) < 0) return -1;
+
+    int sent = 0, err = 0;
+    for (int i = 0; i < n; i++) {
+        struct io_uring_cqe* cqe = uring_peek_cqe(u);
+        if (cqe->res >= 0) {
+            msgs[cqe->user_data].msg_len = cqe->res;
+            if (!err) sent++;
+        } else if (!err) {
+            err = -cqe->res; // later links come back -ECANCELED
+        }
+        uring_cqe_seen(u);
+    }
+
+    if (sent == 0 && err) {
+        errno = err;
+        return -1;
+    }
+    return sent;
+}
+
+// ---- receive: multishot RECVMSG into a provided buffer ring ----
+
+static void uring_buf_add(struct uring* u, unsigned bid, unsigned offset) {
+    struct io_uring_buf* buf = &u->br->bufs[(u->br_tail + offset) & (u->nbufs - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * u->buf_size);
+    buf->len = u->buf_size;
+    buf->bid = bid;
+}
+
+static void uring_buf_publish(struct uring* u, unsigned count) {
+    u->br_tail += count;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_recv_arm(struct uring* u) {
+    struct io_uring_sqe* sqe = uring_get_sqe(u);
+    if (!sqe) {
+        errno = EBUSY;
+        return -1;
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = 0; // fixed file index
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->addr = (uint64_t)(uintptr_t)&u->recv_msg;
+    sqe->len = 1;
+    sqe->buf_group = URING_BGID;
+    if (uring_submit_wait(u, 0) < 0) return -1;
+    u->recv_armed = 1;
+    return 0;
+}
+
+// register nbufs (power of two) receive buffers of buf_size bytes and arm
+// the multishot receive; each buffer starts with io_uring_recvmsg_out, then
+// the peer address, control_len bytes of cmsgs, and the datagram
+int uring_recv_start(struct uring* u, unsigned nbufs, unsigned buf_size, unsigned control_len) {
+    u->nbufs = nbufs;
+    u->buf_size = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) +
+                  control_len + buf_size;
+    u->br_len = nbufs * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->bufs = malloc((size_t)nbufs * u->buf_size);
+    u->held = calloc(nbufs, sizeof(*u->held));
+    if (u->br == MAP_FAILED || !u->bufs || !u->held) {
+        if (u->br == MAP_FAILED) u->br = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = nbufs;
+    reg.bgid = URING_BGID;
+    if (uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        log_event("URING PBUF RING UNSUPPORTED errno=%d", errno);
+        return -1;
+    }
+    for (unsigned i = 0; i < nbufs; i++) uring_buf_add(u, i, i);
+    uring_buf_publish(u, nbufs);
+
+    memset(&u->recv_msg, 0, sizeof(u->recv_msg));
+    u->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+    u->recv_msg.msg_controllen = control_len;
+    if (uring_recv_arm(u) < 0) return -1;
+
+    // a kernel without multishot recvmsg rejects the request right away
+    struct io_uring_cqe* cqe = uring_peek_cqe(u);
+    if (cqe && cqe->res < 0 && !(cqe->flags & IORING_CQE_F_MORE)) {
+        log_event("URING MULTISHOT RECVMSG UNSUPPORTED res=%d", cqe->res);
+        errno = -cqe->res;
+        uring_cqe_seen(u);
+        return -1;
+    }
+    return 0;
+}
+
+// datagrams that completed since the last call, at most rb->max of them,
+// laid out in rb like a recvmmsg result; 0 when none are ready. buffers
+// handed out by the previous call go back to the kernel first
+int uring_recv_batch(struct uring* u, struct recv_batch* rb) {
+    for (int i = 0; i < u->nheld; i++) uring_buf_add(u, u->held[i], i);
+    uring_buf_publish(u, u->nheld);
+    u->nheld = 0;
+
+    size_t name_off = sizeof(struct io_uring_recvmsg_out);
+    size_t control_off = name_off + u->recv_msg.msg_namelen;
+    size_t payload_off = control_off + u->recv_msg.msg_controllen;
+
+    int n = 0;
+    struct io_uring_cqe* cqe;
+    while (n < rb->max && (cqe = uring_peek_cqe(u)) != NULL) {
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        uring_cqe_seen(u);
+        if (!(flags & IORING_CQE_F_MORE)) u->recv_armed = 0;
+
+        if (res < 0) {
+            // out of buffers: re-armed below once they are recycled
+            if (res == -ENOBUFS) continue;
+            errno = -res;
+            return -1;
+        }
+        if (!(flags & IORING_CQE_F_BUFFER)) continue;
+
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        char* buf = u->bufs + (size_t)bid * u->buf_size;
+        struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buf;
+        u->held[u->nheld++] = bid;
+
+        size_t room = u->buf_size - payload_off;
+        size_t len = out->payloadlen < room ? out->payloadlen : room;
+        memcpy(&rb->addrs[n], buf + name_off, sizeof(rb->addrs[n]));
+        rb->iov[n].iov_base = buf + payload_off;
+        rb->iov[n].iov_len = len;
+        rb->msgs[n].msg_len = len;
+
+        struct msghdr* h = &rb->msgs[n].msg_hdr;
+        memset(h, 0, sizeof(*h));
+        h->msg_control = out->controllen ? buf + control_off : NULL;
+        h->msg_controllen = out->controllen;
+        n++;
+    }
+
+    // the ring holds more buffers than one batch, so the new request
+    // always has some to fill even before this batch is recycled
+    if (!u->recv_armed && uring_recv_arm(u) < 0) return -1;
+    return n;
+}
@@ -1,56 +1,8 @@
 #include "sham.h"
 #include <openssl/evp.h>
-
-// global variables for logging
-FILE* log_file = NULL;
-int verbose_logging = 0;
-
-// initialize logging system
-void init_logging(const char* log_filename) {
-    const char* log_env = getenv("RUDP_LOG");
-    if (log_env && strcmp(log_env, "1") == 0) {
-        verbose_logging = 1;
-        log_file = fopen(log_filename, "w");
-        if (!log_file) {
-            perror("failed to open log file");
-            exit(1);
-        }
-    }
-}
-
-// log event with timestamp
-void log_event(const char* format, ...) {
-    if (!verbose_logging || !log_file) return;
-    
-    char time_buffer[30];
-    struct timeval tv;
-    time_t curtime;
-    
-    gettimeofday(&tv, NULL);
-    curtime = tv.tv_sec;
-    
-    // format the time part
-    strftime(time_buffer, 30, "%Y-%m-%d %H:%M:%S", localtime(&curtime));
-    
-    // add microseconds and print to log file
-    fprintf(log_file, "[%s.%06ld] [LOG] ", time_buffer, tv.tv_usec);
-    
-    va_list args;
-    va_start(args, format);
-    vfprintf(log_file, format, args);
-    va_end(args);
-    
-    fprintf(log_file, "\n");
-    fflush(log_file);
-}
-
-// cleanup logging
-void cleanup_logging(void) {
-    if (log_file) {
-        fclose(log_file);
-        log_file = NULL;
-    }
-}
+#include <linux/filter.h>
+#include <linux/errqueue.h>
+#include <poll.h>
 
 // create socket
 int create_socket(int port) {
@@ -76,10 +28,69 @@ int create_socket(int port) {
     return sockfd;
 }
 
+// open count sockets bound to the same port with SO_REUSEPORT. the kernel
+// spreads peers over them by 4-tuple hash; with steer set, a classic BPF
+// program picks the socket from the source address instead, so a peer
+// always lands on the same socket no matter how the group was built
+int create_reuseport_sockets(int port, int count, int* fds, int steer) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    for (int i = 0; i < count; i++) {
+        int one = 1;
+        fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fds[i] < 0) {
+            perror("socket creation failed");
+            exit(1);
+        }
+        if (setsockopt(fds[i], SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+            perror("SO_REUSEPORT failed");
+            exit(1);
+        }
+        if (bind(fds[i], (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("bind failed");
+            exit(1);
+        }
+    }
+
+    if (steer && count > 1) {
+        // index = ((saddr ^ sport) * golden) >> 16 % count; the filter sees
+        // the udp payload, so headers are reached through SKF_NET_OFF
+        struct sock_filter code[] = {
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12), // ip saddr
+            BPF_STMT(BPF_MISC | BPF_TAX, 0),
+            BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_NET_OFF + 20), // udp sport, no ip options
+            BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+            BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1),
+            BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)count),
+            BPF_STMT(BPF_RET | BPF_A, 0),
+        };
+        struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+        if (setsockopt(fds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+            // the group still works, just with the kernel's own hash
+            log_event("REUSEPORT CBPF UNAVAILABLE errno=%d", errno);
+            return 0;
+        }
+        log_event("REUSEPORT CBPF ATTACHED SOCKETS=%d", count);
+    }
+    return 0;
+}
+
 // send packet
 int send_packet(int sockfd, struct sockaddr_in* addr, struct sham_packet* packet, int data_len) {
-    int total_len = sizeof(struct sham_header) + data_len;
-    int bytes_sent = sendto(sockfd, packet, total_len, 0, 
+    return send_datagram(sockfd, addr, &packet->header, data_len);
+}
+
+// send a datagram built in place: data_len payload bytes right behind the
+// header, and room for the crc trailer behind them
+int send_datagram(int sockfd, struct sockaddr_in* addr, struct sham_header* header, int data_len) {
+    char* data = (char*)(header + 1);
+    int total_len = sizeof(struct sham_header) + data_len + packet_seal(header, data, data_len, data + data_len);
+    int bytes_sent = sendto(sockfd, header, total_len, 0,
                            (struct sockaddr*)addr, sizeof(*addr));
     if (bytes_sent < 0) {
         perror("sendto failed");
@@ -108,6 +119,63 @@ int simulate_packet_loss(float loss_rate) {
     return random_val < loss_rate;
 }
 
+// probe: set DF on everything the socket sends and ignore the kernel's path
+// mtu cache, so oversized probes are dropped on the path instead of being
+// fragmented (RFC 8899 packetization layer path mtu discovery). otherwise
+// clear DF, so segments larger than the path are fragmented, not lost
+int set_path_mtu_mode(int sockfd, int probe) {
+    int val = probe ? IP_PMTUDISC_PROBE : IP_PMTUDISC_DONT;
+    if (setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &val, sizeof(val)) < 0) {
+        log_event("PMTU MODE UNAVAILABLE errno=%d", errno);
+        return -1;
+    }
+    return 0;
+}
+
+// values assumed for a peer whose SYN carries no options
+void syn_options_default(struct sham_syn_options* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->ack_freq = 1;
+    opts->ack_delay_ms = 0;
+    opts->mss = BASE_MSS;
+}
+
+// smallest shift that lets buffer_bytes fit the 16-bit window_size field
+uint8_t window_scale_for(uint32_t buffer_bytes) {
+    uint8_t shift = 0;
+    while ((buffer_bytes >> shift) > 0xFFFF && shift < 14) shift++;
+    return shift;
+}
+
+// read handshake options from a SYN or SYN-ACK; fields the peer did not
+// send keep their defaults. returns 1 if any options were present
+int syn_options_parse(const struct sham_packet* packet, int bytes_recv,
+                      struct sham_syn_options* opts) {
+    syn_options_default(opts);
+    int len = bytes_recv - (int)sizeof(struct sham_header); // any crc trailer is gone by now
+    if (len <= 0) return 0;
+    if (len > (int)sizeof(*opts)) len = sizeof(*opts);
+    memcpy(opts, packet->data, len);
+    if (opts->ack_freq == 0) opts->ack_freq = 1;
+    if (opts->mss == 0) opts->mss = BASE_MSS;
+    if (opts->mss > MAX_DATA_SIZE) opts->mss = MAX_DATA_SIZE;
+    if (opts->digest >= DIGEST_COUNT) opts->digest = DIGEST_MD5;
+    if (opts->fec >= FEC_MODE_COUNT || opts->fec_k == 0 || opts->fec_k > FEC_MAX_K) opts->fec = FEC_NONE;
+    if (opts->fec_parity > FEC_MAX_PARITY) opts->fec_parity = FEC_MAX_PARITY;
+    if (opts->fec == FEC_XOR) opts->fec_parity = 1;
+    if (opts->fec_parity == 0) opts->fec = FEC_NONE;
+    if (opts->stripe_flows == 0 || opts->stripe_flows > MAX_STREAMS) opts->stripe = 0;
+    if (opts->stripe == 0) opts->stripe_flows = 0;
+    if (opts->stripe) opts->fec = FEC_NONE; // a repair's ack_num has no room for the stripe offset
+    // resuming takes a known size and one connection writing the file in order
+    if (opts->file_size == 0 || opts->stripe) opts->resume = 0;
+    if (opts->resume == 0) {
+        opts->resume_from = 0;
+        opts->resume_crc = 0;
+    }
+    return 1;
+}
+
 // generate initial sequence number
 uint32_t generate_initial_seq(void) {
     return rand() % 1000000 + 1000; // random starting seq num
@@ -119,66 +187,816 @@ int is_packet_lost(float loss_rate) {
     return simulate_packet_loss(loss_rate);
 }
 
-void calculate_md5(const char* filename) {
-    unsigned char buf[4096];
-    unsigned char digest[EVP_MAX_MD_SIZE];
-    unsigned int digest_len = 0;
+// end-to-end digests: both ends hash the file's bytes in order as they
+// go out or are committed, so nothing is read back after the transfer
+static const struct {
+    const char* name;
+    const char* label;
+    const EVP_MD* (*md)(void);
+} digest_algorithms[] = {
+    [DIGEST_MD5]     = { "md5",        "MD5",        EVP_md5 },
+    [DIGEST_SHA256]  = { "sha256",     "SHA256",     EVP_sha256 },
+    [DIGEST_BLAKE2S] = { "blake2s256", "BLAKE2S256", EVP_blake2s256 },
+    [DIGEST_BLAKE2B] = { "blake2b512", "BLAKE2B512", EVP_blake2b512 },
+};
+
+int digest_from_name(const char* name, digest_algo_t* algo) {
+    for (int i = 0; i < DIGEST_COUNT; i++) {
+        if (strcmp(name, digest_algorithms[i].name) == 0) {
+            *algo = (digest_algo_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char* digest_name(digest_algo_t algo) {
+    return digest_algorithms[algo].name;
+}
+
+int digest_init(struct sham_digest* d, digest_algo_t algo) {
+    memset(d, 0, sizeof(*d));
+    d->algo = algo;
+    d->ctx = EVP_MD_CTX_new();
+    if (!d->ctx || EVP_DigestInit_ex(d->ctx, digest_algorithms[algo].md(), NULL) != 1) {
+        fprintf(stderr, "failed to set up %s digest\n", digest_algorithms[algo].name);
+        EVP_MD_CTX_free(d->ctx);
+        d->ctx = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// fold in the part of [offset, offset + len) just past what the digest has
+// covered; anything that starts beyond it waits for the gap to be filled
+void digest_extend(struct sham_digest* d, uint64_t offset, const void* data, size_t len) {
+    if (!d->ctx || offset > d->bytes || offset + len <= d->bytes) return;
+    size_t skip = d->bytes - offset;
+    EVP_DigestUpdate(d->ctx, (const char*)data + skip, len - skip);
+    d->bytes += len - skip;
+}
+
+// returns the digest length, or -1
+int digest_final(struct sham_digest* d, unsigned char* out) {
+    unsigned int len = 0;
+    if (!d->ctx || EVP_DigestFinal_ex(d->ctx, out, &len) != 1) return -1;
+    EVP_MD_CTX_free(d->ctx);
+    d->ctx = NULL;
+    return (int)len;
+}
+
+void digest_free(struct sham_digest* d) {
+    EVP_MD_CTX_free(d->ctx);
+    d->ctx = NULL;
+}
+
+// lowercase hex after the algorithm's label, e.g. "MD5: 9e10..."
+void digest_print(digest_algo_t algo, const unsigned char* digest, int len) {
+    char hex[DIGEST_MAX * 2 + 1];
+    for (int i = 0; i < len; i++) {
+        sprintf(hex + i * 2, "%02x", digest[i]);
+    }
+    hex[len * 2] = '\0';
+    printf("%s: %s\n", digest_algorithms[algo].label, hex);
+}
+
+// digest of the first size bytes of an open file, for when they were not
+// hashed on their way through (a striped transfer); returns its length or -1
+int digest_file(int fd, uint64_t size, digest_algo_t algo, unsigned char* out) {
+    struct sham_digest d;
+    size_t chunk = 1 << 20;
+    char* buf = malloc(chunk);
+    if (!buf || digest_init(&d, algo) < 0) {
+        free(buf);
+        return -1;
+    }
+    posix_fadvise(fd, 0, (off_t)size, POSIX_FADV_SEQUENTIAL);
+    while (d.bytes < size) {
+        size_t want = size - d.bytes < chunk ? size - d.bytes : chunk;
+        ssize_t n = pread(fd, buf, want, (off_t)d.bytes);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            perror("failed to read file for digest");
+            digest_free(&d);
+            free(buf);
+            return -1;
+        }
+        digest_extend(&d, d.bytes, buf, n);
+    }
+    free(buf);
+    return digest_final(&d, out);
+}
+
+// send a header and a payload that lives elsewhere (e.g. a file mapping)
+// as one datagram, without assembling a sham_packet first
+int send_packet_iov(int sockfd, struct sockaddr_in* addr, const struct sham_header* header,
+                    const void* data, int data_len) {
+    uint32_t crc;
+    struct iovec iov[3];
+    iov[0].iov_base = (void*)header;
+    iov[0].iov_len = sizeof(*header);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = data_len;
+    iov[2].iov_base = &crc;
+    iov[2].iov_len = packet_seal(header, data, data_len, &crc);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr;
+    msg.msg_namelen = sizeof(*addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+
+    int bytes_sent = sendmsg(sockfd, &msg, 0);
+    if (bytes_sent < 0) {
+        perror("sendmsg failed");
+        return -1;
+    }
+    return bytes_sent;
+}
+
+// map a window of the file that covers [offset, offset + len), keeping
+// up to one full send window behind offset mapped for retransmissions
+static int file_map_window(struct file_map* fm, off_t offset, size_t len) {
+    long page = sysconf(_SC_PAGESIZE);
+    off_t behind = (off_t)MAX_WINDOW * MAX_DATA_SIZE;
+    off_t start = offset > behind ? offset - behind : 0;
+    start -= start % page;
+
+    size_t map_len = MAP_WINDOW_BYTES;
+    if ((off_t)map_len > fm->size - start) map_len = fm->size - start;
+    if (offset + (off_t)len > start + (off_t)map_len) return -1;
+
+    if (fm->base) munmap(fm->base, fm->map_len);
+    fm->base = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fm->fd, start);
+    if (fm->base == MAP_FAILED) {
+        perror("mmap failed");
+        fm->base = NULL;
+        return -1;
+    }
+    madvise(fm->base, map_len, MADV_SEQUENTIAL | MADV_WILLNEED);
+    fm->map_off = start;
+    fm->map_len = map_len;
+    log_event("MMAP OFF=%lld LEN=%zu", (long long)start, map_len);
+    return 0;
+}
+
+int file_map_open(struct file_map* fm, const char* filename) {
+    memset(fm, 0, sizeof(*fm));
+    fm->fd = open(filename, O_RDONLY);
+    if (fm->fd < 0) {
+        fprintf(stderr, "failed to open input file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fm->fd, &st) < 0 || st.st_size <= 0) {
+        fprintf(stderr, "input file '%s' is empty or unreadable\n", filename);
+        close(fm->fd);
+        return -1;
+    }
+    fm->size = st.st_size;
+
+    if (file_map_window(fm, 0, 0) < 0) {
+        close(fm->fd);
+        return -1;
+    }
+    return 0;
+}
+
+// whether [offset, offset + len) is inside the current mapping
+int file_map_covers(const struct file_map* fm, off_t offset, size_t len) {
+    return offset >= fm->map_off && offset + (off_t)len <= fm->map_off + (off_t)fm->map_len;
+}
+
+// pointer to len bytes at offset, sliding the mapping if it is not covered
+const char* file_map_slice(struct file_map* fm, off_t offset, size_t len) {
+    if (!file_map_covers(fm, offset, len)) {
+        if (file_map_window(fm, offset, len) < 0) return NULL;
+    }
+    return fm->base + (offset - fm->map_off);
+}
+
+void file_map_close(struct file_map* fm) {
+    if (fm->base) munmap(fm->base, fm->map_len);
+    if (fm->fd >= 0) close(fm->fd);
+    fm->base = NULL;
+    fm->fd = -1;
+}
+
+// ---- batched transmission (sendmmsg + UDP GSO, optional MSG_ZEROCOPY) ----
+
+// the kernel caps a GSO send at 64 segments and one UDP datagram's size
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_BYTES 65000
+
+static int gso_supported(int sockfd) {
+    int val = 0;
+    socklen_t len = sizeof(val);
+    return getsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &val, &len) == 0;
+}
+
+int batch_init(struct send_batch* b, int sockfd, struct sockaddr_in* addr, int max, int mss,
+               int use_gso, int use_uring) {
+    memset(b, 0, sizeof(*b));
+    b->sockfd = sockfd;
+    b->addr = addr;
+    b->max = max < 1 ? 1 : max;
+    b->nslabs = 1;
+    b->slot_size = mss;
+    b->frames = calloc(b->max, sizeof(*b->frames));
+    b->lens = calloc(b->max, sizeof(*b->lens));
+    b->iov = calloc(BATCH_IOV * b->max, sizeof(*b->iov));
+    b->msgs = calloc(b->max, sizeof(*b->msgs));
+    b->cmsgs = calloc(b->max, CMSG_SPACE(sizeof(uint16_t)));
+    b->payload = malloc((size_t)b->max * b->slot_size);
+    b->slabs = calloc(1, sizeof(*b->slabs));
+    if (!b->frames || !b->lens || !b->iov || !b->msgs || !b->cmsgs || !b->payload || !b->slabs) {
+        perror("failed to allocate send batch");
+        batch_free(b);
+        return -1;
+    }
+    b->gso = use_gso && gso_supported(sockfd);
+
+    // one sqe per message, so a full batch goes out in one io_uring_enter
+    if (use_uring) {
+        b->ring = malloc(sizeof(*b->ring));
+        if (!b->ring || uring_init(b->ring, b->max, 0, sockfd) < 0) {
+            log_event("BATCH URING UNAVAILABLE errno=%d", errno);
+            free(b->ring);
+            b->ring = NULL;
+        }
+    }
+    log_event("BATCH SIZE=%d GSO=%d URING=%d", b->max, b->gso, b->ring != NULL);
+    return 0;
+}
+
+// let sends of at least min_bytes go out with MSG_ZEROCOPY. frames and
+// payload slots get ZEROCOPY_SLABS generations so the next batch can be
+// filled while the kernel still holds the last ones
+int batch_zerocopy(struct send_batch* b, int min_bytes) {
+    int on = 1;
+    if (setsockopt(b->sockfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+        log_event("BATCH ZEROCOPY UNAVAILABLE errno=%d", errno);
+        return -1;
+    }
+
+    struct batch_frame* frames = calloc((size_t)ZEROCOPY_SLABS * b->max, sizeof(*frames));
+    char* payload = malloc((size_t)ZEROCOPY_SLABS * b->max * b->slot_size);
+    struct batch_slab* slabs = calloc(ZEROCOPY_SLABS, sizeof(*slabs));
+    if (!frames || !payload || !slabs) {
+        perror("failed to allocate zerocopy slabs");
+        free(frames);
+        free(payload);
+        free(slabs);
+        return -1;
+    }
+    free(b->frames);
+    free(b->payload);
+    free(b->slabs);
+    b->frames = frames;
+    b->payload = payload;
+    b->slabs = slabs;
+    b->nslabs = ZEROCOPY_SLABS;
+    b->slab = 0;
+    b->zerocopy = 1;
+    b->zc_min = min_bytes;
+    log_event("BATCH ZEROCOPY MIN=%d SLABS=%d", min_bytes, b->nslabs);
+    return 0;
+}
 
-    FILE* f = fopen(filename, "rb");
-    if (!f) {
-        perror("failed to open file for md5");
-        return;
+void batch_free(struct send_batch* b) {
+    // pages of in-flight zerocopy sends must not be freed under the kernel
+    if (b->zerocopy) batch_release(b);
+    free(b->frames);
+    free(b->lens);
+    free(b->iov);
+    free(b->msgs);
+    free(b->cmsgs);
+    free(b->payload);
+    free(b->slabs);
+    if (b->ring) {
+        uring_free(b->ring);
+        free(b->ring);
     }
+    memset(b, 0, sizeof(*b));
+}
+
+// completed notification ids [lo, hi] release whatever slabs they cover
+static void batch_complete(struct send_batch* b, uint32_t lo, uint32_t hi, int copied) {
+    unsigned long n = hi - lo + 1;
+    b->zc_completed += n;
+    if (copied) b->zc_copied += n;
 
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    if (!ctx) {
-        perror("EVP_MD_CTX_new failed");
-        fclose(f);
-        return;
+    for (int i = 0; i < b->nslabs; i++) {
+        struct batch_slab* s = &b->slabs[i];
+        if (s->pending == 0) continue;
+        int32_t from = (int32_t)(lo - s->zc_lo);
+        int32_t to = (int32_t)(hi + 1 - s->zc_lo);
+        int32_t size = (int32_t)(s->zc_hi - s->zc_lo);
+        if (from < 0) from = 0;
+        if (to > size) to = size;
+        if (to > from) s->pending -= to - from;
     }
 
-    if (EVP_DigestInit_ex(ctx, EVP_md5(), NULL) != 1) {
-        fprintf(stderr, "EVP_DigestInit_ex failed\n");
-        EVP_MD_CTX_free(ctx);
-        fclose(f);
-        return;
+    // no zerocopy path to this peer (loopback, no scatter-gather): the
+    // kernel copies regardless, so pinning pages only adds work
+    if (b->zerocopy && b->zc_completed >= 16 && 2 * b->zc_copied > b->zc_completed) {
+        log_event("BATCH ZEROCOPY OFF COPIED=%lu COMPLETED=%lu", b->zc_copied, b->zc_completed);
+        b->zc_min = 0;
     }
+}
 
+// drain zerocopy completions from the socket error queue without blocking;
+// returns how many notifications were read
+int batch_reap(struct send_batch* b) {
+    int reaped = 0;
     while (1) {
-        size_t n = fread(buf, 1, sizeof(buf), f);
-        if (n > 0) {
-            if (EVP_DigestUpdate(ctx, buf, n) != 1) {
-                fprintf(stderr, "EVP_DigestUpdate failed\n");
-                EVP_MD_CTX_free(ctx);
-                fclose(f);
-                return;
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(b->sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR) continue;
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cm), sizeof(err));
+            if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0) continue;
+            batch_complete(b, err.ee_info, err.ee_data, err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+            reaped++;
+        }
+    }
+    return reaped;
+}
+
+// block until slab i is no longer referenced by the kernel
+static int batch_wait_slab(struct send_batch* b, int i) {
+    int waits = 0;
+    while (b->slabs[i].pending > 0) {
+        if (batch_reap(b) > 0) continue;
+
+        // completions raise POLLERR; a second without one means they are lost
+        struct pollfd pfd = { b->sockfd, 0, 0 };
+        int r = poll(&pfd, 1, 1000);
+        if (r < 0 && errno != EINTR) return -1;
+        if (r == 0 && ++waits >= 5) {
+            log_event("BATCH ZEROCOPY COMPLETIONS LOST PENDING=%d", b->slabs[i].pending);
+            b->slabs[i].pending = 0;
+        }
+    }
+    return 0;
+}
+
+// start filling the next slab only once the kernel is done with it
+static int batch_begin(struct send_batch* b) {
+    if (b->count > 0 || b->nslabs == 1) return 0;
+    return batch_wait_slab(b, b->slab);
+}
+
+// flush and wait until the kernel holds no pages of ours, e.g. before a
+// file mapping that queued datagrams point into is moved or unmapped
+int batch_release(struct send_batch* b) {
+    if (batch_flush(b) < 0) return -1;
+    for (int i = 0; i < b->nslabs; i++) {
+        if (batch_wait_slab(b, i) < 0) return -1;
+    }
+    return 0;
+}
+
+// payload storage for the next queued datagram, flushing first if full
+char* batch_slot(struct send_batch* b) {
+    if (b->count == b->max && batch_flush(b) < 0) return NULL;
+    if (batch_begin(b) < 0) return NULL;
+    return b->payload + ((size_t)b->slab * b->max + b->count) * b->slot_size;
+}
+
+// queue a datagram; data must stay valid until the next flush (with
+// zerocopy, until batch_release)
+int batch_add(struct send_batch* b, const struct sham_header* header, const void* data, int data_len) {
+    if (b->count == b->max && batch_flush(b) < 0) return -1;
+    if (batch_begin(b) < 0) return -1;
+
+    int i = b->count++;
+    struct batch_frame* f = &b->frames[(size_t)b->slab * b->max + i];
+    struct iovec* iov = &b->iov[BATCH_IOV * i];
+    f->header = *header;
+    b->lens[i] = data_len;
+    iov[0].iov_base = &f->header;
+    iov[0].iov_len = sizeof(f->header);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = data_len;
+    iov[2].iov_base = &f->crc;
+    iov[2].iov_len = packet_seal(header, data, data_len, &f->crc);
+    return 0;
+}
+
+// queue a preformatted datagram, header, payload and room for the crc
+// trailer in one buffer that must stay unchanged until it is sent (with
+// zerocopy, until released)
+int batch_add_packet(struct send_batch* b, struct sham_packet* packet, int data_len) {
+    if (b->count == b->max && batch_flush(b) < 0) return -1;
+    if (batch_begin(b) < 0) return -1;
+
+    int i = b->count++;
+    struct iovec* iov = &b->iov[BATCH_IOV * i];
+    b->lens[i] = data_len;
+    iov[0].iov_base = packet;
+    iov[0].iov_len = sizeof(packet->header) + data_len +
+                     packet_seal(&packet->header, packet->data, data_len, packet->data + data_len);
+    // the other two stay empty, so every datagram has BATCH_IOV for batch_build
+    iov[1].iov_base = NULL;
+    iov[1].iov_len = 0;
+    iov[2].iov_base = NULL;
+    iov[2].iov_len = 0;
+    return 0;
+}
+
+// ---- packet pool ----
+
+#define HUGE_PAGE_BYTES (2UL * 1024 * 1024)
+
+// count buffers of header + mss + crc trailer bytes, faulted in up front. explicit huge
+// pages are used when the system has some reserved, transparent ones are
+// asked for otherwise
+int packet_pool_init(struct packet_pool* pool, int count, int mss) {
+    memset(pool, 0, sizeof(*pool));
+    pool->count = count;
+    pool->stride = (sizeof(struct sham_header) + mss + CRC_TRAILER + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    pool->bytes = (pool->stride * count + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+
+    void* base = mmap(NULL, pool->bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    pool->huge = base != MAP_FAILED;
+    if (base == MAP_FAILED) {
+        base = mmap(NULL, pool->bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            perror("failed to map packet pool");
+            return -1;
+        }
+        madvise(base, pool->bytes, MADV_HUGEPAGE);
+        for (size_t off = 0; off < pool->bytes; off += 4096) ((volatile char*)base)[off] = 0;
+    }
+    pool->base = base;
+    log_event("POOL BUFFERS=%d STRIDE=%zu BYTES=%zu HUGE=%d", count, pool->stride, pool->bytes, pool->huge);
+    return 0;
+}
+
+void packet_pool_free(struct packet_pool* pool) {
+    if (pool->base) munmap(pool->base, pool->bytes);
+    pool->base = NULL;
+}
+
+// the buffer that window slot index (any running count) maps to
+struct sham_packet* packet_pool_get(struct packet_pool* pool, int index) {
+    return (struct sham_packet*)(pool->base + (size_t)(index % pool->count) * pool->stride);
+}
+
+static size_t msg_bytes_n(const struct iovec* iov, size_t n) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++) bytes += iov[i].iov_len;
+    return bytes;
+}
+
+// build one mmsghdr per datagram, or per run of equal-size datagrams
+// when GSO lets the kernel split a super-buffer for us
+static int batch_build(struct send_batch* b) {
+    int nmsgs = 0;
+    int i = 0;
+    while (i < b->count) {
+        struct mmsghdr* m = &b->msgs[nmsgs];
+        memset(m, 0, sizeof(*m));
+        m->msg_hdr.msg_name = b->addr;
+        m->msg_hdr.msg_namelen = sizeof(*b->addr);
+        m->msg_hdr.msg_iov = &b->iov[BATCH_IOV * i];
+
+        // every segment but the last must be exactly gso_size bytes
+        // zerocopy pins every iovec as page frags of its own (a header, the
+        // pages of its payload and a trailer), so a zerocopy super-datagram
+        // can only carry as many segments as fit in one skb
+        int n = 1;
+        int seg = (int)msg_bytes_n(&b->iov[BATCH_IOV * i], BATCH_IOV);
+        int max_segs = GSO_MAX_SEGMENTS;
+        if (b->zc_min > 0) {
+            max_segs = ZEROCOPY_MAX_FRAGS / (3 + b->lens[i] / 4096);
+            if (max_segs < 1) max_segs = 1;
+        }
+        if (b->gso) {
+            while (i + n < b->count && n < max_segs &&
+                   (n + 1) * seg <= GSO_MAX_BYTES &&
+                   b->lens[i + n - 1] == b->lens[i] && b->lens[i + n] <= b->lens[i]) {
+                n++;
             }
         }
-        if (n < sizeof(buf)) {
-            if (feof(f)) break;
-            if (ferror(f)) {
-                perror("fread failed");
-                EVP_MD_CTX_free(ctx);
-                fclose(f);
-                return;
+        m->msg_hdr.msg_iovlen = BATCH_IOV * n;
+
+        if (n > 1) {
+            char* buf = b->cmsgs + (size_t)nmsgs * CMSG_SPACE(sizeof(uint16_t));
+            m->msg_hdr.msg_control = buf;
+            m->msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr* cm = CMSG_FIRSTHDR(&m->msg_hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t gso_size = seg;
+            memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+        }
+
+        i += n;
+        nmsgs++;
+    }
+    return nmsgs;
+}
+
+static size_t msg_bytes(const struct msghdr* h) {
+    return msg_bytes_n(h->msg_iov, h->msg_iovlen);
+}
+
+static int batch_use_zerocopy(const struct send_batch* b, const struct mmsghdr* m) {
+    return b->zc_min > 0 && msg_bytes(&m->msg_hdr) >= (size_t)b->zc_min;
+}
+
+// send everything queued with as few sendmmsg (or io_uring_enter) calls as
+// the kernel allows. runs of messages big enough for MSG_ZEROCOPY go out
+// with it and pin the current slab until their completions are reaped
+int batch_flush(struct send_batch* b) {
+    if (b->count == 0) return 0;
+
+    int nmsgs = batch_build(b);
+    struct batch_slab* slab = &b->slabs[b->slab];
+    slab->zc_lo = b->zc_next;
+    slab->zc_hi = b->zc_next;
+    slab->pending = 0;
+
+    int sent = 0;
+    while (sent < nmsgs) {
+        // sendmmsg takes one flags value: split where the choice changes
+        int zc = batch_use_zerocopy(b, &b->msgs[sent]);
+        int run = 1;
+        while (sent + run < nmsgs && batch_use_zerocopy(b, &b->msgs[sent + run]) == zc) run++;
+        int flags = zc ? MSG_ZEROCOPY : 0;
+
+        int r = b->ring ? uring_sendmsgs(b->ring, b->msgs + sent, run, flags)
+                        : sendmmsg(b->sockfd, b->msgs + sent, run, flags);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (zc && (errno == ENOBUFS || errno == EMSGSIZE)) {
+                // pinned pages count against RLIMIT_MEMLOCK and frags per skb
+                // are limited: copy from now on
+                log_event("BATCH ZEROCOPY OFF errno=%d", errno);
+                b->zc_min = 0;
+                continue;
+            }
+            if (b->gso && sent == 0 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+                // no GSO on this path after all: fall back to one datagram each
+                log_event("BATCH GSO UNAVAILABLE errno=%d", errno);
+                b->gso = 0;
+                return batch_flush(b);
             }
+            perror(b->ring ? "io_uring sendmsg failed" : "sendmmsg failed");
+            b->count = 0;
+            return -1;
         }
+        if (zc) {
+            // every successful zerocopy send gets the next notification id
+            b->zc_next += r;
+            b->zc_sends += r;
+            slab->zc_hi = b->zc_next;
+            slab->pending += r;
+        }
+        sent += r;
+        b->syscalls++;
     }
 
-    if (EVP_DigestFinal_ex(ctx, digest, &digest_len) != 1) {
-        fprintf(stderr, "EVP_DigestFinal_ex failed\n");
-        EVP_MD_CTX_free(ctx);
-        fclose(f);
-        return;
+    b->datagrams += b->count;
+    b->count = 0;
+    if (slab->pending > 0) b->slab = (b->slab + 1) % b->nslabs;
+    return 0;
+}
+
+// ---- batched receive (recvmmsg + UDP GRO) ----
+
+// buffers hold datagrams of up to mss payload bytes (a whole GRO train with use_gro)
+int recv_batch_init(struct recv_batch* rb, int sockfd, int max, int mss, int use_gro, int use_uring) {
+    memset(rb, 0, sizeof(*rb));
+    rb->max = max < 1 ? 1 : max;
+
+    if (use_gro) {
+        int on = 1;
+        if (setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0) {
+            rb->gro = 1;
+        } else {
+            log_event("RECV GRO UNAVAILABLE errno=%d", errno);
+        }
     }
-    EVP_MD_CTX_free(ctx);
-    fclose(f);
 
-    // print lowercase hex MD5
-    char hex[digest_len * 2 + 1];
-    for (unsigned int i = 0; i < digest_len; i++) {
-        sprintf(hex + i * 2, "%02x", digest[i]);
+    // a coalesced super-datagram can be as large as a UDP datagram gets
+    rb->buf_size = rb->gro ? 65536 : sizeof(struct sham_header) + (size_t)mss + CRC_TRAILER;
+    rb->wait_fd = sockfd;
+
+    // multishot receive: datagrams land in ring buffers, several batches deep
+    if (use_uring) {
+        unsigned nbufs = 64;
+        while (nbufs < 4u * rb->max) nbufs *= 2;
+        rb->ring = malloc(sizeof(*rb->ring));
+        if (rb->ring && uring_init(rb->ring, 8, nbufs + 8, sockfd) == 0 &&
+            uring_recv_start(rb->ring, nbufs, rb->buf_size, rb->gro ? CMSG_SPACE(sizeof(int)) : 0) == 0) {
+            rb->wait_fd = rb->ring->fd;
+        } else {
+            log_event("RECV URING UNAVAILABLE errno=%d", errno);
+            if (rb->ring) uring_free(rb->ring);
+            free(rb->ring);
+            rb->ring = NULL;
+        }
+    }
+
+    rb->bufs = rb->ring ? NULL : malloc(rb->max * rb->buf_size);
+    rb->msgs = calloc(rb->max, sizeof(*rb->msgs));
+    rb->iov = calloc(rb->max, sizeof(*rb->iov));
+    rb->addrs = calloc(rb->max, sizeof(*rb->addrs));
+    rb->cmsgs = calloc(rb->max, CMSG_SPACE(sizeof(int)));
+    if ((!rb->bufs && !rb->ring) || !rb->msgs || !rb->iov || !rb->addrs || !rb->cmsgs) {
+        perror("failed to allocate receive batch");
+        recv_batch_free(rb);
+        return -1;
+    }
+    log_event("RECV BATCH SIZE=%d GRO=%d URING=%d", rb->max, rb->gro, rb->ring != NULL);
+    return 0;
+}
+
+void recv_batch_free(struct recv_batch* rb) {
+    free(rb->bufs);
+    free(rb->msgs);
+    free(rb->iov);
+    free(rb->addrs);
+    free(rb->cmsgs);
+    if (rb->ring) {
+        uring_free(rb->ring);
+        free(rb->ring);
+    }
+    memset(rb, 0, sizeof(*rb));
+}
+
+// take whatever is queued, up to one batch; 0 once the socket is drained
+int recv_batch_read(struct recv_batch* rb, int sockfd) {
+    if (rb->ring) {
+        unsigned long enters = rb->ring->enters;
+        int n = uring_recv_batch(rb->ring, rb);
+        rb->syscalls += rb->ring->enters - enters;
+        if (n < 0) {
+            perror("io_uring recvmsg failed");
+            rb->count = 0;
+            return -1;
+        }
+        rb->count = n;
+        rb->cur = 0;
+        rb->cur_off = 0;
+        rb->datagrams += n;
+        return n;
+    }
+
+    for (int i = 0; i < rb->max; i++) {
+        rb->iov[i].iov_base = rb->bufs + i * rb->buf_size;
+        rb->iov[i].iov_len = rb->buf_size;
+        struct msghdr* h = &rb->msgs[i].msg_hdr;
+        memset(h, 0, sizeof(*h));
+        h->msg_name = &rb->addrs[i];
+        h->msg_namelen = sizeof(rb->addrs[i]);
+        h->msg_iov = &rb->iov[i];
+        h->msg_iovlen = 1;
+        if (rb->gro) {
+            h->msg_control = rb->cmsgs + i * CMSG_SPACE(sizeof(int));
+            h->msg_controllen = CMSG_SPACE(sizeof(int));
+        }
+    }
+
+    // never blocks: an edge-triggered reactor drains until this returns 0
+    int n;
+    do {
+        n = recvmmsg(sockfd, rb->msgs, rb->max, MSG_WAITFORONE | MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        rb->count = 0;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        perror("recvmmsg failed");
+        return -1;
+    }
+
+    rb->count = n;
+    rb->cur = 0;
+    rb->cur_off = 0;
+    rb->syscalls++;
+    rb->datagrams += n;
+    return n;
+}
+
+// segment size of a GRO super-datagram, or its full length if not coalesced
+static size_t recv_batch_seg_size(const struct recv_batch* rb, int i) {
+    struct msghdr* h = &rb->msgs[i].msg_hdr;
+    size_t len = rb->msgs[i].msg_len;
+    if (!rb->gro) return len;
+
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(h); cm; cm = CMSG_NXTHDR(h, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int gso_size;
+            memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+            if (gso_size > 0 && (size_t)gso_size < len) return gso_size;
+        }
+    }
+    return len;
+}
+
+// next packet of the batch, splitting coalesced datagrams; 0 when drained
+int recv_batch_next(struct recv_batch* rb, struct sham_packet** packet, int* len,
+                    struct sockaddr_in* addr) {
+    while (rb->cur < rb->count) {
+        size_t total = rb->msgs[rb->cur].msg_len;
+        if (rb->cur_off >= total) {
+            rb->cur++;
+            rb->cur_off = 0;
+            continue;
+        }
+
+        size_t seg = recv_batch_seg_size(rb, rb->cur);
+        size_t take = total - rb->cur_off < seg ? total - rb->cur_off : seg;
+        *packet = (struct sham_packet*)((char*)rb->iov[rb->cur].iov_base + rb->cur_off);
+        *len = take;
+        if (addr) *addr = rb->addrs[rb->cur];
+        rb->cur_off += take;
+        rb->segments++;
+        return 1;
     }
-    hex[digest_len * 2] = '\0';
-    printf("MD5: %s\n", hex);
+    return 0;
 }
+
+// ---- reactor: edge-triggered epoll plus the timer heap ----
+
+int reactor_init(struct reactor* r) {
+    memset(r, 0, sizeof(*r));
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd < 0) {
+        perror("epoll_create1 failed");
+        return -1;
+    }
+    return 0;
+}
+
+// watch fd; events normally EPOLLIN | EPOLLET, in which case the callback
+// must read until EAGAIN (MSG_DONTWAIT) or it will not be told again
+int reactor_add(struct reactor* r, struct io_watch* w, int fd, uint32_t events,
+                io_cb cb, void* arg) {
+    w->fd = fd;
+    w->cb = cb;
+    w->arg = arg;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = w;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl failed");
+        return -1;
+    }
+    return 0;
+}
+
+void reactor_stop(struct reactor* r) {
+    r->running = 0;
+}
+
+// dispatch fd events and timers until a callback calls reactor_stop
+int reactor_run(struct reactor* r) {
+    struct epoll_event events[REACTOR_EVENTS];
+    r->running = 1;
+    while (r->running) {
+        long wait_us = timers_next_wait_us(&r->timers, monotonic_us());
+        int timeout_ms = wait_us < 0 ? -1 : (int)((wait_us + 999) / 1000);
+
+        int n = epoll_wait(r->epfd, events, REACTOR_EVENTS, timeout_ms);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            return -1;
+        }
+        r->wakeups++;
+
+        for (int i = 0; i < n && r->running; i++) {
+            struct io_watch* w = events[i].data.ptr;
+            w->cb(w->arg, events[i].events);
+        }
+        if (r->running) timers_run(&r->timers, monotonic_us());
+    }
+    return 0;
+}
+
+// closing the epoll fd drops every watch; the watched fds stay open
+void reactor_free(struct reactor* r) {
+    timers_free(&r->timers);
+    if (r->epfd >= 0) close(r->epfd);
+    r->epfd = -1;
+}
+
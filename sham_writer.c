@@ -0,0 +1,359 @@
+#include "sham.h"
+#include <sys/eventfd.h>
+
+// background file writer: the receive loop copies each segment into the
+// output file's stage ring and queues a job; the writer thread puts it at
+// its final offset with pwritev, merging neighbours, so a slow disk only
+// shrinks the advertised window instead of holding up acks. the job queue
+// has a single producer and a single consumer, like the log rings.
+
+// write len bytes at offset, whatever pwrite returns short
+static int write_all(int fd, const char* data, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int write_vec(int fd, struct iovec* iov, int count, off_t offset) {
+    ssize_t total = 0;
+    for (int i = 0; i < count; i++) total += iov[i].iov_len;
+
+    ssize_t n = pwritev(fd, iov, count, offset);
+    if (n == total) return 0;
+    if (n < 0 && errno != EINTR) return -1;
+
+    // short write: finish iov by iov
+    if (n < 0) n = 0;
+    for (int i = 0; i < count; i++) {
+        size_t skip = (size_t)n < iov[i].iov_len ? (size_t)n : iov[i].iov_len;
+        n -= skip;
+        if (write_all(fd, (char*)iov[i].iov_base + skip, iov[i].iov_len - skip, offset + skip) < 0)
+            return -1;
+        offset += iov[i].iov_len;
+    }
+    return 0;
+}
+
+// keep dirty pages per file bounded: start writeback of what was written
+// since the last call and wait for the range before it (sync_file_range)
+static void writer_pace(struct disk_writer* w, struct write_stage* st, off_t offset, uint32_t len) {
+    if (st->dirty == 0 || offset < st->dirty_lo) st->dirty_lo = offset;
+    if (st->dirty == 0 || offset + len > st->dirty_hi) st->dirty_hi = offset + len;
+    st->dirty += len;
+    if ((off_t)st->dirty < w->writeback) return;
+
+    if (st->flush_hi > st->flush_lo)
+        sync_file_range(st->fd, st->flush_lo, st->flush_hi - st->flush_lo,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+    sync_file_range(st->fd, st->dirty_lo, st->dirty_hi - st->dirty_lo, SYNC_FILE_RANGE_WRITE);
+    st->flush_lo = st->dirty_lo;
+    st->flush_hi = st->dirty_hi;
+    st->dirty = 0;
+}
+
+// every job queued for the file before this one is written: make them
+// durable, then save the checkpoint that vouches for them
+static void writer_checkpoint(struct write_stage* st, struct write_job* job) {
+    if (fdatasync(st->fd) < 0)
+        log_event("CHECKPOINT SYNC FAILED: %s", strerror(errno));
+    else
+        ckpt_save(job->ckpt, (uint64_t)job->offset);
+    __atomic_add_fetch(&st->checkpointed, 1, __ATOMIC_RELEASE);
+}
+
+// every job queued for the file before this one is written: start reading
+// it back for the digest. writer_hash does that a chunk at a time between
+// passes over the queue, so the other files' writes are not held up
+static void writer_digest(struct disk_writer* w, struct write_stage* st, struct write_job* job) {
+    st->hash_size = (uint64_t)job->offset;
+    st->hash_out = job->digest;
+    st->hash_len = job->digest_len;
+    if (digest_init(&st->hash, job->algo) < 0) {
+        *st->hash_len = -1;
+        __atomic_add_fetch(&st->digested, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    posix_fadvise(st->fd, 0, (off_t)st->hash_size, POSIX_FADV_SEQUENTIAL);
+    st->hash_next = w->hashing;
+    w->hashing = st;
+}
+
+// one chunk more of each digest under way; returns how many finished
+static int writer_hash(struct disk_writer* w) {
+    struct write_stage** link = &w->hashing;
+    int finished = 0;
+    while (*link) {
+        struct write_stage* st = *link;
+        uint64_t want = st->hash_size - st->hash.bytes;
+        ssize_t n = 0;
+        if (want > 0) {
+            n = pread(st->fd, w->hash_buf, want < WRITE_HASH_CHUNK ? want : WRITE_HASH_CHUNK,
+                      (off_t)st->hash.bytes);
+            if (n < 0 && errno == EINTR) continue;
+            if (n > 0) digest_extend(&st->hash, st->hash.bytes, w->hash_buf, n);
+        }
+        if (n > 0 && st->hash.bytes < st->hash_size) {
+            link = &st->hash_next;
+            continue;
+        }
+
+        if (st->hash.bytes < st->hash_size) {
+            perror("failed to read file for digest");
+            digest_free(&st->hash);
+            *st->hash_len = -1;
+        } else {
+            *st->hash_len = digest_final(&st->hash, st->hash_out);
+        }
+        *link = st->hash_next;
+        __atomic_add_fetch(&st->digested, 1, __ATOMIC_RELEASE);
+        finished++;
+    }
+    return finished;
+}
+
+// write the job at tail and any that continue it in the same file;
+// returns how many jobs were consumed
+static uint32_t writer_run(struct disk_writer* w, uint32_t tail, uint32_t head) {
+    struct write_job* first = &w->jobs[tail % WRITE_QUEUE_JOBS];
+    struct write_stage* st = first->stage;
+    struct iovec iov[WRITE_IOV];
+    off_t next = first->offset;
+    uint32_t n = 0;
+
+    if (first->ckpt) {
+        writer_checkpoint(st, first);
+        return 1;
+    }
+    if (first->digest) {
+        writer_digest(w, st, first);
+        return 1;
+    }
+    while (tail + n != head && n < WRITE_IOV) {
+        struct write_job* job = &w->jobs[(tail + n) % WRITE_QUEUE_JOBS];
+        if (job->stage != st || job->offset != next || job->ckpt || job->digest) break;
+        iov[n].iov_base = st->data + job->pos;
+        iov[n].iov_len = job->len;
+        next += job->len;
+        n++;
+    }
+
+    if (write_vec(st->fd, iov, n, first->offset) < 0)
+        __atomic_add_fetch(&st->errors, 1, __ATOMIC_RELAXED);
+    else if (w->writeback > 0)
+        writer_pace(w, st, first->offset, next - first->offset);
+    w->writes++;
+
+    // the ring space goes back to the receive loop only after the write
+    uint64_t released = 0;
+    for (uint32_t i = 0; i < n; i++) released += w->jobs[(tail + i) % WRITE_QUEUE_JOBS].cost;
+    __atomic_add_fetch(&st->done, released, __ATOMIC_RELEASE);
+    return n;
+}
+
+// tell the receive loop that window space came back
+static void writer_notify(struct disk_writer* w) {
+    uint64_t one = 1;
+    if (write(w->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("disk writer notify");
+}
+
+static void* writer_main(void* arg) {
+    struct disk_writer* w = arg;
+    struct timespec idle = { 0, 1000000 }; // 1 ms between empty polls
+
+    while (1) {
+        int running = __atomic_load_n(&w->running, __ATOMIC_ACQUIRE);
+        uint32_t head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = w->tail;
+        if (tail == head && !w->hashing) {
+            if (!running) break;
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        while (tail != head) {
+            tail += writer_run(w, tail, head);
+            __atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+            // someone is waiting on a closed window: don't make them wait for the whole pass
+            if (__atomic_exchange_n(&w->wanted, 0, __ATOMIC_ACQ_REL)) writer_notify(w);
+        }
+        if (w->hashing && writer_hash(w) == 0 && tail == head)
+            continue; // nothing to report yet
+        writer_notify(w);
+    }
+    return NULL;
+}
+
+int disk_writer_start(struct disk_writer* w, off_t writeback) {
+    memset(w, 0, sizeof(*w));
+    w->writeback = writeback;
+    w->jobs = calloc(WRITE_QUEUE_JOBS, sizeof(*w->jobs));
+    w->hash_buf = malloc(WRITE_HASH_CHUNK);
+    w->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!w->jobs || !w->hash_buf || w->event_fd < 0) {
+        perror("failed to set up disk writer");
+        free(w->jobs);
+        free(w->hash_buf);
+        if (w->event_fd >= 0) close(w->event_fd);
+        return -1;
+    }
+
+    w->running = 1;
+    if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+        fprintf(stderr, "failed to start disk writer\n");
+        free(w->jobs);
+        free(w->hash_buf);
+        close(w->event_fd);
+        return -1;
+    }
+    return 0;
+}
+
+// writes everything still queued, then joins the thread
+void disk_writer_stop(struct disk_writer* w) {
+    __atomic_store_n(&w->running, 0, __ATOMIC_RELEASE);
+    pthread_join(w->thread, NULL);
+    log_event("DISK WRITER JOBS=%lu WRITES=%lu STALLS=%lu", w->queued, w->writes, w->stalls);
+    free(w->jobs);
+    free(w->hash_buf);
+    close(w->event_fd);
+    w->jobs = NULL;
+    w->hash_buf = NULL;
+}
+
+int write_stage_init(struct write_stage* st, int fd, uint32_t capacity) {
+    memset(st, 0, sizeof(*st));
+    st->data = malloc(capacity);
+    if (!st->data) return -1;
+    st->fd = fd;
+    st->capacity = capacity;
+    return 0;
+}
+
+void write_stage_free(struct write_stage* st) {
+    free(st->data);
+    st->data = NULL;
+}
+
+// bytes still waiting for the writer; they count against the receive window
+uint32_t write_stage_pending(const struct write_stage* st) {
+    return (uint32_t)(st->queued - __atomic_load_n(&st->done, __ATOMIC_ACQUIRE));
+}
+
+// block until the writer has caught up with this file, checkpoints and
+// digests included; -1 if any write failed
+int write_stage_wait(struct write_stage* st) {
+    struct timespec pause = { 0, 200000 };
+    while (write_stage_pending(st) > 0 ||
+           __atomic_load_n(&st->checkpointed, __ATOMIC_ACQUIRE) != st->checkpoints ||
+           write_stage_digesting(st))
+        nanosleep(&pause, NULL);
+    return __atomic_load_n(&st->errors, __ATOMIC_RELAXED) > 0 ? -1 : 0;
+}
+
+// a digest job for this file is still queued or running
+int write_stage_digesting(const struct write_stage* st) {
+    return __atomic_load_n(&st->digested, __ATOMIC_ACQUIRE) != st->digests;
+}
+
+// queue len bytes for offset; when the ring or the queue is full they are
+// written here instead, which is slow but never loses data
+int disk_writer_submit(struct disk_writer* w, struct write_stage* st, off_t offset,
+                       const char* data, uint32_t len) {
+    uint32_t pos = st->head;
+    uint32_t skip = 0;
+    if (len > st->capacity - pos) {
+        skip = st->capacity - pos; // keep each segment contiguous
+        pos = 0;
+    }
+
+    uint32_t head = w->head;
+    if (write_stage_pending(st) + skip + len > st->capacity ||
+        head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == WRITE_QUEUE_JOBS) {
+        w->stalls++;
+        if (write_all(st->fd, data, len, offset) < 0) {
+            __atomic_add_fetch(&st->errors, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        return 0;
+    }
+
+    memcpy(st->data + pos, data, len);
+    st->head = pos + len == st->capacity ? 0 : pos + len;
+    st->queued += skip + len;
+
+    struct write_job* job = &w->jobs[head % WRITE_QUEUE_JOBS];
+    job->stage = st;
+    job->offset = offset;
+    job->pos = pos;
+    job->len = len;
+    job->cost = skip + len;
+    job->ckpt = NULL;
+    job->digest = NULL;
+    __atomic_store_n(&w->head, head + 1, __ATOMIC_RELEASE);
+    w->queued++;
+    return 0;
+}
+
+// queue a checkpoint of the first committed bytes behind everything the
+// file has queued so far; -1 if the queue is full, to try again later
+int disk_writer_checkpoint(struct disk_writer* w, struct write_stage* st, struct sham_checkpoint* ck,
+                           uint64_t committed) {
+    uint32_t head = w->head;
+    if (head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == WRITE_QUEUE_JOBS) return -1;
+
+    struct write_job* job = &w->jobs[head % WRITE_QUEUE_JOBS];
+    job->stage = st;
+    job->offset = (off_t)committed;
+    job->pos = 0;
+    job->len = 0;
+    job->cost = 0;
+    job->ckpt = ck;
+    job->digest = NULL;
+    st->checkpoints++;
+    __atomic_store_n(&w->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// queue a digest of the first size bytes of the file behind everything it
+// has queued so far; the writer stores it in out and its length (or -1) in
+// len. -1 if the queue is full
+int disk_writer_digest(struct disk_writer* w, struct write_stage* st, uint64_t size, digest_algo_t algo,
+                       unsigned char* out, int* len) {
+    uint32_t head = w->head;
+    if (head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == WRITE_QUEUE_JOBS) return -1;
+
+    struct write_job* job = &w->jobs[head % WRITE_QUEUE_JOBS];
+    job->stage = st;
+    job->offset = (off_t)size;
+    job->pos = 0;
+    job->len = 0;
+    job->cost = 0;
+    job->ckpt = NULL;
+    job->digest = out;
+    job->digest_len = len;
+    job->algo = algo;
+    st->digests++;
+    __atomic_store_n(&w->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// ask for a completion event after every write rather than every pass
+void disk_writer_want(struct disk_writer* w) {
+    __atomic_store_n(&w->wanted, 1, __ATOMIC_RELEASE);
+}
+
+// clear the completion event before looking at the stages again
+void disk_writer_reap(struct disk_writer* w) {
+    uint64_t count;
+    while (read(w->event_fd, &count, sizeof(count)) == sizeof(count))
+        ;
+}
@@ -0,0 +1,38 @@
+#!/bin/sh
+# send a sparse file a little over 4 GiB across loopback, with data at the
+# start, on both sides of and across the 4 GiB mark, and at the end; the
+# output must match the input and the digest the server printed
+set -e
+
+bin=$(cd "$(dirname "$0")/.." && pwd)
+dir=$(mktemp -d "${TMPDIR:-/tmp}/sham_sparse.XXXXXX")
+server=
+trap '[ -n "$server" ] && kill $server 2>/dev/null; rm -rf "$dir"' EXIT
+cd "$dir"
+
+size=$((4160 * 1024 * 1024))
+truncate -s $size in.bin
+for seek in 0 8190 8191 8192 8318; do # 512 KB blocks: 1 MB at each
+    head -c 1048576 /dev/urandom | dd of=in.bin bs=512K seek=$seek conv=notrunc iflag=fullblock status=none
+done
+
+port=$((20000 + $$ % 20000))
+"$bin/server" $port > server.out 2>&1 &
+server=$!
+sleep 0.5
+if ! "$bin/client" 127.0.0.1 $port in.bin out.bin > client.out 2>&1; then
+    cat client.out server.out
+    echo "sparse_4g: client failed"
+    exit 1
+fi
+wait $server
+server=
+
+want=$(md5sum < in.bin | cut -c1-32)
+got=$(md5sum < received_file | cut -c1-32)
+if [ "$want" != "$got" ] || ! grep -q "MD5: $want" server.out; then
+    cat server.out
+    echo "sparse_4g: received_file differs ($want, $got)"
+    exit 1
+fi
+echo "sparse_4g: ok ($size bytes)"